@@ -0,0 +1,235 @@
+#include "AssetManager.hpp"
+
+#include <algorithm>
+#include <filesystem>
+
+static size_t mesh_bytes(const Mesh& mesh)
+{
+    return sizeof(PerVertex) * mesh.verticies.size()
+        + sizeof(uint32_t) * mesh.indices.size()
+        + sizeof(Meshlet) * mesh.meshlets.size()
+        + sizeof(uint32_t) * mesh.meshletVertices.size()
+        + sizeof(uint8_t) * mesh.meshletTriangles.size();
+}
+
+AssetManager::AssetManager(size_t budget, uint32_t numWorkers)
+    :_budget(budget), _residentBytes(0), _frame(0), _sequence(0), _stopping(false)
+{
+    for (uint32_t i = 0; i < numWorkers; ++i)
+    {
+        _workers.emplace_back(&AssetManager::worker_loop, this);
+    }
+}
+
+AssetManager::~AssetManager()
+{
+    {
+        std::lock_guard lg{_mutex};
+        _stopping = true;
+    }
+    _loadQueued.notify_all();
+
+    for (auto& worker : _workers)
+    {
+        worker.join();
+    }
+}
+
+MeshHandle AssetManager::request_mesh(const std::string& filename, AssetPriority priority)
+{
+    std::unique_lock lock{_mutex};
+
+    const auto found = std::find_if(_meshes.begin(), _meshes.end(), [&](const MeshAsset& asset) { return asset.filename == filename; });
+    const MeshHandle handle = found - _meshes.begin();
+    if (_meshes.end() == found)
+    {
+        _meshes.push_back({ filename, AssetState::Unloaded, priority, nullptr, 0, _frame, false });
+    }
+
+    auto& asset = _meshes[handle];
+    const bool queue = AssetState::Unloaded == asset.state || (AssetState::Queued == asset.state && priority > asset.priority);
+    if (queue)
+    {
+        // A raised priority leaves the old entry behind, workers skip it once the load has been claimed
+        asset.state = AssetState::Queued;
+        asset.priority = priority;
+        _queue.push({ priority, _sequence++, handle });
+        lock.unlock();
+        _loadQueued.notify_one();
+    }
+
+    return handle;
+}
+
+void AssetManager::reload_file(const std::string& filename)
+{
+    std::unique_lock lock{_mutex};
+
+    // Library paths are joined onto the OBJ's directory, so compare them the way the file system would
+    const auto path = std::filesystem::path(filename).lexically_normal();
+    const auto same_file = [&](const std::string& other) { return std::filesystem::path(other).lexically_normal() == path; };
+
+    uint32_t numQueued = 0;
+    for (uint32_t handle = 0; handle < _meshes.size(); ++handle)
+    {
+        auto& asset = _meshes[handle];
+        if (AssetState::Loaded != asset.state || asset.reloadQueued)
+        {
+            continue;
+        }
+        const auto& libraries = asset.mesh->materialLibraries;
+        if (same_file(asset.filename) || std::any_of(libraries.begin(), libraries.end(), same_file))
+        {
+            asset.reloadQueued = true;
+            _queue.push({ asset.priority, _sequence++, handle });
+            ++numQueued;
+        }
+    }
+    lock.unlock();
+
+    if (numQueued > 0)
+    {
+        _loadQueued.notify_all();
+    }
+}
+
+const Mesh *AssetManager::resolve(MeshHandle handle)
+{
+    std::lock_guard lg{_mutex};
+
+    auto& asset = _meshes.at(handle);
+    asset.lastUsed = _frame;
+    return asset.mesh.get();
+}
+
+AssetUpdate AssetManager::update()
+{
+    std::lock_guard lg{_mutex};
+
+    AssetUpdate result;
+
+    std::exception_ptr error;
+    for (auto& finished : _finished)
+    {
+        auto& asset = _meshes[finished.handle];
+        const bool reloaded = AssetState::Loaded == asset.state;
+        if (finished.error && reloaded)
+        {
+            try
+            {
+                std::rethrow_exception(finished.error);
+            }
+            catch (const std::exception& e)
+            {
+                result.reloadErrors.emplace_back(asset.filename, e.what());
+            }
+            catch (...)
+            {
+                result.reloadErrors.emplace_back(asset.filename, "Unknown error");
+            }
+            continue;
+        }
+        if (finished.error)
+        {
+            asset.state = AssetState::Unloaded;
+            error = finished.error;
+            continue;
+        }
+
+        if (reloaded)
+        {
+            _residentBytes -= asset.bytes;
+        }
+        asset.state = AssetState::Loaded;
+        asset.mesh = std::move(finished.mesh);
+        asset.bytes = mesh_bytes(*asset.mesh);
+        asset.lastUsed = _frame;
+        _residentBytes += asset.bytes;
+        result.loaded.push_back(finished.handle);
+    }
+    _finished.clear();
+
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+
+    // Anything resolved last frame is still in use
+    while (_residentBytes > _budget)
+    {
+        auto victim = _meshes.end();
+        for (auto it = _meshes.begin(); it != _meshes.end(); ++it)
+        {
+            if (AssetState::Loaded == it->state && it->lastUsed + 1 < _frame && (_meshes.end() == victim || it->lastUsed < victim->lastUsed))
+            {
+                victim = it;
+            }
+        }
+
+        if (_meshes.end() == victim)
+        {
+            break;
+        }
+
+        victim->state = AssetState::Unloaded;
+        victim->reloadQueued = false;
+        victim->mesh.reset();
+        _residentBytes -= victim->bytes;
+        result.evicted.push_back(victim - _meshes.begin());
+    }
+
+    ++_frame;
+    return result;
+}
+
+size_t AssetManager::resident_bytes() const noexcept
+{
+    return _residentBytes;
+}
+
+void AssetManager::worker_loop()
+{
+    std::unique_lock lock{_mutex};
+    while (true)
+    {
+        _loadQueued.wait(lock, [this] { return _stopping || !_queue.empty(); });
+        if (_stopping)
+        {
+            return;
+        }
+
+        const auto load = _queue.top();
+        _queue.pop();
+
+        // A reload leaves the asset loaded, so the old mesh is used until the new one is published
+        auto& asset = _meshes[load.handle];
+        if (AssetState::Queued == asset.state)
+        {
+            asset.state = AssetState::Loading;
+        }
+        else if (AssetState::Loaded == asset.state && asset.reloadQueued)
+        {
+            asset.reloadQueued = false;
+        }
+        else
+        {
+            continue;
+        }
+        const auto filename = asset.filename;
+
+        lock.unlock();
+
+        FinishedLoad finished = { load.handle, nullptr, nullptr };
+        try
+        {
+            finished.mesh = std::make_unique<const Mesh>(filename.c_str());
+        }
+        catch (...)
+        {
+            finished.error = std::current_exception();
+        }
+
+        lock.lock();
+        _finished.push_back(std::move(finished));
+    }
+}
\ No newline at end of file
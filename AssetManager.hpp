@@ -0,0 +1,121 @@
+#pragma once
+
+#include "Mesh.hpp"
+
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Higher priorities are loaded first, e.g. the next fighter's assets preload while the current match still runs
+enum class AssetPriority
+{
+    Background,
+    Preload,
+    Immediate
+};
+
+// Stays valid, and names the same file, for the AssetManager's lifetime, even across eviction and reload
+using MeshHandle = uint32_t;
+
+struct AssetUpdate
+{
+    std::vector<MeshHandle> loaded;
+    std::vector<MeshHandle> evicted;
+
+    // Reloads that failed, as the filename and the error. The mesh they were replacing stays loaded.
+    std::vector<std::pair<std::string, std::string>> reloadErrors;
+};
+
+// Loads meshes on a pool of worker threads, in priority order, and keeps the ones it has loaded within a memory budget
+// by evicting the least recently used. Everything but the workers runs on the thread that owns the manager.
+class AssetManager
+{
+public:
+    AssetManager(size_t budget, uint32_t numWorkers);
+    ~AssetManager();
+
+    AssetManager(const AssetManager&) = delete;
+    AssetManager& operator=(const AssetManager&) = delete;
+
+    // Queues the file for loading, raises the priority of a load still waiting, or does nothing if it is loaded
+    MeshHandle request_mesh(const std::string& filename, AssetPriority priority);
+
+    // Loads every loaded mesh read from the file again, its OBJ or one of its material libraries, e.g. because the file
+    // changed, and publishes them through update() like a first load. The old meshes stay resolvable until then. Does
+    // nothing for files no loaded mesh was read from.
+    void reload_file(const std::string& filename);
+
+    // The loaded mesh, or null until it is. Counts as a use this frame, so it is not evicted before the next.
+    const Mesh *resolve(MeshHandle handle);
+
+    // Publishes the loads finished since the last call, rethrowing any that failed, and then evicts least recently
+    // used meshes until the budget is met. Evicted meshes are destroyed.
+    AssetUpdate update();
+
+    size_t resident_bytes() const noexcept;
+
+private:
+    enum class AssetState
+    {
+        Unloaded,
+        Queued,
+        Loading,
+        Loaded
+    };
+
+    struct MeshAsset
+    {
+        std::string filename;
+        AssetState state;
+        AssetPriority priority;
+        std::unique_ptr<const Mesh> mesh;
+        size_t bytes;
+        uint64_t lastUsed;
+
+        // Loaded and queued to be loaded again, until a worker claims it
+        bool reloadQueued;
+    };
+
+    struct QueuedLoad
+    {
+        AssetPriority priority;
+        uint64_t sequence;
+        MeshHandle handle;
+
+        // Highest priority first, then first come first served
+        bool operator<(const QueuedLoad& rhs) const noexcept
+        {
+            return priority != rhs.priority ? priority < rhs.priority : sequence > rhs.sequence;
+        }
+    };
+
+    struct FinishedLoad
+    {
+        MeshHandle handle;
+        std::unique_ptr<const Mesh> mesh;
+        std::exception_ptr error;
+    };
+
+    void worker_loop();
+
+    const size_t _budget;
+    size_t _residentBytes;
+    uint64_t _frame;
+    uint64_t _sequence;
+
+    // Guards everything below, the fields above are only touched by the owning thread
+    std::mutex _mutex;
+    std::condition_variable _loadQueued;
+    bool _stopping;
+    std::vector<MeshAsset> _meshes;
+    std::priority_queue<QueuedLoad> _queue;
+    std::vector<FinishedLoad> _finished;
+
+    std::vector<std::thread> _workers;
+};
\ No newline at end of file
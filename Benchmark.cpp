@@ -0,0 +1,443 @@
+#include "Benchmark.hpp"
+
+#include "Mesh.hpp"
+#include "ObjParser.hpp"
+#include "Renderer.hpp"
+#include "Simulation.hpp"
+#include "Transform.hpp"
+#include "Window.hpp"
+
+#include <glm/gtx/transform.hpp>
+#include <tiny_obj_loader.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <vector>
+
+using BenchmarkClock = std::chrono::steady_clock;
+
+constexpr uint32_t ROLLBACK_BENCHMARK_DEPTH = 8;
+constexpr uint32_t ROLLBACK_BENCHMARK_ITERATIONS = 10000;
+constexpr auto ROLLBACK_BENCHMARK_BUDGET = std::chrono::milliseconds(1);
+
+constexpr uint32_t TRANSFORM_BENCHMARK_INSTANCES = 10000;
+constexpr uint32_t TRANSFORM_BENCHMARK_ITERATIONS = 200;
+
+constexpr char MESH_BENCHMARK_DIRECTORY[] = "../models";
+
+// Every model is also parsed concatenated this many times, big enough to be split across threads. Absolute indices
+// keep pointing at the first copy, which is still a valid file.
+constexpr uint32_t OBJ_BENCHMARK_REPEATS = 200;
+constexpr uint32_t OBJ_BENCHMARK_ITERATIONS = 5;
+
+// Every prop is stood in a few rows in front of the camera, back to front so each row is shaded over the last
+constexpr char OVERDRAW_BENCHMARK_MESH[] = "../models/monkey_smooth.obj";
+constexpr uint32_t OVERDRAW_BENCHMARK_COLUMNS = 16;
+constexpr float OVERDRAW_BENCHMARK_SPACING = 1.0f;
+constexpr uint32_t OVERDRAW_BENCHMARK_LIGHTS = 32;
+constexpr uint32_t OVERDRAW_BENCHMARK_LOAD_FRAMES = 1000;
+constexpr uint32_t OVERDRAW_BENCHMARK_FRAMES = 200;
+
+static std::chrono::duration<double, std::micro> percentile(std::vector<BenchmarkClock::duration>& samples, double p)
+{
+    const auto index = static_cast<size_t>(p * (samples.size() - 1));
+    std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+    return samples[index];
+}
+
+static int benchmark_rollback()
+{
+    static_assert(ROLLBACK_BENCHMARK_DEPTH <= SIMULATION_ROLLBACK_FRAMES);
+
+    Simulation simulation;
+    TickInput input = {};
+    for (uint32_t i = 0; i < ROLLBACK_BENCHMARK_DEPTH; ++i)
+    {
+        simulation.advance(input);
+    }
+
+    std::vector<BenchmarkClock::duration> samples;
+    samples.reserve(ROLLBACK_BENCHMARK_ITERATIONS);
+
+    for (uint32_t i = 0; i < ROLLBACK_BENCHMARK_ITERATIONS; ++i)
+    {
+        input.buttons[1] = static_cast<uint16_t>(i);
+
+        const auto start = BenchmarkClock::now();
+        simulation.amend_input(simulation.frame() - ROLLBACK_BENCHMARK_DEPTH, input);
+        samples.emplace_back(BenchmarkClock::now() - start);
+
+        simulation.advance(input);
+    }
+
+    const auto median = percentile(samples, 0.5);
+    const auto p99 = percentile(samples, 0.99);
+    const bool withinBudget = p99 < ROLLBACK_BENCHMARK_BUDGET;
+
+    printf("rollback: %u frames re-simulated, median %.2fus, p99 %.2fus, budget %s\n",
+        ROLLBACK_BENCHMARK_DEPTH, median.count(), p99.count(), withinBudget ? "met" : "EXCEEDED");
+
+    return withinBudget ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// The per-instance path record_command_buffer used before instancing
+static void transform_instances_glm(const glm::mat4& viewMatrix, const glm::vec3 *positions, const glm::quat *rotations, uint32_t count, InstanceTransform *out)
+{
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        const auto modelViewMatrix = viewMatrix * (glm::translate(positions[i]) * glm::mat4_cast(rotations[i]));
+        const auto normalMatrix = glm::transpose(glm::inverse(modelViewMatrix));
+
+        out[i].modelViewMatrix = modelViewMatrix;
+        for (uint32_t c = 0; c < 3; ++c)
+        {
+            out[i].normalMatrix[c] = glm::vec4(glm::vec3(normalMatrix[c]), 0.0f);
+        }
+    }
+}
+
+static double time_transform_kernel(TransformKernel kernel, const glm::mat4& viewMatrix, const std::vector<glm::vec3>& positions, const std::vector<glm::quat>& rotations, std::vector<InstanceTransform>& out)
+{
+    std::vector<BenchmarkClock::duration> samples;
+    samples.reserve(TRANSFORM_BENCHMARK_ITERATIONS);
+
+    for (uint32_t i = 0; i < TRANSFORM_BENCHMARK_ITERATIONS; ++i)
+    {
+        const auto start = BenchmarkClock::now();
+        kernel(viewMatrix, positions.data(), rotations.data(), positions.size(), out.data());
+        samples.emplace_back(BenchmarkClock::now() - start);
+    }
+
+    return percentile(samples, 0.5).count();
+}
+
+static float max_difference(const std::vector<InstanceTransform>& a, const std::vector<InstanceTransform>& b)
+{
+    float maxDifference = 0.0f;
+    for (size_t i = 0; i < a.size(); ++i)
+    {
+        const auto lhs = reinterpret_cast<const float *>(&a[i]);
+        const auto rhs = reinterpret_cast<const float *>(&b[i]);
+        for (size_t j = 0; j < sizeof(InstanceTransform) / sizeof(float); ++j)
+        {
+            maxDifference = std::max(maxDifference, std::abs(lhs[j] - rhs[j]));
+        }
+    }
+    return maxDifference;
+}
+
+static int benchmark_transforms()
+{
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> location(-50.0f, 50.0f);
+    std::uniform_real_distribution<float> component(-1.0f, 1.0f);
+
+    std::vector<glm::vec3> positions(TRANSFORM_BENCHMARK_INSTANCES);
+    std::vector<glm::quat> rotations(TRANSFORM_BENCHMARK_INSTANCES);
+    for (uint32_t i = 0; i < TRANSFORM_BENCHMARK_INSTANCES; ++i)
+    {
+        positions[i] = { location(rng), location(rng), location(rng) };
+        rotations[i] = glm::normalize(glm::quat(component(rng), component(rng), component(rng), component(rng)));
+    }
+
+    const auto viewMatrix = glm::lookAt(glm::vec3{ 0, 1, 0 }, glm::vec3{ 0, 0, 5 }, glm::vec3{ 0, 1, 0 });
+
+    std::vector<InstanceTransform> reference(TRANSFORM_BENCHMARK_INSTANCES), out(TRANSFORM_BENCHMARK_INSTANCES);
+    const auto glmTime = time_transform_kernel(transform_instances_glm, viewMatrix, positions, rotations, reference);
+    printf("transforms: %u instances, glm %.1fus\n", TRANSFORM_BENCHMARK_INSTANCES, glmTime);
+
+    std::vector kernels = { transform_instances_scalar };
+#if defined(__x86_64__) || defined(__i386__)
+    kernels.emplace_back(transform_instances_sse);
+#endif
+    const auto selectedKernel = select_transform_kernel();
+    if (kernels.end() == std::find(kernels.begin(), kernels.end(), selectedKernel))
+    {
+        kernels.emplace_back(selectedKernel);
+    }
+
+    constexpr float tolerance = 1e-3f;
+    bool allMatch = true;
+    for (const auto kernel : kernels)
+    {
+        const auto kernelTime = time_transform_kernel(kernel, viewMatrix, positions, rotations, out);
+        const auto difference = max_difference(reference, out);
+        allMatch = allMatch && difference < tolerance;
+
+        printf("transforms: %u instances, %s %.1fus (%.1fx glm), max error %g\n",
+            TRANSFORM_BENCHMARK_INSTANCES, transform_kernel_name(kernel), kernelTime, glmTime / kernelTime, difference);
+    }
+
+    return allMatch ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int benchmark_meshes()
+{
+    uint32_t numMeshes = 0;
+    for (const auto& entry : std::filesystem::directory_iterator(MESH_BENCHMARK_DIRECTORY))
+    {
+        if (".obj" != entry.path().extension())
+        {
+            continue;
+        }
+
+        const auto start = BenchmarkClock::now();
+        const Mesh mesh(entry.path().c_str());
+        const std::chrono::duration<double, std::milli> loadTime = BenchmarkClock::now() - start;
+
+        const auto lod_triangles = [&](const MeshLod& lod)
+        {
+            uint32_t numIndices = 0;
+            for (uint32_t i = 0; i < lod.submeshCount; ++i)
+            {
+                numIndices += mesh.submeshes[lod.firstSubmesh + i].indexCount;
+            }
+            return numIndices / 3;
+        };
+
+        const auto& report = mesh.vertexCacheReport;
+        printf("meshes: %s, %u triangles, %u submeshes, %zu materials, ACMR %.3f -> %.3f, ATVR %.3f -> %.3f, %zu meshlets, loaded in %.1fms\n",
+            entry.path().filename().c_str(), lod_triangles(mesh.lods[0]), mesh.lods[0].submeshCount, mesh.materials.size(),
+            report.unoptimized.acmr, report.optimized.acmr, report.unoptimized.atvr, report.optimized.atvr, mesh.meshlets.size(), loadTime.count());
+        for (size_t i = 1; i < mesh.lods.size(); ++i)
+        {
+            printf("meshes:     LOD %zu, %u triangles, error %.4f (%.2f%% of radius)\n", i, lod_triangles(mesh.lods[i]),
+                mesh.lods[i].error, 100.0f * mesh.lods[i].error / mesh.bounds.radius);
+        }
+        ++numMeshes;
+    }
+
+    return numMeshes ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static bool matches_tinyobj(const char *filename, const ObjData& obj)
+{
+    tinyobj::attrib_t attribs;
+    std::vector<tinyobj::shape_t> shapes;
+    std::vector<tinyobj::material_t> materials;
+    const auto directory = std::filesystem::path(filename).parent_path().string() + "/";
+    if (!tinyobj::LoadObj(&attribs, &shapes, &materials, nullptr, filename, directory.c_str()))
+    {
+        return false;
+    }
+
+    std::vector<tinyobj::index_t> indices;
+    for (size_t i = 0; i < shapes.size(); ++i)
+    {
+        const auto& mesh = shapes[i].mesh;
+        if (i >= obj.shapes.size() || obj.shapes[i].firstIndex != indices.size() || obj.shapes[i].indexCount != mesh.indices.size()
+            || !std::equal(mesh.material_ids.begin(), mesh.material_ids.end(), obj.materialIds.begin() + indices.size() / 3))
+        {
+            return false;
+        }
+        indices.insert(indices.end(), mesh.indices.begin(), mesh.indices.end());
+    }
+
+    const auto same_material = [](const tinyobj::material_t& expected, const ObjMaterial& material)
+    {
+        return expected.name == material.name && glm::vec3(expected.ambient[0], expected.ambient[1], expected.ambient[2]) == material.ambient
+            && glm::vec3(expected.diffuse[0], expected.diffuse[1], expected.diffuse[2]) == material.diffuse
+            && glm::vec3(expected.specular[0], expected.specular[1], expected.specular[2]) == material.specular
+            && expected.shininess == material.shininess;
+    };
+
+    const auto same_index = [](const tinyobj::index_t& expected, const ObjIndex& index)
+    {
+        return expected.vertex_index == index.position && expected.texcoord_index == index.texcoord && expected.normal_index == index.normal;
+    };
+    return attribs.vertices == obj.positions && attribs.texcoords == obj.texcoords && attribs.normals == obj.normals
+        && shapes.size() == obj.shapes.size()
+        && std::equal(indices.begin(), indices.end(), obj.indices.begin(), obj.indices.end(), same_index)
+        && std::equal(materials.begin(), materials.end(), obj.materials.begin(), obj.materials.end(), same_material);
+}
+
+template<typename Parse>
+static double parse_throughput(const std::filesystem::path& path, Parse&& parse)
+{
+    auto best = BenchmarkClock::duration::max();
+    for (uint32_t i = 0; i < OBJ_BENCHMARK_ITERATIONS; ++i)
+    {
+        const auto start = BenchmarkClock::now();
+        parse(path.c_str());
+        best = std::min(best, BenchmarkClock::now() - start);
+    }
+    return std::filesystem::file_size(path) / std::chrono::duration<double>(best).count() / 1e6;
+}
+
+// Checks parse_obj against tinyobj and compares their throughput
+static int benchmark_objparse()
+{
+    uint32_t numFiles = 0;
+    bool allMatch = true;
+    const auto benchmark = [&](const std::filesystem::path& path, const char *name)
+    {
+        const auto obj = parse_obj(path.c_str());
+        const bool matches = matches_tinyobj(path.c_str(), obj);
+
+        const auto throughput = parse_throughput(path, [](const char *filename) { parse_obj(filename); });
+        const auto tinyobjThroughput = parse_throughput(path, [](const char *filename)
+        {
+            tinyobj::attrib_t attribs;
+            std::vector<tinyobj::shape_t> shapes;
+            tinyobj::LoadObj(&attribs, &shapes, nullptr, nullptr, filename);
+        });
+
+        printf("objparse: %s, %.2fMB, %s tinyobj, %.0fMB/s (tinyobj %.0fMB/s)\n", name, std::filesystem::file_size(path) / 1e6,
+            matches ? "matches" : "DIFFERS FROM", throughput, tinyobjThroughput);
+        allMatch &= matches;
+        ++numFiles;
+    };
+
+    for (const auto& entry : std::filesystem::directory_iterator(MESH_BENCHMARK_DIRECTORY))
+    {
+        if (".obj" != entry.path().extension())
+        {
+            continue;
+        }
+        benchmark(entry.path(), entry.path().filename().c_str());
+
+        const auto repeatedPath = std::filesystem::temp_directory_path() / ("vfighter_" + entry.path().filename().string());
+        {
+            std::ifstream source(entry.path(), std::ios::binary);
+            const std::string contents((std::istreambuf_iterator<char>(source)), std::istreambuf_iterator<char>());
+
+            std::ofstream repeated(repeatedPath, std::ios::binary | std::ios::trunc);
+            for (uint32_t i = 0; i < OBJ_BENCHMARK_REPEATS; ++i)
+            {
+                repeated << contents << '\n';
+            }
+        }
+        const auto repeatedName = entry.path().filename().string() + " x" + std::to_string(OBJ_BENCHMARK_REPEATS);
+        benchmark(repeatedPath, repeatedName.c_str());
+        std::filesystem::remove(repeatedPath);
+    }
+
+    return numFiles && allMatch ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static void make_overdraw_scene(World& world, std::vector<PointLight>& lights)
+{
+    constexpr glm::vec3 up = { 0, 1, 0 };
+    const auto facingCamera = glm::angleAxis(glm::radians(180.0f), up);
+    constexpr glm::vec3 stationary = { 0, 0, 0 };
+    constexpr Hitbox hitbox = { { 0.0f, 0.0f, 0.0f }, { 1.0f, 1.0f, 1.0f } };
+
+    constexpr uint32_t rows = MAX_PROPS / OVERDRAW_BENCHMARK_COLUMNS;
+    for (uint32_t row = rows; row-- > 0;)
+    {
+        for (uint32_t column = 0; column < OVERDRAW_BENCHMARK_COLUMNS; ++column)
+        {
+            const float x = (column - 0.5f * (OVERDRAW_BENCHMARK_COLUMNS - 1)) * OVERDRAW_BENCHMARK_SPACING;
+            const float z = 6.0f + row * OVERDRAW_BENCHMARK_SPACING;
+            spawn(world.props, { x, 1.0f, z }, facingCamera, stationary, hitbox, 0);
+        }
+    }
+
+    for (uint32_t i = 0; i < OVERDRAW_BENCHMARK_LIGHTS; ++i)
+    {
+        const float angle = i * glm::radians(360.0f) / OVERDRAW_BENCHMARK_LIGHTS;
+        lights.push_back({ { 8.0f * glm::sin(angle), 3.0f, 10.0f + 4.0f * glm::cos(angle) }, { 1.0f, 1.0f, 1.0f }, 4.0f });
+    }
+}
+
+// Median GPU time of the main render pass, without and with a depth prepass
+static int benchmark_overdraw()
+{
+    auto world = std::make_unique<World>();
+    std::vector<PointLight> lights;
+    make_overdraw_scene(*world, lights);
+
+    // Occlusion culling would hide most of the overdraw being measured
+    const Window window("vfighter overdraw benchmark");
+    Renderer renderer(RendererFlags::GpuDrivenCulling | RendererFlags::PackedVertices, window.connection(), window.window());
+
+    Scene scene = {};
+    scene.cameraLocation = { 0.0f, 1.0f, 0.0f };
+    scene.cameraTarget = { 0.0f, 1.0f, 10.0f };
+    scene.world = world.get();
+    scene.mesh = renderer.request_mesh(OVERDRAW_BENCHMARK_MESH, AssetPriority::Immediate);
+    scene.lights = lights.data();
+    scene.lightCount = lights.size();
+
+    uint32_t loadFrames = 0;
+    while (0.0f == renderer.timings().shading)
+    {
+        if (++loadFrames > OVERDRAW_BENCHMARK_LOAD_FRAMES)
+        {
+            printf("Error: '%s' was never drawn, or the device can't time it\n", OVERDRAW_BENCHMARK_MESH);
+            return EXIT_FAILURE;
+        }
+        renderer.render(scene);
+    }
+
+    const auto measure = [&](bool depthPrepass)
+    {
+        renderer.set_depth_prepass(depthPrepass);
+
+        // Timings lag behind by the frames in flight
+        for (uint32_t i = 0; i < RENDERER_MAX_FRAMES_IN_FLIGHT; ++i)
+        {
+            renderer.render(scene);
+        }
+
+        std::vector<BenchmarkClock::duration> prepassSamples, shadingSamples, totalSamples;
+        for (uint32_t i = 0; i < OVERDRAW_BENCHMARK_FRAMES; ++i)
+        {
+            renderer.render(scene);
+
+            const auto& timings = renderer.timings();
+            const auto to_duration = [](float milliseconds)
+            {
+                return std::chrono::duration_cast<BenchmarkClock::duration>(std::chrono::duration<float, std::milli>(milliseconds));
+            };
+            prepassSamples.emplace_back(to_duration(timings.depthPrepass));
+            shadingSamples.emplace_back(to_duration(timings.shading));
+            totalSamples.emplace_back(to_duration(timings.depthPrepass + timings.shading));
+        }
+
+        const auto total = percentile(totalSamples, 0.5);
+        printf("overdraw: %u props, %u lights, %s, median %.1fus (prepass %.1fus, shading %.1fus)\n", world->props.count,
+            scene.lightCount, depthPrepass ? "depth prepass" : "forward", total.count(),
+            percentile(prepassSamples, 0.5).count(), percentile(shadingSamples, 0.5).count());
+        return total;
+    };
+
+    const auto forwardTime = measure(false);
+    const auto prepassTime = measure(true);
+    printf("overdraw: depth prepass %.2fx forward\n", forwardTime / prepassTime);
+
+    return EXIT_SUCCESS;
+}
+
+int run_benchmark(std::string_view name)
+{
+    if ("rollback" == name)
+    {
+        return benchmark_rollback();
+    }
+    if ("transforms" == name)
+    {
+        return benchmark_transforms();
+    }
+    if ("meshes" == name)
+    {
+        return benchmark_meshes();
+    }
+    if ("objparse" == name)
+    {
+        return benchmark_objparse();
+    }
+    if ("overdraw" == name)
+    {
+        return benchmark_overdraw();
+    }
+
+    printf("Error: Unknown benchmark '%.*s'\n", static_cast<int>(name.size()), name.data());
+    return EXIT_FAILURE;
+}
\ No newline at end of file
@@ -0,0 +1,5 @@
+#pragma once
+
+#include <string_view>
+
+int run_benchmark(std::string_view name);
\ No newline at end of file
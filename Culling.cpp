@@ -0,0 +1,130 @@
+#include "Culling.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+constexpr uint32_t NUM_FRUSTUM_PLANES = std::tuple_size_v<decltype(Frustum::planes)>;
+
+// Shared by every kernel, V is either float or a SIMD register with one instance per lane. Inputs are px, py, pz,
+// qx, qy, qz, qw; planes[p * 4 + i] holds component i of plane p. Returns the signed distance of the sphere's
+// center from the closest plane.
+template<typename V>
+static inline __attribute__((always_inline)) V min_plane_distance(const V *planes, const V *center, const V *in)
+{
+    const V qx = in[3], qy = in[4], qz = in[5], qw = in[6];
+
+    // center + 2 * cross(q, cross(q, center) + w * center), offset by the instance position
+    const V tx = qy * center[2] - qz * center[1] + qw * center[0];
+    const V ty = qz * center[0] - qx * center[2] + qw * center[1];
+    const V tz = qx * center[1] - qy * center[0] + qw * center[2];
+    const V cx = in[0] + center[0] + 2.0f * (qy * tz - qz * ty);
+    const V cy = in[1] + center[1] + 2.0f * (qz * tx - qx * tz);
+    const V cz = in[2] + center[2] + 2.0f * (qx * ty - qy * tx);
+
+    V minDistance = planes[0] * cx + planes[1] * cy + planes[2] * cz + planes[3];
+    for (uint32_t p = 1; p < NUM_FRUSTUM_PLANES; ++p)
+    {
+        const V distance = planes[4 * p] * cx + planes[4 * p + 1] * cy + planes[4 * p + 2] * cz + planes[4 * p + 3];
+        minDistance = minDistance < distance ? minDistance : distance;
+    }
+    return minDistance;
+}
+
+Frustum extract_frustum(const glm::mat4& viewProjectionMatrix)
+{
+    const auto m = glm::transpose(viewProjectionMatrix);
+
+    // Gribb/Hartmann, with a reversed [1, 0] depth range for the near plane
+    Frustum frustum;
+    frustum.planes[0] = m[3] + m[0];
+    frustum.planes[1] = m[3] - m[0];
+    frustum.planes[2] = m[3] + m[1];
+    frustum.planes[3] = m[3] - m[1];
+    frustum.planes[4] = m[3] - m[2];
+
+    for (auto& plane : frustum.planes)
+    {
+        plane /= glm::length(glm::vec3(plane));
+    }
+    return frustum;
+}
+
+uint32_t cull_instances_scalar(const Frustum& frustum, const glm::vec3& center, float radius, const glm::vec3 *positions, const glm::quat *rotations, uint32_t count, uint32_t *visibleIndices)
+{
+    const auto planes = &frustum.planes[0].x;
+    const float centers[3] = { center.x, center.y, center.z };
+
+    uint32_t numVisible = 0;
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        const float in[7] = {
+            positions[i].x, positions[i].y, positions[i].z,
+            rotations[i].x, rotations[i].y, rotations[i].z, rotations[i].w
+        };
+        if (min_plane_distance(planes, centers, in) >= -radius)
+        {
+            visibleIndices[numVisible++] = i;
+        }
+    }
+    return numVisible;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+uint32_t cull_instances_sse(const Frustum& frustum, const glm::vec3& center, float radius, const glm::vec3 *positions, const glm::quat *rotations, uint32_t count, uint32_t *visibleIndices)
+{
+    __m128 planes[4 * NUM_FRUSTUM_PLANES];
+    for (uint32_t p = 0; p < NUM_FRUSTUM_PLANES; ++p)
+    {
+        for (uint32_t i = 0; i < 4; ++i)
+        {
+            planes[4 * p + i] = _mm_set1_ps(frustum.planes[p][i]);
+        }
+    }
+    const __m128 centers[3] = { _mm_set1_ps(center.x), _mm_set1_ps(center.y), _mm_set1_ps(center.z) };
+    const __m128 negativeRadius = _mm_set1_ps(-radius);
+
+    uint32_t numVisible = 0;
+    uint32_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        const auto p = positions + i;
+
+        __m128 in[7];
+        in[0] = _mm_setr_ps(p[0].x, p[1].x, p[2].x, p[3].x);
+        in[1] = _mm_setr_ps(p[0].y, p[1].y, p[2].y, p[3].y);
+        in[2] = _mm_setr_ps(p[0].z, p[1].z, p[2].z, p[3].z);
+        in[3] = _mm_loadu_ps(&rotations[i + 0].x);
+        in[4] = _mm_loadu_ps(&rotations[i + 1].x);
+        in[5] = _mm_loadu_ps(&rotations[i + 2].x);
+        in[6] = _mm_loadu_ps(&rotations[i + 3].x);
+        _MM_TRANSPOSE4_PS(in[3], in[4], in[5], in[6]);
+
+        const auto distance = min_plane_distance(planes, centers, in);
+
+        // Compact the visible lanes
+        auto mask = _mm_movemask_ps(_mm_cmpge_ps(distance, negativeRadius));
+        while (mask)
+        {
+            visibleIndices[numVisible++] = i + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+
+    const auto numTailVisible = cull_instances_scalar(frustum, center, radius, positions + i, rotations + i, count - i, visibleIndices + numVisible);
+    for (uint32_t j = 0; j < numTailVisible; ++j)
+    {
+        visibleIndices[numVisible + j] += i;
+    }
+    return numVisible + numTailVisible;
+}
+#endif
+
+uint32_t cull_instances(const Frustum& frustum, const glm::vec3& center, float radius, const glm::vec3 *positions, const glm::quat *rotations, uint32_t count, uint32_t *visibleIndices)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return cull_instances_sse(frustum, center, radius, positions, rotations, count, visibleIndices);
+#else
+    return cull_instances_scalar(frustum, center, radius, positions, rotations, count, visibleIndices);
+#endif
+}
\ No newline at end of file
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <array>
+#include <cstdint>
+
+// Left, right, bottom, top and near planes as (normal, distance), normalized and pointing inwards. The projection
+// is infinite, so there is no far plane.
+struct Frustum
+{
+    std::array<glm::vec4, 5> planes;
+};
+
+struct CullStats
+{
+    uint32_t instancesTested;
+    uint32_t instancesDrawn;
+};
+
+Frustum extract_frustum(const glm::mat4& viewProjectionMatrix);
+
+// Tests each instance's bounding sphere, given in model space, against the frustum and writes the indices of the
+// visible instances to visibleIndices in order. Returns the number of visible instances.
+uint32_t cull_instances_scalar(const Frustum& frustum, const glm::vec3& center, float radius, const glm::vec3 *positions, const glm::quat *rotations, uint32_t count, uint32_t *visibleIndices);
+#if defined(__x86_64__) || defined(__i386__)
+uint32_t cull_instances_sse(const Frustum& frustum, const glm::vec3& center, float radius, const glm::vec3 *positions, const glm::quat *rotations, uint32_t count, uint32_t *visibleIndices);
+#endif
+
+uint32_t cull_instances(const Frustum& frustum, const glm::vec3& center, float radius, const glm::vec3 *positions, const glm::quat *rotations, uint32_t count, uint32_t *visibleIndices);
\ No newline at end of file
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Elements [first, first + count) of a DirtyArray
+struct DirtyRange
+{
+    uint32_t first;
+    uint32_t count;
+};
+
+// CPU copy of an array that lives on the GPU, remembering which elements changed since they were last uploaded so
+// only those are. Elements compare bytewise, so T must not have uninitialized padding.
+template<typename T>
+class DirtyArray
+{
+public:
+    // Everything starts out dirty, the GPU copy holds garbage until the first upload
+    explicit DirtyArray(uint32_t size)
+        :_elements(size), _dirtyWords((size + 63) / 64, ~uint64_t(0))
+    {
+        if (size % 64)
+        {
+            _dirtyWords.back() = (uint64_t(1) << (size % 64)) - 1;
+        }
+    }
+
+    // Only marks the element dirty if its value changed
+    void set(uint32_t index, const T& value)
+    {
+        if (0 != memcmp(&_elements[index], &value, sizeof(T)))
+        {
+            _elements[index] = value;
+            _dirtyWords[index / 64] |= uint64_t(1) << (index % 64);
+        }
+    }
+
+    const T& operator[](uint32_t index) const noexcept
+    {
+        return _elements[index];
+    }
+
+    uint32_t size() const noexcept
+    {
+        return _elements.size();
+    }
+
+    // The dirty elements as runs in ascending order, adjacent ones merged, then marks everything clean
+    std::vector<DirtyRange> take_dirty_ranges()
+    {
+        std::vector<DirtyRange> ranges;
+        for (uint32_t word = 0; word < _dirtyWords.size(); ++word)
+        {
+            for (auto bits = _dirtyWords[word]; bits; bits &= bits - 1)
+            {
+                const uint32_t index = word * 64 + __builtin_ctzll(bits);
+                if (!ranges.empty() && ranges.back().first + ranges.back().count == index)
+                {
+                    ++ranges.back().count;
+                }
+                else
+                {
+                    ranges.push_back({ index, 1 });
+                }
+            }
+            _dirtyWords[word] = 0;
+        }
+        return ranges;
+    }
+
+private:
+    std::vector<T> _elements;
+    std::vector<uint64_t> _dirtyWords;
+};
\ No newline at end of file
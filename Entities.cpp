@@ -0,0 +1,61 @@
+#include "Entities.hpp"
+
+template<uint32_t Capacity>
+static void expire_entities(Archetype<Capacity>& archetype)
+{
+    // Iterate backwards so swap-removal never skips an entity
+    for (uint32_t i = archetype.count; i-- > 0;)
+    {
+        auto& lifetime = archetype.lifetimes[i];
+        if (lifetime && 0 == --lifetime)
+        {
+            despawn(archetype, i);
+        }
+    }
+}
+
+static bool overlaps(const glm::vec3& positionA, const Hitbox& hitboxA, const glm::vec3& positionB, const Hitbox& hitboxB)
+{
+    const auto distance = glm::abs((positionA + hitboxA.center) - (positionB + hitboxB.center));
+    const auto extent = hitboxA.halfExtents + hitboxB.halfExtents;
+    return distance.x <= extent.x && distance.y <= extent.y && distance.z <= extent.z;
+}
+
+void integrate_motion(glm::vec3 *positions, const glm::vec3 *velocities, uint32_t count, float deltaTime)
+{
+    // Treat both arrays as flat float streams so the loop vectorizes across entity boundaries
+    auto *__restrict dst = reinterpret_cast<float *>(positions);
+    const auto *__restrict src = reinterpret_cast<const float *>(velocities);
+
+    static_assert(sizeof(glm::vec3) == 3 * sizeof(float));
+    for (uint32_t i = 0; i < 3 * count; ++i)
+    {
+        dst[i] += src[i] * deltaTime;
+    }
+}
+
+void expire_entities(World& world)
+{
+    expire_entities(world.fighters);
+    expire_entities(world.projectiles);
+    expire_entities(world.props);
+}
+
+uint32_t resolve_projectile_hits(World& world, uint32_t fighterIndex)
+{
+    const auto& fighterPosition = world.fighters.positions[fighterIndex];
+    const auto& fighterHitbox = world.fighters.hitboxes[fighterIndex];
+
+    auto& projectiles = world.projectiles;
+
+    uint32_t numHits = 0;
+    for (uint32_t i = projectiles.count; i-- > 0;)
+    {
+        if (overlaps(projectiles.positions[i], projectiles.hitboxes[i], fighterPosition, fighterHitbox))
+        {
+            despawn(projectiles, i);
+            ++numHits;
+        }
+    }
+    return numHits;
+}
\ No newline at end of file
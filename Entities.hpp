@@ -0,0 +1,85 @@
+#pragma once
+
+#include <glm/gtc/quaternion.hpp>
+
+#include <array>
+#include <cstdint>
+#include <type_traits>
+
+constexpr uint32_t ENTITY_ARRAY_ALIGNMENT = 64;
+
+constexpr uint32_t MAX_FIGHTERS = 2;
+constexpr uint32_t MAX_PROJECTILES = 512;
+constexpr uint32_t MAX_PROPS = 256;
+constexpr uint32_t MAX_ENTITIES = MAX_FIGHTERS + MAX_PROJECTILES + MAX_PROPS;
+
+constexpr uint32_t INVALID_ENTITY = UINT32_MAX;
+
+struct Hitbox
+{
+    glm::vec3 center;
+    glm::vec3 halfExtents;
+};
+
+// Structure-of-arrays storage for every entity of one kind. Each component is a contiguous, cache line aligned array
+// and live entities are kept densely packed in [0, count), so systems and uploads walk memory linearly.
+template<uint32_t Capacity>
+struct Archetype
+{
+    static constexpr uint32_t capacity = Capacity;
+
+    uint32_t count;
+    alignas(ENTITY_ARRAY_ALIGNMENT) std::array<glm::vec3, Capacity> positions;
+    alignas(ENTITY_ARRAY_ALIGNMENT) std::array<glm::quat, Capacity> rotations;
+    alignas(ENTITY_ARRAY_ALIGNMENT) std::array<glm::vec3, Capacity> velocities;
+    alignas(ENTITY_ARRAY_ALIGNMENT) std::array<Hitbox, Capacity> hitboxes;
+    alignas(ENTITY_ARRAY_ALIGNMENT) std::array<uint16_t, Capacity> lifetimes; // Ticks remaining, 0 for persistent
+};
+
+struct World
+{
+    Archetype<MAX_FIGHTERS> fighters;
+    Archetype<MAX_PROJECTILES> projectiles;
+    Archetype<MAX_PROPS> props;
+};
+
+static_assert(std::is_trivially_copyable_v<World>);
+
+template<uint32_t Capacity>
+uint32_t spawn(Archetype<Capacity>& archetype, const glm::vec3& position, const glm::quat& rotation, const glm::vec3& velocity, const Hitbox& hitbox, uint16_t lifetime)
+{
+    if (archetype.count == Capacity)
+    {
+        return INVALID_ENTITY;
+    }
+
+    const auto index = archetype.count++;
+    archetype.positions[index] = position;
+    archetype.rotations[index] = rotation;
+    archetype.velocities[index] = velocity;
+    archetype.hitboxes[index] = hitbox;
+    archetype.lifetimes[index] = lifetime;
+    return index;
+}
+
+template<uint32_t Capacity>
+void despawn(Archetype<Capacity>& archetype, uint32_t index)
+{
+    // Swap-remove to keep the arrays dense
+    const auto last = --archetype.count;
+    archetype.positions[index] = archetype.positions[last];
+    archetype.rotations[index] = archetype.rotations[last];
+    archetype.velocities[index] = archetype.velocities[last];
+    archetype.hitboxes[index] = archetype.hitboxes[last];
+    archetype.lifetimes[index] = archetype.lifetimes[last];
+}
+
+void integrate_motion(glm::vec3 *positions, const glm::vec3 *velocities, uint32_t count, float deltaTime);
+void expire_entities(World& world);
+uint32_t resolve_projectile_hits(World& world, uint32_t fighterIndex);
+
+template<uint32_t Capacity>
+void integrate_motion(Archetype<Capacity>& archetype, float deltaTime)
+{
+    integrate_motion(archetype.positions.data(), archetype.velocities.data(), archetype.count, deltaTime);
+}
\ No newline at end of file
@@ -0,0 +1,81 @@
+#include "FileWatcher.hpp"
+
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+
+constexpr uint32_t WATCH_EVENTS = IN_CLOSE_WRITE | IN_MOVED_TO;
+
+FileWatcher::FileWatcher()
+    :_fd(inotify_init1(IN_NONBLOCK | IN_CLOEXEC))
+{
+    if (_fd < 0)
+    {
+        throw std::system_error(errno, std::generic_category(), "inotify_init1");
+    }
+}
+
+FileWatcher::~FileWatcher()
+{
+    close(_fd);
+}
+
+void FileWatcher::watch(const std::string& directory)
+{
+    const int wd = inotify_add_watch(_fd, directory.empty() ? "." : directory.c_str(), WATCH_EVENTS | IN_ONLYDIR);
+    if (wd < 0)
+    {
+        throw std::system_error(errno, std::generic_category(), "inotify_add_watch " + directory);
+    }
+
+    _directories.emplace(wd, directory);
+}
+
+std::vector<std::string> FileWatcher::poll()
+{
+    std::vector<std::string> changed;
+
+    alignas(inotify_event) char buffer[4096];
+    while (true)
+    {
+        const auto length = read(_fd, buffer, sizeof(buffer));
+        if (length < 0)
+        {
+            if (EAGAIN == errno)
+            {
+                break;
+            }
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            throw std::system_error(errno, std::generic_category(), "inotify read");
+        }
+
+        for (ssize_t offset = 0; offset < length;)
+        {
+            inotify_event event;
+            memcpy(&event, buffer + offset, sizeof(event));
+            const char *name = buffer + offset + sizeof(event);
+            offset += sizeof(event) + event.len;
+
+            const auto directory = _directories.find(event.wd);
+            if (0 == event.len || _directories.end() == directory)
+            {
+                continue;
+            }
+
+            auto path = directory->second.empty() ? std::string(name) : directory->second + "/" + name;
+            if (changed.end() == std::find(changed.begin(), changed.end(), path))
+            {
+                changed.push_back(std::move(path));
+            }
+        }
+    }
+
+    return changed;
+}
\ No newline at end of file
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Watches directories with inotify for files that are written or moved in, without ever blocking. Editors and
+// compilers that save by renaming a temporary file over the old one are seen as a move.
+class FileWatcher
+{
+public:
+    FileWatcher();
+    ~FileWatcher();
+
+    FileWatcher(const FileWatcher&) = delete;
+    FileWatcher& operator=(const FileWatcher&) = delete;
+
+    // Watching a directory twice does nothing. An empty directory is the working directory.
+    void watch(const std::string& directory);
+
+    // Paths, as the directory that was watched joined with the file name, changed since the last call. A file saved
+    // more than once in that time is only listed once.
+    std::vector<std::string> poll();
+
+private:
+    int _fd;
+    std::unordered_map<int, std::string> _directories;
+};
\ No newline at end of file
@@ -1,19 +1,560 @@
 #include "Mesh.hpp"
 
-Mesh::Mesh(const char *filename)
+#include "ObjParser.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <unordered_map>
+
+constexpr char MESH_CACHE_MAGIC[4] = { 'V', 'F', 'M', 'S' };
+constexpr uint32_t MESH_CACHE_VERSION = 6;
+constexpr char MESH_CACHE_EXTENSION[] = ".vfmesh";
+
+// Each LOD aims for this fraction of the previous one's triangles, and is dropped if it can't get below LOD_MIN_REDUCTION
+constexpr float LOD_TRIANGLE_RATIO = 0.5f;
+constexpr float LOD_MIN_REDUCTION = 0.8f;
+
+// Relative to the bounding radius, past this the silhouette changes too much to be worth drawing at any distance
+constexpr float LOD_MAX_ERROR = 0.1f;
+
+// For faces without a material
+constexpr MeshMaterial DEFAULT_MATERIAL = { { 0.1f, 0.1f, 0.1f }, { 0.7f, 0.5f, 0.3f }, { 1.0f, 1.0f, 1.0f }, 16.0f };
+
+struct MeshCacheHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t sourceSize;
+    int64_t sourceTime;
+    uint32_t numVertices;
+    uint32_t numIndices;
+    uint32_t numSubmeshes;
+    uint32_t numMaterials;
+    uint32_t numLods;
+    uint32_t numMeshlets;
+    uint32_t numMeshletVertices;
+    uint32_t numMeshletTriangles;
+    uint32_t numMaterialLibraries;
+    Bounds bounds;
+    VertexCacheReport vertexCacheReport;
+};
+
+// Follows the header once per material library, then the library's path
+struct MeshCacheLibrary
+{
+    uint64_t sourceSize;
+    int64_t sourceTime;
+    uint32_t pathLength;
+};
+
+// A missing file gets the same stamp every time, so creating it later also invalidates the cache
+static void stamp_source(const std::string& filename, uint64_t& size, int64_t& time)
+{
+    std::error_code error;
+    size = std::filesystem::file_size(filename, error);
+    time = std::filesystem::last_write_time(filename, error).time_since_epoch().count();
+}
+
+template<typename T>
+static bool read_array(std::ifstream& file, std::vector<T>& values, uint32_t count)
+{
+    values.resize(count);
+    return static_cast<bool>(file.read(reinterpret_cast<char *>(values.data()), count * sizeof(T)));
+}
+
+template<typename T>
+static void write_array(std::ofstream& file, const std::vector<T>& values)
+{
+    file.write(reinterpret_cast<const char *>(values.data()), values.size() * sizeof(T));
+}
+
+static MeshCacheHeader make_cache_header(const char *filename)
+{
+    MeshCacheHeader header = {};
+    memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(MESH_CACHE_MAGIC));
+    header.version = MESH_CACHE_VERSION;
+    stamp_source(filename, header.sourceSize, header.sourceTime);
+    return header;
+}
+
+static bool load_cache(Mesh& mesh, const char *filename)
 {
-    tinyobj::attrib_t _attribs;
-    std::vector<tinyobj::shape_t> _shapes;
-    tinyobj::LoadObj(&_attribs, &_shapes, nullptr, nullptr, filename);
+    std::ifstream file(std::string(filename) + MESH_CACHE_EXTENSION, std::ios::binary);
+
+    const auto expected = make_cache_header(filename);
+
+    MeshCacheHeader header;
+    if (!file.read(reinterpret_cast<char *>(&header), sizeof(header))
+        || memcmp(header.magic, expected.magic, sizeof(header.magic))
+        || header.version != expected.version
+        || header.sourceSize != expected.sourceSize
+        || header.sourceTime != expected.sourceTime)
+    {
+        return false;
+    }
 
-    for (auto i = 0; i < _shapes[0].mesh.indices.size(); i += 1)
+    // Materials are baked in, so an edited .mtl is as stale as an edited .obj
+    for (uint32_t i = 0; i < header.numMaterialLibraries; ++i)
     {
-        PerVertex vertex;
-        for (auto j = 0; j < 3; ++j)
+        MeshCacheLibrary library;
+        if (!file.read(reinterpret_cast<char *>(&library), sizeof(library)))
         {
-            vertex.position[j] = _attribs.vertices[3 * _shapes[0].mesh.indices[i].vertex_index + j];
-            vertex.normal[j] = _attribs.normals[3 * _shapes[0].mesh.indices[i].normal_index + j];
+            return false;
         }
-        verticies.emplace_back(std::move(vertex));
+        std::string path(library.pathLength, '\0');
+        if (!file.read(path.data(), path.size()))
+        {
+            return false;
+        }
+
+        uint64_t sourceSize;
+        int64_t sourceTime;
+        stamp_source(path, sourceSize, sourceTime);
+        if (library.sourceSize != sourceSize || library.sourceTime != sourceTime)
+        {
+            return false;
+        }
+        mesh.materialLibraries.push_back(std::move(path));
+    }
+
+    mesh.bounds = header.bounds;
+    mesh.vertexCacheReport = header.vertexCacheReport;
+    return read_array(file, mesh.verticies, header.numVertices)
+        && read_array(file, mesh.indices, header.numIndices)
+        && read_array(file, mesh.submeshes, header.numSubmeshes)
+        && read_array(file, mesh.materials, header.numMaterials)
+        && read_array(file, mesh.lods, header.numLods)
+        && read_array(file, mesh.meshlets, header.numMeshlets)
+        && read_array(file, mesh.meshletVertices, header.numMeshletVertices)
+        && read_array(file, mesh.meshletTriangles, header.numMeshletTriangles);
+}
+
+static void save_cache(const Mesh& mesh, const char *filename)
+{
+    auto header = make_cache_header(filename);
+    header.numVertices = mesh.verticies.size();
+    header.numIndices = mesh.indices.size();
+    header.numSubmeshes = mesh.submeshes.size();
+    header.numMaterials = mesh.materials.size();
+    header.numLods = mesh.lods.size();
+    header.numMeshlets = mesh.meshlets.size();
+    header.numMeshletVertices = mesh.meshletVertices.size();
+    header.numMeshletTriangles = mesh.meshletTriangles.size();
+    header.numMaterialLibraries = mesh.materialLibraries.size();
+    header.bounds = mesh.bounds;
+    header.vertexCacheReport = mesh.vertexCacheReport;
+
+    // The cache is only an optimization, so a read-only model directory is not an error
+    std::ofstream file(std::string(filename) + MESH_CACHE_EXTENSION, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    for (const auto& path : mesh.materialLibraries)
+    {
+        MeshCacheLibrary library = {};
+        stamp_source(path, library.sourceSize, library.sourceTime);
+        library.pathLength = path.size();
+        file.write(reinterpret_cast<const char *>(&library), sizeof(library));
+        file.write(path.data(), path.size());
     }
+    write_array(file, mesh.verticies);
+    write_array(file, mesh.indices);
+    write_array(file, mesh.submeshes);
+    write_array(file, mesh.materials);
+    write_array(file, mesh.lods);
+    write_array(file, mesh.meshlets);
+    write_array(file, mesh.meshletVertices);
+    write_array(file, mesh.meshletTriangles);
 }
+
+static void load_obj(Mesh& mesh, const char *filename)
+{
+    auto obj = parse_obj(filename);
+    mesh.materialLibraries = std::move(obj.materialLibraries);
+
+    for (const auto& material : obj.materials)
+    {
+        mesh.materials.push_back({ material.ambient, material.diffuse, material.specular, material.shininess });
+    }
+    const uint32_t defaultMaterial = mesh.materials.size();
+    const auto material_of = [&](uint32_t triangle)
+    {
+        return obj.materialIds[triangle] < 0 ? defaultMaterial : static_cast<uint32_t>(obj.materialIds[triangle]);
+    };
+
+    // Submeshes are sorted by material, then by shape, so each material's triangles end up contiguous
+    std::vector<std::pair<uint32_t, uint32_t>> triangles;
+    for (uint32_t shape = 0; shape < obj.shapes.size(); ++shape)
+    {
+        const auto firstTriangle = obj.shapes[shape].firstIndex / 3;
+        for (uint32_t i = 0; i < obj.shapes[shape].indexCount / 3; ++i)
+        {
+            triangles.emplace_back(shape, firstTriangle + i);
+        }
+    }
+    std::stable_sort(triangles.begin(), triangles.end(), [&](const auto& a, const auto& b)
+    {
+        return material_of(a.second) < material_of(b.second);
+    });
+
+    // OBJ indexes positions and normals separately, so a vertex is unique per (position, normal) pair
+    std::unordered_map<uint64_t, uint32_t> uniqueVertices;
+    uint32_t previousShape = UINT32_MAX;
+    for (const auto& [shape, triangle] : triangles)
+    {
+        const auto material = material_of(triangle);
+        if (shape != previousShape || material != mesh.submeshes.back().material)
+        {
+            mesh.submeshes.push_back({ material, static_cast<uint32_t>(mesh.indices.size()), 0 });
+            previousShape = shape;
+        }
+        mesh.submeshes.back().indexCount += 3;
+
+        for (uint32_t j = 0; j < 3; ++j)
+        {
+            const auto& index = obj.indices[3 * triangle + j];
+            const auto key = static_cast<uint64_t>(static_cast<uint32_t>(index.position)) << 32 | static_cast<uint32_t>(index.normal);
+            const auto [it, inserted] = uniqueVertices.try_emplace(key, static_cast<uint32_t>(mesh.verticies.size()));
+            if (inserted)
+            {
+                PerVertex vertex;
+                for (auto k = 0; k < 3; ++k)
+                {
+                    vertex.position[k] = obj.positions[3 * index.position + k];
+                    vertex.normal[k] = obj.normals[3 * index.normal + k];
+                }
+                mesh.verticies.emplace_back(std::move(vertex));
+            }
+            mesh.indices.emplace_back(it->second);
+        }
+    }
+
+    if (std::any_of(mesh.submeshes.begin(), mesh.submeshes.end(), [&](const Submesh& submesh) { return defaultMaterial == submesh.material; }))
+    {
+        mesh.materials.push_back(DEFAULT_MATERIAL);
+    }
+
+    auto& bounds = mesh.bounds;
+    bounds.min = glm::vec3(std::numeric_limits<float>::max());
+    bounds.max = glm::vec3(std::numeric_limits<float>::lowest());
+    for (const auto& vertex : mesh.verticies)
+    {
+        bounds.min = glm::min(bounds.min, vertex.position);
+        bounds.max = glm::max(bounds.max, vertex.position);
+    }
+
+    bounds.center = (bounds.min + bounds.max) * 0.5f;
+    bounds.radius = 0.0f;
+    for (const auto& vertex : mesh.verticies)
+    {
+        bounds.radius = std::max(bounds.radius, glm::distance(bounds.center, vertex.position));
+    }
+}
+
+static void optimize(Mesh& mesh)
+{
+    const uint32_t numVertices = mesh.verticies.size();
+    mesh.vertexCacheReport.unoptimized = analyze_vertex_cache(mesh.indices, numVertices);
+
+    std::vector<glm::vec3> positions(numVertices);
+    std::transform(mesh.verticies.begin(), mesh.verticies.end(), positions.begin(), [](const PerVertex& vertex) { return vertex.position; });
+
+    // Triangles are only reordered within their submesh, so the ranges stay valid
+    for (const auto& submesh : mesh.submeshes)
+    {
+        const auto begin = mesh.indices.begin() + submesh.firstIndex;
+        const auto end = begin + submesh.indexCount;
+
+        std::vector<uint32_t> indices(begin, end);
+        optimize_vertex_cache(indices, numVertices);
+        optimize_overdraw(indices, positions);
+        std::copy(indices.begin(), indices.end(), begin);
+    }
+
+    const auto remap = optimize_vertex_fetch(mesh.indices, numVertices);
+    std::vector<PerVertex> verticies(numVertices);
+    for (uint32_t i = 0; i < numVertices; ++i)
+    {
+        verticies[remap[i]] = mesh.verticies[i];
+    }
+    mesh.verticies = std::move(verticies);
+
+    mesh.vertexCacheReport.optimized = analyze_vertex_cache(mesh.indices, numVertices);
+}
+
+static void compute_meshlet_bounds(const Mesh& mesh, Meshlet& meshlet)
+{
+    glm::vec3 min(std::numeric_limits<float>::max());
+    glm::vec3 max(std::numeric_limits<float>::lowest());
+    for (uint32_t i = 0; i < meshlet.vertexCount; ++i)
+    {
+        const auto& position = mesh.verticies[mesh.meshletVertices[meshlet.vertexOffset + i]].position;
+        min = glm::min(min, position);
+        max = glm::max(max, position);
+    }
+
+    meshlet.center = (min + max) * 0.5f;
+    meshlet.radius = 0.0f;
+    for (uint32_t i = 0; i < meshlet.vertexCount; ++i)
+    {
+        const auto& position = mesh.verticies[mesh.meshletVertices[meshlet.vertexOffset + i]].position;
+        meshlet.radius = std::max(meshlet.radius, glm::distance(meshlet.center, position));
+    }
+
+    std::array<glm::vec3, MESHLET_MAX_TRIANGLES> normals;
+    uint32_t numNormals = 0;
+
+    glm::vec3 axis(0.0f);
+    for (uint32_t i = 0; i < meshlet.triangleCount; ++i)
+    {
+        const auto triangle = &mesh.indices[3 * (meshlet.triangleOffset + i)];
+        const auto& p0 = mesh.verticies[triangle[0]].position;
+        const auto& p1 = mesh.verticies[triangle[1]].position;
+        const auto& p2 = mesh.verticies[triangle[2]].position;
+
+        const auto normal = glm::cross(p1 - p0, p2 - p0);
+        const auto area = glm::length(normal);
+        if (area > 0.0f)
+        {
+            normals[numNormals++] = normal / area;
+            axis += normal / area;
+        }
+    }
+
+    // Degenerate cones get a cutoff that can never pass the backface test
+    meshlet.coneAxis = { 0.0f, 0.0f, 1.0f };
+    meshlet.coneCutoff = 1.0f;
+
+    const auto axisLength = glm::length(axis);
+    if (0 == numNormals || 0.0f == axisLength)
+    {
+        return;
+    }
+    axis /= axisLength;
+
+    float minDot = 1.0f;
+    for (uint32_t i = 0; i < numNormals; ++i)
+    {
+        minDot = std::min(minDot, glm::dot(normals[i], axis));
+    }
+
+    if (minDot > 0.0f)
+    {
+        meshlet.coneAxis = axis;
+        meshlet.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+    }
+}
+
+// Greedily packs triangles in index order, so the index buffer is already sorted by meshlet
+static void build_meshlets(Mesh& mesh)
+{
+    constexpr uint8_t NOT_IN_MESHLET = UINT8_MAX;
+    static_assert(MESHLET_MAX_VERTICES < NOT_IN_MESHLET);
+
+    std::vector<uint8_t> localIndices(mesh.verticies.size(), NOT_IN_MESHLET);
+
+    Meshlet meshlet = {};
+    const auto finish_meshlet = [&]()
+    {
+        for (uint32_t i = 0; i < meshlet.vertexCount; ++i)
+        {
+            localIndices[mesh.meshletVertices[meshlet.vertexOffset + i]] = NOT_IN_MESHLET;
+        }
+        mesh.meshlets.emplace_back(meshlet);
+
+        const auto material = meshlet.material;
+        meshlet = {};
+        meshlet.vertexOffset = mesh.meshletVertices.size();
+        meshlet.triangleOffset = mesh.meshletTriangles.size() / 3;
+        meshlet.material = material;
+    };
+
+    for (const auto& submesh : mesh.submeshes)
+    {
+        meshlet.material = submesh.material;
+        for (size_t i = submesh.firstIndex; i < submesh.firstIndex + submesh.indexCount; i += 3)
+        {
+            const auto triangle = &mesh.indices[i];
+
+            uint32_t newVertices = 0;
+            for (uint32_t j = 0; j < 3; ++j)
+            {
+                newVertices += NOT_IN_MESHLET == localIndices[triangle[j]];
+            }
+            if (meshlet.vertexCount + newVertices > MESHLET_MAX_VERTICES || meshlet.triangleCount == MESHLET_MAX_TRIANGLES)
+            {
+                finish_meshlet();
+            }
+
+            for (uint32_t j = 0; j < 3; ++j)
+            {
+                auto& localIndex = localIndices[triangle[j]];
+                if (NOT_IN_MESHLET == localIndex)
+                {
+                    localIndex = meshlet.vertexCount++;
+                    mesh.meshletVertices.emplace_back(triangle[j]);
+                }
+                mesh.meshletTriangles.emplace_back(localIndex);
+            }
+            ++meshlet.triangleCount;
+        }
+
+        // Meshlets never span submeshes
+        if (meshlet.triangleCount)
+        {
+            finish_meshlet();
+        }
+    }
+
+    for (auto& meshlet : mesh.meshlets)
+    {
+        compute_meshlet_bounds(mesh, meshlet);
+    }
+}
+
+static void build_lods(Mesh& mesh)
+{
+    const uint32_t numVertices = mesh.verticies.size();
+    std::vector<glm::vec3> positions(numVertices);
+    std::vector<glm::vec3> normals(numVertices);
+    for (uint32_t i = 0; i < numVertices; ++i)
+    {
+        positions[i] = mesh.verticies[i].position;
+        normals[i] = mesh.verticies[i].normal;
+    }
+
+    // Every LOD is simplified from full detail, so its error is measured against the real surface. Submeshes are
+    // simplified separately, their shared edges are borders and stay in place.
+    const std::vector<Submesh> fullDetail = mesh.submeshes;
+    mesh.lods = { { 0, static_cast<uint32_t>(fullDetail.size()), 0.0f } };
+
+    // A submesh too small to simplify any further keeps its previous LOD's triangles, rather than vanishing
+    std::vector<std::vector<uint32_t>> previousIndices;
+    std::vector<float> previousErrors(fullDetail.size(), 0.0f);
+    for (const auto& submesh : fullDetail)
+    {
+        previousIndices.emplace_back(mesh.indices.begin() + submesh.firstIndex, mesh.indices.begin() + submesh.firstIndex + submesh.indexCount);
+    }
+
+    float ratio = 1.0f;
+    uint32_t previousIndexCount = mesh.indices.size();
+    while (mesh.lods.size() < MESH_MAX_LODS)
+    {
+        ratio *= LOD_TRIANGLE_RATIO;
+
+        MeshLod lod = { static_cast<uint32_t>(mesh.submeshes.size()), 0, 0.0f };
+        std::vector<uint32_t> lodIndices;
+        std::vector<Submesh> lodSubmeshes;
+        std::vector<std::vector<uint32_t>> submeshIndices(fullDetail.size());
+        std::vector<float> submeshErrors(fullDetail.size());
+        for (size_t i = 0; i < fullDetail.size(); ++i)
+        {
+            const auto& submesh = fullDetail[i];
+            const std::vector<uint32_t> indices(mesh.indices.begin() + submesh.firstIndex, mesh.indices.begin() + submesh.firstIndex + submesh.indexCount);
+            const auto targetIndexCount = static_cast<size_t>(submesh.indexCount / 3 * ratio) * 3;
+
+            submeshIndices[i] = simplify(indices, positions, normals, targetIndexCount, LOD_MAX_ERROR * mesh.bounds.radius, submeshErrors[i]);
+            if (submeshIndices[i].empty())
+            {
+                submeshIndices[i] = previousIndices[i];
+                submeshErrors[i] = previousErrors[i];
+            }
+            else
+            {
+                optimize_vertex_cache(submeshIndices[i], numVertices);
+            }
+
+            lodSubmeshes.push_back({ submesh.material, static_cast<uint32_t>(mesh.indices.size() + lodIndices.size()), static_cast<uint32_t>(submeshIndices[i].size()) });
+            lodIndices.insert(lodIndices.end(), submeshIndices[i].begin(), submeshIndices[i].end());
+            lod.error = std::max(lod.error, submeshErrors[i]);
+        }
+        if (lodIndices.empty() || lodIndices.size() > previousIndexCount * LOD_MIN_REDUCTION)
+        {
+            break;
+        }
+
+        lod.submeshCount = lodSubmeshes.size();
+        mesh.lods.push_back(lod);
+        mesh.submeshes.insert(mesh.submeshes.end(), lodSubmeshes.begin(), lodSubmeshes.end());
+        mesh.indices.insert(mesh.indices.end(), lodIndices.begin(), lodIndices.end());
+        previousIndexCount = lodIndices.size();
+        previousIndices = std::move(submeshIndices);
+        previousErrors = std::move(submeshErrors);
+    }
+}
+
+Mesh::Mesh(const char *filename)
+{
+    if (load_cache(*this, filename))
+    {
+        return;
+    }
+    verticies.clear();
+    indices.clear();
+    submeshes.clear();
+    materials.clear();
+    materialLibraries.clear();
+    lods.clear();
+    meshlets.clear();
+    meshletVertices.clear();
+    meshletTriangles.clear();
+
+    load_obj(*this, filename);
+    optimize(*this);
+    build_meshlets(*this);
+    build_lods(*this);
+    save_cache(*this, filename);
+}
+
+static glm::vec2 octahedral_encode(const glm::vec3& normal)
+{
+    // Project onto the octahedron |x| + |y| + |z| = 1, then fold the lower hemisphere over the diagonals
+    const auto n = normal / (std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z));
+    if (n.z >= 0.0f)
+    {
+        return { n.x, n.y };
+    }
+    return {
+        (1.0f - std::abs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f),
+        (1.0f - std::abs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f)
+    };
+}
+
+std::vector<PackedVertex> pack_vertices(const std::vector<PerVertex>& verticies, const Bounds& bounds)
+{
+    const auto extent = bounds.max - bounds.min;
+    const glm::vec3 scale = {
+        extent.x > 0.0f ? UINT16_MAX / extent.x : 0.0f,
+        extent.y > 0.0f ? UINT16_MAX / extent.y : 0.0f,
+        extent.z > 0.0f ? UINT16_MAX / extent.z : 0.0f
+    };
+
+    std::vector<PackedVertex> packed(verticies.size());
+    for (size_t i = 0; i < verticies.size(); ++i)
+    {
+        const auto position = glm::clamp(glm::round((verticies[i].position - bounds.min) * scale), 0.0f, float(UINT16_MAX));
+        const auto normal = glm::round(octahedral_encode(verticies[i].normal) * float(INT16_MAX));
+
+        packed[i].position = { uint16_t(position.x), uint16_t(position.y), uint16_t(position.z), 0 };
+        packed[i].normal = { int16_t(normal.x), int16_t(normal.y) };
+    }
+    return packed;
+}
+
+IndexRange material_range(const Mesh& mesh, uint32_t lod, uint32_t material)
+{
+    IndexRange range = { 0, 0 };
+    const auto begin = mesh.submeshes.begin() + mesh.lods[lod].firstSubmesh;
+    for (auto submesh = begin; submesh != begin + mesh.lods[lod].submeshCount; ++submesh)
+    {
+        if (submesh->material == material)
+        {
+            range.firstIndex = range.indexCount ? range.firstIndex : submesh->firstIndex;
+            range.indexCount += submesh->indexCount;
+        }
+    }
+    return range;
+}
\ No newline at end of file
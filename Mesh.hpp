@@ -1,7 +1,16 @@
 #pragma once
 
+#include "MeshOptimizer.hpp"
+
 #include <glm/glm.hpp>
-#include <tiny_obj_loader.h>
+
+#include <array>
+#include <string>
+
+constexpr uint32_t MESHLET_MAX_VERTICES = 64;
+constexpr uint32_t MESHLET_MAX_TRIANGLES = 124;
+
+constexpr uint32_t MESH_MAX_LODS = 4;
 
 struct PerVertex
 {
@@ -9,9 +18,112 @@ struct PerVertex
     glm::vec3 normal;
 };
 
+// Half the size of PerVertex: the position is quantized to unorm16 within the mesh's bounds (w is padding, since
+// three-component 16-bit vertex formats are rarely supported) and the normal is octahedral-encoded to snorm16x2
+struct PackedVertex
+{
+    std::array<uint16_t, 4> position;
+    std::array<int16_t, 2> normal;
+};
+
+struct Bounds
+{
+    glm::vec3 min;
+    glm::vec3 max;
+    glm::vec3 center;
+    float radius;
+};
+
+// A cluster of up to MESHLET_MAX_TRIANGLES triangles touching up to MESHLET_MAX_VERTICES vertices. Its triangles are
+// contiguous in Mesh::indices starting at 3 * triangleOffset, and are repeated as local indices in
+// Mesh::meshletTriangles for consumers that fetch through Mesh::meshletVertices instead.
+struct Meshlet
+{
+    glm::vec3 center;
+    float radius;
+
+    // Every triangle faces away from a viewer at p when dot(center - p, coneAxis) >= coneCutoff * |center - p| + radius
+    glm::vec3 coneAxis;
+    float coneCutoff;
+
+    uint32_t vertexOffset;
+    uint32_t vertexCount;
+    uint32_t triangleOffset;
+    uint32_t triangleCount;
+
+    // Meshlets never span submeshes, so each has a single material
+    uint32_t material;
+
+    // std430 rounds the struct up to the alignment of its vec3s
+    std::array<uint32_t, 3> _padding;
+};
+
+struct MeshMaterial
+{
+    glm::vec3 ambient;
+    glm::vec3 diffuse;
+    glm::vec3 specular;
+    float shininess;
+};
+
+// One OBJ shape's triangles with one material
+struct Submesh
+{
+    uint32_t material;
+    uint32_t firstIndex;
+    uint32_t indexCount;
+};
+
+struct IndexRange
+{
+    uint32_t firstIndex;
+    uint32_t indexCount;
+};
+
+// The submeshes drawing the whole mesh no further than error from the full detail surface. They are sorted by
+// material and contiguous in Mesh::indices, so each material's triangles are a single range.
+struct MeshLod
+{
+    uint32_t firstSubmesh;
+    uint32_t submeshCount;
+    float error;
+};
+
+struct VertexCacheReport
+{
+    VertexCacheStats unoptimized;
+    VertexCacheStats optimized;
+};
+
+// Loads every shape in an OBJ file and its materials, optimized for vertex cache, overdraw and fetch order and with a chain of LODs, through a binary cache next to it (<filename>.vfmesh) that is rebuilt when the source changes
 struct Mesh
 {
     explicit Mesh(const char *filenmae);
 
     std::vector<PerVertex> verticies;
-};
\ No newline at end of file
+    std::vector<uint32_t> indices;
+    Bounds bounds;
+
+    // Every shape and material in the file. Materials the file doesn't define get a default one.
+    std::vector<Submesh> submeshes;
+    std::vector<MeshMaterial> materials;
+
+    // The mtllib files the materials were read from. A change to any of them rebuilds the cache, like one to the OBJ.
+    std::vector<std::string> materialLibraries;
+
+    // Full detail first, then progressively simplified copies of its submeshes appended to submeshes and indices.
+    // Meshlets only cover lods[0].
+    std::vector<MeshLod> lods;
+
+    std::vector<Meshlet> meshlets;
+    std::vector<uint32_t> meshletVertices;
+    std::vector<uint8_t> meshletTriangles;
+
+    VertexCacheReport vertexCacheReport;
+};
+
+// The triangles of one material in one LOD, empty if that LOD doesn't use it
+IndexRange material_range(const Mesh& mesh, uint32_t lod, uint32_t material);
+
+// Decoded in main.vert as bounds.min + position * (bounds.max - bounds.min)
+std::vector<PackedVertex> pack_vertices(const std::vector<PerVertex>& verticies, const Bounds& bounds);
\ No newline at end of file
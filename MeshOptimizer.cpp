@@ -0,0 +1,603 @@
+#include "MeshOptimizer.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <numeric>
+
+constexpr uint32_t FORSYTH_CACHE_SIZE = 32;
+constexpr float FORSYTH_CACHE_DECAY_POWER = 1.5f;
+constexpr float FORSYTH_LAST_TRIANGLE_SCORE = 0.75f;
+constexpr float FORSYTH_VALENCE_BOOST_SCALE = 2.0f;
+constexpr float FORSYTH_VALENCE_BOOST_POWER = -0.5f;
+
+// Keeps spatially coherent runs together when nothing is shared between triangles, as in flat shaded meshes
+constexpr uint32_t OVERDRAW_MIN_CLUSTER_TRIANGLES = 32;
+
+// Open edges are held in place by planes perpendicular to their triangle, weighted this much more than the surface
+constexpr float SIMPLIFY_BORDER_WEIGHT = 10.0f;
+
+// How far past the cost of the cheapest sufficient set of collapses a pass may go, trading passes for quality
+constexpr float SIMPLIFY_PASS_COST_SLACK = 1.5f;
+
+VertexCacheStats analyze_vertex_cache(const std::vector<uint32_t>& indices, uint32_t numVertices, uint32_t cacheSize)
+{
+    // A vertex is in the FIFO while fewer than cacheSize misses happened since it was last loaded
+    std::vector<uint32_t> loadedAt(numVertices, 0);
+    uint32_t misses = 0;
+
+    for (const auto index : indices)
+    {
+        if (0 == loadedAt[index] || misses - loadedAt[index] >= cacheSize)
+        {
+            ++misses;
+            loadedAt[index] = misses;
+        }
+    }
+
+    VertexCacheStats stats = {};
+    if (indices.size())
+    {
+        stats.acmr = static_cast<float>(misses) / (indices.size() / 3);
+        stats.atvr = static_cast<float>(misses) / numVertices;
+    }
+    return stats;
+}
+
+static float vertex_score(int32_t cachePosition, uint32_t remainingTriangles)
+{
+    if (0 == remainingTriangles)
+    {
+        return -1.0f;
+    }
+
+    float score = 0.0f;
+    if (cachePosition >= 0)
+    {
+        // The last triangle's vertices get a fixed score so it isn't simply repeated
+        if (cachePosition < 3)
+        {
+            score = FORSYTH_LAST_TRIANGLE_SCORE;
+        }
+        else
+        {
+            const float scale = 1.0f / (FORSYTH_CACHE_SIZE - 3);
+            score = std::pow(1.0f - (cachePosition - 3) * scale, FORSYTH_CACHE_DECAY_POWER);
+        }
+    }
+
+    return score + FORSYTH_VALENCE_BOOST_SCALE * std::pow(static_cast<float>(remainingTriangles), FORSYTH_VALENCE_BOOST_POWER);
+}
+
+void optimize_vertex_cache(std::vector<uint32_t>& indices, uint32_t numVertices)
+{
+    const uint32_t numTriangles = indices.size() / 3;
+
+    // Triangles using each vertex, in one flat array. The first remainingTriangles entries are still to be emitted.
+    std::vector<uint32_t> adjacencyOffsets(numVertices + 1, 0);
+    for (const auto index : indices)
+    {
+        ++adjacencyOffsets[index + 1];
+    }
+    std::partial_sum(adjacencyOffsets.begin(), adjacencyOffsets.end(), adjacencyOffsets.begin());
+
+    std::vector<uint32_t> remainingTriangles(numVertices, 0);
+    std::vector<uint32_t> adjacency(indices.size());
+    for (uint32_t i = 0; i < indices.size(); ++i)
+    {
+        const auto vertex = indices[i];
+        adjacency[adjacencyOffsets[vertex] + remainingTriangles[vertex]++] = i / 3;
+    }
+
+    std::vector<int32_t> cachePositions(numVertices, -1);
+    std::vector<float> vertexScores(numVertices);
+    for (uint32_t i = 0; i < numVertices; ++i)
+    {
+        vertexScores[i] = vertex_score(-1, remainingTriangles[i]);
+    }
+
+    std::vector<float> triangleScores(numTriangles);
+    std::vector<bool> emitted(numTriangles, false);
+    for (uint32_t i = 0; i < numTriangles; ++i)
+    {
+        triangleScores[i] = vertexScores[indices[3 * i]] + vertexScores[indices[3 * i + 1]] + vertexScores[indices[3 * i + 2]];
+    }
+
+    std::vector<uint32_t> result;
+    result.reserve(indices.size());
+
+    std::array<uint32_t, FORSYTH_CACHE_SIZE + 3> cache;
+    uint32_t cacheCount = 0;
+
+    uint32_t scanCursor = 0;
+    int64_t bestTriangle = -1;
+
+    for (uint32_t emittedCount = 0; emittedCount < numTriangles; ++emittedCount)
+    {
+        // Nothing in the cache has triangles left, so start over from the best of the rest
+        if (bestTriangle < 0)
+        {
+            float bestScore = -1.0f;
+            for (uint32_t i = scanCursor; i < numTriangles; ++i)
+            {
+                if (!emitted[i] && triangleScores[i] > bestScore)
+                {
+                    bestScore = triangleScores[i];
+                    bestTriangle = i;
+                }
+            }
+        }
+
+        const auto triangle = static_cast<uint32_t>(bestTriangle);
+        const auto vertices = &indices[3 * triangle];
+        emitted[triangle] = true;
+        while (scanCursor < numTriangles && emitted[scanCursor])
+        {
+            ++scanCursor;
+        }
+
+        std::array<uint32_t, FORSYTH_CACHE_SIZE + 3> newCache;
+        uint32_t newCacheCount = 0;
+        for (uint32_t i = 0; i < 3; ++i)
+        {
+            const auto vertex = vertices[i];
+            result.emplace_back(vertex);
+            newCache[newCacheCount++] = vertex;
+
+            // Swap-remove the triangle from the vertex's remaining adjacency
+            const auto begin = &adjacency[adjacencyOffsets[vertex]];
+            const auto end = begin + remainingTriangles[vertex];
+            std::iter_swap(std::find(begin, end, triangle), end - 1);
+            --remainingTriangles[vertex];
+        }
+
+        for (uint32_t i = 0; i < cacheCount; ++i)
+        {
+            const auto vertex = cache[i];
+            if (vertex != vertices[0] && vertex != vertices[1] && vertex != vertices[2])
+            {
+                newCache[newCacheCount++] = vertex;
+            }
+        }
+
+        for (uint32_t i = FORSYTH_CACHE_SIZE; i < newCacheCount; ++i)
+        {
+            const auto vertex = newCache[i];
+            cachePositions[vertex] = -1;
+            vertexScores[vertex] = vertex_score(-1, remainingTriangles[vertex]);
+
+            for (uint32_t j = 0; j < remainingTriangles[vertex]; ++j)
+            {
+                const auto candidate = adjacency[adjacencyOffsets[vertex] + j];
+                const auto candidateVertices = &indices[3 * candidate];
+                triangleScores[candidate] = vertexScores[candidateVertices[0]] + vertexScores[candidateVertices[1]] + vertexScores[candidateVertices[2]];
+            }
+        }
+
+        cacheCount = std::min(newCacheCount, FORSYTH_CACHE_SIZE);
+        std::copy(newCache.begin(), newCache.begin() + cacheCount, cache.begin());
+
+        for (uint32_t i = 0; i < cacheCount; ++i)
+        {
+            cachePositions[cache[i]] = i;
+            vertexScores[cache[i]] = vertex_score(i, remainingTriangles[cache[i]]);
+        }
+
+        // Only triangles touching the cache changed score, and the next one is picked among them
+        bestTriangle = -1;
+        float bestScore = -1.0f;
+        for (uint32_t i = 0; i < cacheCount; ++i)
+        {
+            const auto vertex = cache[i];
+            for (uint32_t j = 0; j < remainingTriangles[vertex]; ++j)
+            {
+                const auto candidate = adjacency[adjacencyOffsets[vertex] + j];
+                const auto candidateVertices = &indices[3 * candidate];
+                const float score = vertexScores[candidateVertices[0]] + vertexScores[candidateVertices[1]] + vertexScores[candidateVertices[2]];
+                triangleScores[candidate] = score;
+
+                if (score > bestScore)
+                {
+                    bestScore = score;
+                    bestTriangle = candidate;
+                }
+            }
+        }
+    }
+
+    indices = std::move(result);
+}
+
+void optimize_overdraw(std::vector<uint32_t>& indices, const std::vector<glm::vec3>& positions)
+{
+    const uint32_t numTriangles = indices.size() / 3;
+    if (0 == numTriangles)
+    {
+        return;
+    }
+
+    // Start a new cluster wherever all three vertices miss the cache, moving those runs around costs nothing
+    std::vector<uint32_t> clusterStarts;
+    {
+        std::vector<uint32_t> loadedAt(positions.size(), 0);
+        uint32_t misses = 0;
+
+        for (uint32_t i = 0; i < numTriangles; ++i)
+        {
+            uint32_t triangleMisses = 0;
+            for (uint32_t j = 0; j < 3; ++j)
+            {
+                const auto index = indices[3 * i + j];
+                if (0 == loadedAt[index] || misses - loadedAt[index] >= VERTEX_CACHE_ANALYSIS_SIZE)
+                {
+                    ++misses;
+                    ++triangleMisses;
+                    loadedAt[index] = misses;
+                }
+            }
+
+            if (0 == i || (3 == triangleMisses && i - clusterStarts.back() >= OVERDRAW_MIN_CLUSTER_TRIANGLES))
+            {
+                clusterStarts.emplace_back(i);
+            }
+        }
+    }
+    clusterStarts.emplace_back(numTriangles);
+
+    glm::vec3 meshCentroid(0.0f);
+    for (const auto& position : positions)
+    {
+        meshCentroid += position;
+    }
+    meshCentroid /= static_cast<float>(positions.size());
+
+    // Clusters facing away from the mesh center are likely to occlude the rest, so they go first
+    const uint32_t numClusters = clusterStarts.size() - 1;
+    std::vector<float> sortKeys(numClusters);
+    for (uint32_t c = 0; c < numClusters; ++c)
+    {
+        glm::vec3 centroid(0.0f);
+        glm::vec3 normal(0.0f);
+        float area = 0.0f;
+
+        for (uint32_t i = clusterStarts[c]; i < clusterStarts[c + 1]; ++i)
+        {
+            const auto& p0 = positions[indices[3 * i]];
+            const auto& p1 = positions[indices[3 * i + 1]];
+            const auto& p2 = positions[indices[3 * i + 2]];
+
+            const auto triangleNormal = glm::cross(p1 - p0, p2 - p0);
+            const auto triangleArea = glm::length(triangleNormal);
+
+            centroid += (p0 + p1 + p2) * (triangleArea / 3.0f);
+            normal += triangleNormal;
+            area += triangleArea;
+        }
+
+        centroid = area > 0.0f ? centroid / area : positions[indices[3 * clusterStarts[c]]];
+        const auto normalLength = glm::length(normal);
+        sortKeys[c] = normalLength > 0.0f ? glm::dot(centroid - meshCentroid, normal / normalLength) : 0.0f;
+    }
+
+    std::vector<uint32_t> order(numClusters);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return sortKeys[a] > sortKeys[b]; });
+
+    std::vector<uint32_t> result;
+    result.reserve(indices.size());
+    for (const auto c : order)
+    {
+        result.insert(result.end(), indices.begin() + 3 * clusterStarts[c], indices.begin() + 3 * clusterStarts[c + 1]);
+    }
+
+    indices = std::move(result);
+}
+
+std::vector<uint32_t> optimize_vertex_fetch(std::vector<uint32_t>& indices, uint32_t numVertices)
+{
+    constexpr uint32_t UNUSED = UINT32_MAX;
+
+    std::vector<uint32_t> remap(numVertices, UNUSED);
+    uint32_t nextVertex = 0;
+
+    for (auto& index : indices)
+    {
+        if (UNUSED == remap[index])
+        {
+            remap[index] = nextVertex++;
+        }
+        index = remap[index];
+    }
+
+    // Vertices no triangle uses go to the end
+    for (auto& newIndex : remap)
+    {
+        if (UNUSED == newIndex)
+        {
+            newIndex = nextVertex++;
+        }
+    }
+    return remap;
+}
+
+// Sum of squared distances to a set of planes, as the symmetric 4x4 matrix Garland & Heckbert use, plus the total
+// weight of the planes so the error can be normalized back to a distance
+struct Quadric
+{
+    double a00, a01, a02, a11, a12, a22;
+    double b0, b1, b2;
+    double c;
+    double weight;
+};
+
+static void add_plane(Quadric& q, const glm::vec3& normal, float distance, float weight)
+{
+    const double x = normal.x, y = normal.y, z = normal.z, d = distance;
+    q.a00 += weight * x * x; q.a01 += weight * x * y; q.a02 += weight * x * z;
+    q.a11 += weight * y * y; q.a12 += weight * y * z; q.a22 += weight * z * z;
+    q.b0 += weight * x * d; q.b1 += weight * y * d; q.b2 += weight * z * d;
+    q.c += weight * d * d;
+    q.weight += weight;
+}
+
+static void add_quadric(Quadric& q, const Quadric& other)
+{
+    q.a00 += other.a00; q.a01 += other.a01; q.a02 += other.a02;
+    q.a11 += other.a11; q.a12 += other.a12; q.a22 += other.a22;
+    q.b0 += other.b0; q.b1 += other.b1; q.b2 += other.b2;
+    q.c += other.c;
+    q.weight += other.weight;
+}
+
+// Mean squared distance from p to the quadric's planes
+static double quadric_error(const Quadric& q, const glm::vec3& p)
+{
+    const double x = p.x, y = p.y, z = p.z;
+    const double error = q.a00 * x * x + q.a11 * y * y + q.a22 * z * z
+        + 2.0 * (q.a01 * x * y + q.a02 * x * z + q.a12 * y * z)
+        + 2.0 * (q.b0 * x + q.b1 * y + q.b2 * z)
+        + q.c;
+    return q.weight > 0.0 ? std::max(error, 0.0) / q.weight : 0.0;
+}
+
+std::vector<uint32_t> simplify(const std::vector<uint32_t>& indices, const std::vector<glm::vec3>& positions,
+    const std::vector<glm::vec3>& normals, size_t targetIndexCount, float maxError, float& error)
+{
+    const uint32_t numVertices = positions.size();
+
+    // Vertices split only by their normal share one position, and are collapsed together as one "wedge"
+    std::vector<uint32_t> byPosition(numVertices);
+    std::iota(byPosition.begin(), byPosition.end(), 0);
+    const auto positionLess = [&](uint32_t a, uint32_t b)
+    {
+        const auto& pa = positions[a];
+        const auto& pb = positions[b];
+        return pa.x != pb.x ? pa.x < pb.x : pa.y != pb.y ? pa.y < pb.y : pa.z < pb.z;
+    };
+    std::sort(byPosition.begin(), byPosition.end(), positionLess);
+
+    std::vector<uint32_t> wedge(numVertices);
+    std::vector<std::vector<uint32_t>> wedgeVertices;
+    for (uint32_t i = 0; i < numVertices; ++i)
+    {
+        if (0 == i || positions[byPosition[i - 1]] != positions[byPosition[i]])
+        {
+            wedgeVertices.emplace_back();
+        }
+        wedge[byPosition[i]] = wedgeVertices.size() - 1;
+        wedgeVertices.back().push_back(byPosition[i]);
+    }
+    const uint32_t numWedges = wedgeVertices.size();
+    const auto wedge_position = [&](uint32_t w) -> const glm::vec3& { return positions[wedgeVertices[w][0]]; };
+
+    std::vector<Quadric> quadrics(numWedges, Quadric{});
+    std::vector<uint32_t> result = indices;
+    {
+        // Directed edges seen once are open borders, an opposing triangle would have added the reverse
+        std::vector<std::pair<uint64_t, uint32_t>> edges;
+        for (size_t i = 0; i < result.size(); i += 3)
+        {
+            const std::array<uint32_t, 3> w = { wedge[result[i]], wedge[result[i + 1]], wedge[result[i + 2]] };
+            const auto p0 = wedge_position(w[0]);
+            const auto cross = glm::cross(wedge_position(w[1]) - p0, wedge_position(w[2]) - p0);
+            const float area = glm::length(cross) * 0.5f;
+            if (area <= 0.0f)
+            {
+                continue;
+            }
+            const auto normal = cross / (2.0f * area);
+            for (const auto v : w)
+            {
+                add_plane(quadrics[v], normal, -glm::dot(normal, p0), area);
+            }
+            for (uint32_t j = 0; j < 3; ++j)
+            {
+                edges.emplace_back(static_cast<uint64_t>(w[j]) << 32 | w[(j + 1) % 3], i / 3);
+            }
+        }
+        std::sort(edges.begin(), edges.end());
+
+        for (const auto& [edge, triangle] : edges)
+        {
+            const uint64_t reverse = edge << 32 | edge >> 32;
+            const auto it = std::lower_bound(edges.begin(), edges.end(), std::make_pair(reverse, 0u));
+            if (it != edges.end() && it->first == reverse)
+            {
+                continue;
+            }
+
+            const uint32_t w0 = edge >> 32, w1 = edge & UINT32_MAX;
+            const auto& p0 = wedge_position(w0);
+            const auto& p1 = wedge_position(w1);
+            const auto& p2 = wedge_position(wedge[result[3 * triangle]] ^ wedge[result[3 * triangle + 1]] ^ wedge[result[3 * triangle + 2]] ^ w0 ^ w1);
+            const auto faceNormal = glm::cross(p1 - p0, p2 - p0);
+            const auto borderNormal = glm::cross(p1 - p0, faceNormal);
+            const float length = glm::length(borderNormal);
+            if (length <= 0.0f)
+            {
+                continue;
+            }
+            const auto normal = borderNormal / length;
+            const float weight = SIMPLIFY_BORDER_WEIGHT * glm::dot(p1 - p0, p1 - p0);
+            add_plane(quadrics[w0], normal, -glm::dot(normal, p0), weight);
+            add_plane(quadrics[w1], normal, -glm::dot(normal, p0), weight);
+        }
+    }
+
+    struct Collapse
+    {
+        float cost;
+        uint32_t from;
+        uint32_t to;
+    };
+
+    error = 0.0f;
+    std::vector<uint32_t> collapseTo(numWedges);
+    std::vector<bool> locked(numWedges);
+    std::vector<uint32_t> triangleStarts(numWedges + 1);
+    std::vector<uint32_t> triangles;
+    std::vector<Collapse> collapses;
+
+    // Each pass collapses the cheapest edges whose neighbourhoods don't overlap, then rebuilds the triangles
+    while (result.size() > targetIndexCount)
+    {
+        const size_t numTriangles = result.size() / 3;
+
+        std::fill(triangleStarts.begin(), triangleStarts.end(), 0);
+        for (const auto index : result)
+        {
+            ++triangleStarts[wedge[index] + 1];
+        }
+        std::partial_sum(triangleStarts.begin(), triangleStarts.end(), triangleStarts.begin());
+        triangles.resize(result.size());
+        auto fill = triangleStarts;
+        for (size_t i = 0; i < result.size(); ++i)
+        {
+            triangles[fill[wedge[result[i]]]++] = i / 3;
+        }
+
+        collapses.clear();
+        for (size_t i = 0; i < result.size(); i += 3)
+        {
+            for (uint32_t j = 0; j < 3; ++j)
+            {
+                const uint32_t w0 = wedge[result[i + j]], w1 = wedge[result[i + (j + 1) % 3]];
+                if (w0 > w1)
+                {
+                    continue;
+                }
+
+                // Only ever collapse onto an existing vertex, so the vertex buffer is shared by every LOD
+                auto merged = quadrics[w0];
+                add_quadric(merged, quadrics[w1]);
+                const float toW1 = quadric_error(merged, wedge_position(w1));
+                const float toW0 = quadric_error(merged, wedge_position(w0));
+                collapses.push_back(toW1 <= toW0 ? Collapse{ toW1, w0, w1 } : Collapse{ toW0, w1, w0 });
+            }
+        }
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.cost < b.cost; });
+
+        std::iota(collapseTo.begin(), collapseTo.end(), 0);
+        std::fill(locked.begin(), locked.end(), false);
+
+        // A collapse removes about two triangles. Edges locked earlier in the pass would otherwise let much costlier
+        // ones through, so stay close to the cost of the cheapest set that would be enough.
+        const size_t maxCollapses = (numTriangles - targetIndexCount / 3 + 1) / 2;
+        const float passCost = collapses.empty() ? 0.0f : collapses[std::min(maxCollapses, collapses.size()) - 1].cost * SIMPLIFY_PASS_COST_SLACK;
+        const float maxCost = std::min(maxError * maxError, std::max(passCost, collapses.empty() ? 0.0f : collapses[0].cost));
+        size_t numCollapses = 0;
+        for (const auto& collapse : collapses)
+        {
+            if (numCollapses >= maxCollapses || collapse.cost > maxCost)
+            {
+                break;
+            }
+            if (locked[collapse.from] || locked[collapse.to])
+            {
+                continue;
+            }
+
+            // Reject collapses that would fold a surviving triangle over
+            const auto& target = wedge_position(collapse.to);
+            bool flips = false;
+            for (auto t = triangleStarts[collapse.from]; t < triangleStarts[collapse.from + 1] && !flips; ++t)
+            {
+                const uint32_t triangle = triangles[t];
+                std::array<glm::vec3, 3> corners;
+                std::array<glm::vec3, 3> moved;
+                bool degenerate = false;
+                for (uint32_t j = 0; j < 3; ++j)
+                {
+                    const auto w = wedge[result[3 * triangle + j]];
+                    corners[j] = wedge_position(w);
+                    moved[j] = w == collapse.from ? target : corners[j];
+                    degenerate |= w == collapse.to;
+                }
+                if (!degenerate)
+                {
+                    const auto before = glm::cross(corners[1] - corners[0], corners[2] - corners[0]);
+                    const auto after = glm::cross(moved[1] - moved[0], moved[2] - moved[0]);
+                    flips = glm::dot(before, after) <= 0.0f;
+                }
+            }
+            if (flips)
+            {
+                continue;
+            }
+
+            collapseTo[collapse.from] = collapse.to;
+            add_quadric(quadrics[collapse.to], quadrics[collapse.from]);
+            error = std::max(error, collapse.cost);
+            ++numCollapses;
+
+            // Everything sharing a triangle with either end has been seen with stale topology
+            for (const auto w : { collapse.from, collapse.to })
+            {
+                for (auto t = triangleStarts[w]; t < triangleStarts[w + 1]; ++t)
+                {
+                    for (uint32_t j = 0; j < 3; ++j)
+                    {
+                        locked[wedge[result[3 * triangles[t] + j]]] = true;
+                    }
+                }
+            }
+        }
+        if (0 == numCollapses)
+        {
+            break;
+        }
+
+        size_t write = 0;
+        for (size_t i = 0; i < result.size(); i += 3)
+        {
+            std::array<uint32_t, 3> triangle;
+            for (uint32_t j = 0; j < 3; ++j)
+            {
+                const auto vertex = result[i + j];
+                const auto w = collapseTo[wedge[vertex]];
+                if (w == wedge[vertex])
+                {
+                    triangle[j] = vertex;
+                    continue;
+                }
+
+                // Keep the shading closest to the vertex that moved
+                const auto& candidates = wedgeVertices[w];
+                triangle[j] = *std::max_element(candidates.begin(), candidates.end(), [&](uint32_t a, uint32_t b)
+                {
+                    return glm::dot(normals[vertex], normals[a]) < glm::dot(normals[vertex], normals[b]);
+                });
+            }
+
+            if (wedge[triangle[0]] != wedge[triangle[1]] && wedge[triangle[1]] != wedge[triangle[2]] && wedge[triangle[2]] != wedge[triangle[0]])
+            {
+                std::copy(triangle.begin(), triangle.end(), result.begin() + write);
+                write += 3;
+            }
+        }
+        result.resize(write);
+    }
+
+    error = std::sqrt(error);
+    return result;
+}
\ No newline at end of file
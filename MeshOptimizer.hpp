@@ -0,0 +1,38 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+// FIFO cache size used when analyzing index buffers, close to what current GPUs get out of post-transform reuse
+constexpr uint32_t VERTEX_CACHE_ANALYSIS_SIZE = 16;
+
+// ACMR is transformed vertices per triangle (0.5 is ideal for large regular meshes, 3 is the worst case). ATVR is
+// transformed vertices per unique vertex (1 is ideal).
+struct VertexCacheStats
+{
+    float acmr;
+    float atvr;
+};
+
+VertexCacheStats analyze_vertex_cache(const std::vector<uint32_t>& indices, uint32_t numVertices, uint32_t cacheSize = VERTEX_CACHE_ANALYSIS_SIZE);
+
+// Reorders triangles for post-transform cache reuse, using Forsyth's "Linear-Speed Vertex Cache Optimisation"
+void optimize_vertex_cache(std::vector<uint32_t>& indices, uint32_t numVertices);
+
+// Reorders clusters of triangles that already have good cache order so outward facing ones draw first, lowering
+// overdraw without splitting up cache-friendly runs (after Sander et al., "Fast Triangle Reordering for Vertex
+// Locality and Reduced Overdraw")
+void optimize_overdraw(std::vector<uint32_t>& indices, const std::vector<glm::vec3>& positions);
+
+// Renumbers vertices in order of first use so fetches walk memory linearly. Rewrites the indices and returns the
+// new index of every old vertex.
+std::vector<uint32_t> optimize_vertex_fetch(std::vector<uint32_t>& indices, uint32_t numVertices);
+
+// Collapses edges in order of quadric error (Garland & Heckbert, "Surface Simplification Using Quadric Error Metrics")
+// until at most targetIndexCount indices remain or the next collapse would move the surface further than maxError.
+// Vertices only ever collapse onto existing ones, so the result indexes the same vertex buffer. Also returns the
+// largest error introduced, as a distance in the mesh's units.
+std::vector<uint32_t> simplify(const std::vector<uint32_t>& indices, const std::vector<glm::vec3>& positions,
+    const std::vector<glm::vec3>& normals, size_t targetIndexCount, float maxError, float& error);
\ No newline at end of file
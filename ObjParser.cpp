@@ -0,0 +1,447 @@
+#include "ObjParser.hpp"
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Files smaller than this per thread aren't worth the threads' startup cost
+constexpr size_t OBJ_MIN_CHUNK_SIZE = 1 << 18;
+
+class MappedFile
+{
+public:
+    explicit MappedFile(const char *filename)
+        :_data(nullptr), _size(0)
+    {
+        const int fd = open(filename, O_RDONLY);
+        if (fd < 0)
+        {
+            throw std::runtime_error("Unable to open OBJ file");
+        }
+
+        struct stat status;
+        if (0 == fstat(fd, &status) && status.st_size > 0)
+        {
+            _size = status.st_size;
+            _data = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd);
+
+        if (MAP_FAILED == _data)
+        {
+            throw std::runtime_error("Unable to map OBJ file");
+        }
+        if (_data)
+        {
+            madvise(_data, _size, MADV_SEQUENTIAL);
+        }
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile()
+    {
+        if (_data)
+        {
+            munmap(_data, _size);
+        }
+    }
+
+    const char *begin() const noexcept
+    {
+        return static_cast<const char *>(_data);
+    }
+
+    const char *end() const noexcept
+    {
+        return begin() + _size;
+    }
+
+    size_t size() const noexcept
+    {
+        return _size;
+    }
+
+private:
+    void *_data;
+    size_t _size;
+};
+
+// A negative index counts back from the attributes seen so far, which a chunk only knows locally. These are
+// resolved against the earlier chunks' counts once all of them are parsed.
+struct ObjRelativeIndex
+{
+    uint32_t corner;
+    int32_t ObjIndex::*attribute;
+};
+
+constexpr std::array<int32_t ObjIndex::*, 3> OBJ_INDEX_ATTRIBUTES = { &ObjIndex::position, &ObjIndex::texcoord, &ObjIndex::normal };
+
+// An o, g or usemtl line, and the number of indices in the chunk before it
+struct ObjShapeEvent
+{
+    uint32_t index;
+    bool material;
+    std::string name;
+};
+
+struct ObjChunk
+{
+    ObjData data;
+    std::vector<ObjRelativeIndex> relativeIndices;
+    std::vector<ObjShapeEvent> shapeEvents;
+    std::vector<std::string> materialLibraries;
+
+    // The polygon being parsed, with a bit per attribute in OBJ_INDEX_ATTRIBUTES order for the relative ones
+    std::vector<ObjIndex> face;
+    std::vector<uint8_t> faceRelative;
+};
+
+static bool is_space(char c)
+{
+    return ' ' == c || '\t' == c || '\r' == c;
+}
+
+static const char *skip_spaces(const char *p, const char *end)
+{
+    while (p < end && is_space(*p))
+    {
+        ++p;
+    }
+    return p;
+}
+
+static void parse_floats(const char *p, const char *end, uint32_t count, std::vector<float>& values)
+{
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        p = skip_spaces(p, end);
+        if (p < end && '+' == *p)
+        {
+            ++p;
+        }
+
+        // Missing or malformed values read as zero, as in tinyobj
+        float value = 0.0f;
+        p = std::from_chars(p, end, value).ptr;
+        values.push_back(value);
+    }
+}
+
+static const char *parse_index(const char *p, const char *end, ObjChunk& chunk, uint32_t attribute, size_t count)
+{
+    if (p < end && '+' == *p)
+    {
+        ++p;
+    }
+
+    int32_t index = 0;
+    p = std::from_chars(p, end, index).ptr;
+
+    auto& value = chunk.face.back().*OBJ_INDEX_ATTRIBUTES[attribute];
+    if (index < 0)
+    {
+        value = static_cast<int32_t>(count) + index;
+        chunk.faceRelative.back() |= 1 << attribute;
+    }
+    else
+    {
+        value = index > 0 ? index - 1 : 0;
+    }
+
+    while (p < end && '/' != *p && !is_space(*p))
+    {
+        ++p;
+    }
+    return p;
+}
+
+static void parse_face(const char *p, const char *end, ObjChunk& chunk)
+{
+    auto& data = chunk.data;
+    chunk.face.clear();
+    chunk.faceRelative.clear();
+
+    // Each corner is v, v/vt, v//vn or v/vt/vn
+    while ((p = skip_spaces(p, end)) < end)
+    {
+        chunk.face.push_back({ -1, -1, -1 });
+        chunk.faceRelative.push_back(0);
+
+        p = parse_index(p, end, chunk, 0, data.positions.size() / 3);
+        if (p < end && '/' == *p)
+        {
+            ++p;
+            if (p < end && '/' != *p)
+            {
+                p = parse_index(p, end, chunk, 1, data.texcoords.size() / 2);
+            }
+            if (p < end && '/' == *p)
+            {
+                p = parse_index(p + 1, end, chunk, 2, data.normals.size() / 3);
+            }
+        }
+    }
+
+    for (size_t k = 2; k < chunk.face.size(); ++k)
+    {
+        for (const auto j : { size_t(0), k - 1, k })
+        {
+            for (uint32_t attribute = 0; attribute < OBJ_INDEX_ATTRIBUTES.size(); ++attribute)
+            {
+                if (chunk.faceRelative[j] & (1 << attribute))
+                {
+                    chunk.relativeIndices.push_back({ static_cast<uint32_t>(data.indices.size()), OBJ_INDEX_ATTRIBUTES[attribute] });
+                }
+            }
+            data.indices.push_back(chunk.face[j]);
+        }
+    }
+}
+
+static bool is_keyword(const char *p, const char *end, const char *keyword)
+{
+    const size_t length = strlen(keyword);
+    return static_cast<size_t>(end - p) > length && 0 == memcmp(p, keyword, length) && is_space(p[length]);
+}
+
+// The rest of the line, without surrounding whitespace
+static std::string parse_name(const char *p, const char *end)
+{
+    p = skip_spaces(p, end);
+    while (end > p && is_space(end[-1]))
+    {
+        --end;
+    }
+    return std::string(p, end);
+}
+
+static void parse_chunk(const char *p, const char *end, ObjChunk& chunk)
+{
+    auto& data = chunk.data;
+    while (p < end)
+    {
+        const char *lineEnd = static_cast<const char *>(memchr(p, '\n', end - p));
+        if (!lineEnd)
+        {
+            lineEnd = end;
+        }
+
+        p = skip_spaces(p, lineEnd);
+        if (lineEnd - p >= 2 && 'v' == p[0] && is_space(p[1]))
+        {
+            parse_floats(p + 2, lineEnd, 3, data.positions);
+        }
+        else if (lineEnd - p >= 3 && 'v' == p[0] && 'n' == p[1] && is_space(p[2]))
+        {
+            parse_floats(p + 3, lineEnd, 3, data.normals);
+        }
+        else if (lineEnd - p >= 3 && 'v' == p[0] && 't' == p[1] && is_space(p[2]))
+        {
+            parse_floats(p + 3, lineEnd, 2, data.texcoords);
+        }
+        else if (lineEnd - p >= 2 && 'f' == p[0] && is_space(p[1]))
+        {
+            parse_face(p + 2, lineEnd, chunk);
+        }
+        else if (is_keyword(p, lineEnd, "o") || is_keyword(p, lineEnd, "g"))
+        {
+            chunk.shapeEvents.push_back({ static_cast<uint32_t>(data.indices.size()), false, parse_name(p + 2, lineEnd) });
+        }
+        else if (is_keyword(p, lineEnd, "usemtl"))
+        {
+            chunk.shapeEvents.push_back({ static_cast<uint32_t>(data.indices.size()), true, parse_name(p + 7, lineEnd) });
+        }
+        else if (is_keyword(p, lineEnd, "mtllib"))
+        {
+            std::istringstream names(parse_name(p + 7, lineEnd));
+            for (std::string name; names >> name;)
+            {
+                chunk.materialLibraries.push_back(name);
+            }
+        }
+
+        p = lineEnd + 1;
+    }
+}
+
+static void parse_mtl(const std::filesystem::path& filename, std::vector<ObjMaterial>& materials)
+{
+    // A missing library leaves its materials undefined, as in tinyobj
+    std::ifstream file(filename);
+    for (std::string line; std::getline(file, line);)
+    {
+        const char *p = skip_spaces(line.data(), line.data() + line.size());
+        const char *end = line.data() + line.size();
+
+        if (is_keyword(p, end, "newmtl"))
+        {
+            materials.push_back({ parse_name(p + 7, end), glm::vec3(0.0f), glm::vec3(0.0f), glm::vec3(0.0f), 1.0f });
+        }
+        else if (materials.empty())
+        {
+            continue;
+        }
+
+        std::vector<float> values;
+        if (is_keyword(p, end, "Ka"))
+        {
+            parse_floats(p + 3, end, 3, values);
+            materials.back().ambient = { values[0], values[1], values[2] };
+        }
+        else if (is_keyword(p, end, "Kd"))
+        {
+            parse_floats(p + 3, end, 3, values);
+            materials.back().diffuse = { values[0], values[1], values[2] };
+        }
+        else if (is_keyword(p, end, "Ks"))
+        {
+            parse_floats(p + 3, end, 3, values);
+            materials.back().specular = { values[0], values[1], values[2] };
+        }
+        else if (is_keyword(p, end, "Ns"))
+        {
+            parse_floats(p + 3, end, 1, values);
+            materials.back().shininess = values[0];
+        }
+    }
+}
+
+// Replays the chunks' o, g and usemtl lines in file order
+static void build_shapes(const std::vector<ObjChunk>& chunks, ObjData& data)
+{
+    std::string name;
+    uint32_t shapeStart = 0;
+    const auto finish_shape = [&](uint32_t end)
+    {
+        if (end > shapeStart)
+        {
+            data.shapes.push_back({ name, shapeStart, end - shapeStart });
+        }
+        shapeStart = end;
+    };
+
+    int32_t material = -1;
+    uint32_t materialStart = 0;
+    data.materialIds.resize(data.indices.size() / 3);
+    const auto finish_material = [&](uint32_t end)
+    {
+        std::fill(data.materialIds.begin() + materialStart / 3, data.materialIds.begin() + end / 3, material);
+        materialStart = end;
+    };
+
+    uint32_t chunkStart = 0;
+    for (const auto& chunk : chunks)
+    {
+        for (const auto& event : chunk.shapeEvents)
+        {
+            if (event.material)
+            {
+                finish_material(chunkStart + event.index);
+                const auto it = std::find_if(data.materials.begin(), data.materials.end(), [&](const ObjMaterial& m) { return m.name == event.name; });
+                material = data.materials.end() == it ? -1 : static_cast<int32_t>(it - data.materials.begin());
+            }
+            else
+            {
+                finish_shape(chunkStart + event.index);
+                name = event.name;
+            }
+        }
+        chunkStart += chunk.data.indices.size();
+    }
+    finish_shape(chunkStart);
+    finish_material(chunkStart);
+}
+
+template<typename T>
+static void append(std::vector<T>& values, const std::vector<T>& chunkValues, size_t offset)
+{
+    std::copy(chunkValues.begin(), chunkValues.end(), values.begin() + offset);
+}
+
+ObjData parse_obj(const char *filename)
+{
+    const MappedFile file(filename);
+
+    const size_t numThreads = std::clamp<size_t>(file.size() / OBJ_MIN_CHUNK_SIZE, 1, std::max(1u, std::thread::hardware_concurrency()));
+
+    // Split evenly, then push every boundary forward to the start of the next line
+    std::vector<const char *> boundaries = { file.begin() };
+    for (size_t i = 1; i < numThreads; ++i)
+    {
+        const char *split = std::max(boundaries.back(), file.begin() + i * file.size() / numThreads);
+        const char *lineEnd = static_cast<const char *>(memchr(split, '\n', file.end() - split));
+        boundaries.push_back(lineEnd ? lineEnd + 1 : file.end());
+    }
+    boundaries.push_back(file.end());
+
+    std::vector<ObjChunk> chunks(numThreads);
+    {
+        std::vector<std::thread> threads;
+        for (size_t i = 1; i < numThreads; ++i)
+        {
+            threads.emplace_back(parse_chunk, boundaries[i], boundaries[i + 1], std::ref(chunks[i]));
+        }
+        parse_chunk(boundaries[0], boundaries[1], chunks[0]);
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+    }
+
+    ObjData data;
+    size_t numPositions = 0, numTexcoords = 0, numNormals = 0, numIndices = 0;
+    for (auto& chunk : chunks)
+    {
+        for (const auto& relative : chunk.relativeIndices)
+        {
+            auto& index = chunk.data.indices[relative.corner].*relative.attribute;
+            index += static_cast<int32_t>(&ObjIndex::position == relative.attribute ? numPositions / 3
+                : &ObjIndex::texcoord == relative.attribute ? numTexcoords / 2 : numNormals / 3);
+        }
+        numPositions += chunk.data.positions.size();
+        numTexcoords += chunk.data.texcoords.size();
+        numNormals += chunk.data.normals.size();
+        numIndices += chunk.data.indices.size();
+    }
+
+    data.positions.resize(numPositions);
+    data.texcoords.resize(numTexcoords);
+    data.normals.resize(numNormals);
+    data.indices.resize(numIndices);
+
+    numPositions = numTexcoords = numNormals = numIndices = 0;
+    for (const auto& chunk : chunks)
+    {
+        append(data.positions, chunk.data.positions, numPositions);
+        append(data.texcoords, chunk.data.texcoords, numTexcoords);
+        append(data.normals, chunk.data.normals, numNormals);
+        append(data.indices, chunk.data.indices, numIndices);
+        numPositions += chunk.data.positions.size();
+        numTexcoords += chunk.data.texcoords.size();
+        numNormals += chunk.data.normals.size();
+        numIndices += chunk.data.indices.size();
+
+        for (const auto& library : chunk.materialLibraries)
+        {
+            const auto path = std::filesystem::path(filename).parent_path() / library;
+            parse_mtl(path, data.materials);
+            data.materialLibraries.push_back(path.string());
+        }
+    }
+
+    build_shapes(chunks, data);
+    return data;
+}
\ No newline at end of file
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Zero-based like tinyobj's index_t, -1 where a face corner doesn't reference that attribute
+struct ObjIndex
+{
+    int32_t position;
+    int32_t texcoord;
+    int32_t normal;
+};
+
+// The faces between one o or g line and the next, like tinyobj's shape_t
+struct ObjShape
+{
+    std::string name;
+    uint32_t firstIndex;
+    uint32_t indexCount;
+};
+
+// The MTL properties the renderer shades with, defaulted like tinyobj's material_t
+struct ObjMaterial
+{
+    std::string name;
+    glm::vec3 ambient;
+    glm::vec3 diffuse;
+    glm::vec3 specular;
+    float shininess;
+};
+
+// Every face in an OBJ file, fan triangulated the same way tinyobj does
+struct ObjData
+{
+    std::vector<float> positions;
+    std::vector<float> texcoords;
+    std::vector<float> normals;
+    std::vector<ObjIndex> indices;
+
+    // Shapes cover indices in order. Materials come from every mtllib, in the order they are defined, and are
+    // assigned per triangle, -1 where there is no usemtl or it names a material that doesn't exist.
+    std::vector<ObjShape> shapes;
+    std::vector<ObjMaterial> materials;
+    std::vector<int32_t> materialIds;
+
+    // Every mtllib, relative to the working directory like the OBJ's own filename, including ones that don't exist
+    std::vector<std::string> materialLibraries;
+};
+
+// Memory maps the file and parses it in chunks of whole lines on all hardware threads, then stitches the chunks
+// together. Produces the same attributes, indices, shapes and materials as tinyobj::LoadObj, except that
+// material libraries are loaded before any usemtl is resolved.
+ObjData parse_obj(const char *filename);
\ No newline at end of file
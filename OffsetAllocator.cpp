@@ -0,0 +1,231 @@
+#include "OffsetAllocator.hpp"
+
+#include <stdexcept>
+
+constexpr uint32_t MANTISSA_BITS = 3;
+constexpr uint32_t MANTISSA_VALUE = 1 << MANTISSA_BITS;
+constexpr uint32_t MANTISSA_MASK = MANTISSA_VALUE - 1;
+
+constexpr uint32_t NO_NODE = UINT32_MAX;
+
+static uint32_t highest_bit(uint32_t value)
+{
+    return 31 - __builtin_clz(value);
+}
+
+// The smallest size class whose regions all fit size. Sizes below MANTISSA_VALUE are their own class.
+static uint32_t bin_round_up(uint32_t size)
+{
+    if (size < MANTISSA_VALUE)
+    {
+        return size;
+    }
+
+    const uint32_t mantissaStart = highest_bit(size) - MANTISSA_BITS;
+    const uint32_t exponent = mantissaStart + 1;
+    uint32_t mantissa = (size >> mantissaStart) & MANTISSA_MASK;
+    if (size & ((1u << mantissaStart) - 1))
+    {
+        // May carry into the exponent, which is the next class up
+        ++mantissa;
+    }
+    return (exponent << MANTISSA_BITS) + mantissa;
+}
+
+// The size class a region of size is filed under, so it fits anything rounded up to that class
+static uint32_t bin_round_down(uint32_t size)
+{
+    if (size < MANTISSA_VALUE)
+    {
+        return size;
+    }
+
+    const uint32_t mantissaStart = highest_bit(size) - MANTISSA_BITS;
+    const uint32_t exponent = mantissaStart + 1;
+    const uint32_t mantissa = (size >> mantissaStart) & MANTISSA_MASK;
+    return (exponent << MANTISSA_BITS) | mantissa;
+}
+
+OffsetAllocator::OffsetAllocator(uint32_t size, uint32_t maxAllocations)
+    :_freeSpace(0), _usedTopBins(0), _usedLeafBins{}, _nodes(2 * maxAllocations + 1)
+{
+    _binHeads.fill(NO_NODE);
+
+    // Popped from the back, so nodes are handed out in order
+    _unusedNodes.reserve(_nodes.size());
+    for (uint32_t i = _nodes.size(); i > 0; --i)
+    {
+        _unusedNodes.push_back(i - 1);
+    }
+
+    insert_free_node(0, size);
+}
+
+OffsetAllocation OffsetAllocator::allocate(uint32_t size)
+{
+    // Splitting off the remainder may need another node
+    if (0 == size || _unusedNodes.empty())
+    {
+        return { OFFSET_ALLOCATOR_NO_SPACE, NO_NODE };
+    }
+
+    const uint32_t minBin = bin_round_up(size);
+    uint32_t top = minBin / BINS_PER_LEAF;
+    const uint32_t minLeaf = minBin % BINS_PER_LEAF;
+
+    // Any leaf at or past minLeaf in the same top bin, otherwise the smallest leaf of the next nonempty top bin
+    uint32_t bin = NO_NODE;
+    const uint32_t leafMask = _usedLeafBins[top] & (~0u << minLeaf);
+    if (leafMask)
+    {
+        bin = top * BINS_PER_LEAF + __builtin_ctz(leafMask);
+    }
+    else if (top + 1 < NUM_TOP_BINS)
+    {
+        const uint32_t topMask = _usedTopBins & (~0u << (top + 1));
+        if (topMask)
+        {
+            top = __builtin_ctz(topMask);
+            bin = top * BINS_PER_LEAF + __builtin_ctz(_usedLeafBins[top]);
+        }
+    }
+
+    if (NO_NODE == bin)
+    {
+        return { OFFSET_ALLOCATOR_NO_SPACE, NO_NODE };
+    }
+
+    const uint32_t node = _binHeads[bin];
+    remove_free_node(node);
+
+    _nodes[node].used = true;
+    const uint32_t remainder = _nodes[node].size - size;
+    _nodes[node].size = size;
+
+    if (remainder)
+    {
+        const uint32_t next = _nodes[node].neighbourNext;
+        const uint32_t split = insert_free_node(_nodes[node].offset + size, remainder);
+        _nodes[split].neighbourPrev = node;
+        _nodes[split].neighbourNext = next;
+        if (NO_NODE != next)
+        {
+            _nodes[next].neighbourPrev = split;
+        }
+        _nodes[node].neighbourNext = split;
+    }
+
+    return { _nodes[node].offset, node };
+}
+
+void OffsetAllocator::free(OffsetAllocation allocation)
+{
+    const uint32_t node = allocation.node;
+    if (node >= _nodes.size() || !_nodes[node].used)
+    {
+        throw std::invalid_argument("Freeing an allocation that isn't live");
+    }
+
+    uint32_t offset = _nodes[node].offset;
+    uint32_t size = _nodes[node].size;
+    uint32_t prev = _nodes[node].neighbourPrev;
+    uint32_t next = _nodes[node].neighbourNext;
+
+    if (NO_NODE != prev && !_nodes[prev].used)
+    {
+        offset = _nodes[prev].offset;
+        size += _nodes[prev].size;
+        remove_free_node(prev);
+        _unusedNodes.push_back(prev);
+        prev = _nodes[prev].neighbourPrev;
+    }
+
+    if (NO_NODE != next && !_nodes[next].used)
+    {
+        size += _nodes[next].size;
+        remove_free_node(next);
+        _unusedNodes.push_back(next);
+        next = _nodes[next].neighbourNext;
+    }
+
+    _nodes[node].used = false;
+    _unusedNodes.push_back(node);
+
+    const uint32_t merged = insert_free_node(offset, size);
+    _nodes[merged].neighbourPrev = prev;
+    _nodes[merged].neighbourNext = next;
+    if (NO_NODE != prev)
+    {
+        _nodes[prev].neighbourNext = merged;
+    }
+    if (NO_NODE != next)
+    {
+        _nodes[next].neighbourPrev = merged;
+    }
+}
+
+uint32_t OffsetAllocator::free_space() const noexcept
+{
+    return _freeSpace;
+}
+
+// Files a free region under its bin, leaving its neighbours for the caller to link
+uint32_t OffsetAllocator::insert_free_node(uint32_t offset, uint32_t size)
+{
+    const uint32_t bin = bin_round_down(size);
+    const uint32_t top = bin / BINS_PER_LEAF;
+    const uint32_t leaf = bin % BINS_PER_LEAF;
+
+    const uint32_t head = _binHeads[bin];
+    if (NO_NODE == head)
+    {
+        _usedLeafBins[top] |= 1 << leaf;
+        _usedTopBins |= 1u << top;
+    }
+
+    const uint32_t node = _unusedNodes.back();
+    _unusedNodes.pop_back();
+
+    _nodes[node] = { offset, size, NO_NODE, head, NO_NODE, NO_NODE, false };
+    if (NO_NODE != head)
+    {
+        _nodes[head].binPrev = node;
+    }
+    _binHeads[bin] = node;
+
+    _freeSpace += size;
+    return node;
+}
+
+// Takes a free region out of its bin, leaving its neighbours and the node itself for the caller to deal with
+void OffsetAllocator::remove_free_node(uint32_t node)
+{
+    const auto& removed = _nodes[node];
+    if (NO_NODE != removed.binNext)
+    {
+        _nodes[removed.binNext].binPrev = removed.binPrev;
+    }
+
+    if (NO_NODE != removed.binPrev)
+    {
+        _nodes[removed.binPrev].binNext = removed.binNext;
+    }
+    else
+    {
+        const uint32_t bin = bin_round_down(removed.size);
+        const uint32_t top = bin / BINS_PER_LEAF;
+        const uint32_t leaf = bin % BINS_PER_LEAF;
+
+        _binHeads[bin] = removed.binNext;
+        if (NO_NODE == removed.binNext)
+        {
+            _usedLeafBins[top] &= ~(1 << leaf);
+            if (!_usedLeafBins[top])
+            {
+                _usedTopBins &= ~(1u << top);
+            }
+        }
+    }
+
+    _freeSpace -= removed.size;
+}
\ No newline at end of file
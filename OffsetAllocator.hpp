@@ -0,0 +1,63 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+// OffsetAllocation::offset when no free region is large enough
+constexpr uint32_t OFFSET_ALLOCATOR_NO_SPACE = UINT32_MAX;
+
+struct OffsetAllocation
+{
+    uint32_t offset;
+    uint32_t node;
+};
+
+// Two-level segregated fit (TLSF) allocator for ranges of a buffer it doesn't own, such as a GPU buffer shared by many
+// meshes. Free regions are binned by size class, a float with 5 exponent and 3 mantissa bits, so allocate and free are
+// a couple of bit scans, and a freed range merges with its free neighbours straight away.
+class OffsetAllocator
+{
+public:
+    // Room for maxAllocations live allocations, whatever the fragmentation
+    OffsetAllocator(uint32_t size, uint32_t maxAllocations);
+
+    OffsetAllocation allocate(uint32_t size);
+    void free(OffsetAllocation allocation);
+
+    uint32_t free_space() const noexcept;
+
+private:
+    static constexpr uint32_t NUM_TOP_BINS = 32;
+    static constexpr uint32_t BINS_PER_LEAF = 8;
+    static constexpr uint32_t NUM_LEAF_BINS = NUM_TOP_BINS * BINS_PER_LEAF;
+
+    struct Node
+    {
+        uint32_t offset;
+        uint32_t size;
+
+        // The other free regions in the same bin
+        uint32_t binPrev;
+        uint32_t binNext;
+
+        // The regions right before and after this one, free or not
+        uint32_t neighbourPrev;
+        uint32_t neighbourNext;
+
+        bool used;
+    };
+
+    uint32_t insert_free_node(uint32_t offset, uint32_t size);
+    void remove_free_node(uint32_t node);
+
+    uint32_t _freeSpace;
+
+    // A bit per top bin with any free regions, and per top bin a bit for each of its leaf bins that has any
+    uint32_t _usedTopBins;
+    std::array<uint8_t, NUM_TOP_BINS> _usedLeafBins;
+    std::array<uint32_t, NUM_LEAF_BINS> _binHeads;
+
+    std::vector<Node> _nodes;
+    std::vector<uint32_t> _unusedNodes;
+};
\ No newline at end of file
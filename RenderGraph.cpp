@@ -0,0 +1,257 @@
+#include "RenderGraph.hpp"
+
+#include "BadVkResult.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+constexpr VkAccessFlags WRITE_ACCESS = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+    VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+constexpr uint32_t NO_PASS = UINT32_MAX;
+
+static void check_success(VkResult vkResult)
+{
+    if (VK_SUCCESS != vkResult)
+    {
+        throw BadVkResult(vkResult);
+    }
+}
+
+GraphResource RenderGraph::add_image(std::string name, VkImage image, const VkImageSubresourceRange& range, ImageLifetime lifetime)
+{
+    _images.push_back({ std::move(name), image, range, lifetime, VK_IMAGE_LAYOUT_UNDEFINED, 0, NO_PASS, 0 });
+    return _images.size() - 1;
+}
+
+void RenderGraph::add_pass(std::string name, std::vector<ImageUse> uses, std::function<void(VkCommandBuffer)> record, bool output)
+{
+    for (auto use = uses.begin(); use != uses.end(); ++use)
+    {
+        if (std::any_of(uses.begin(), use, [&](const ImageUse& other) { return other.image == use->image; }))
+        {
+            throw std::logic_error("Pass " + name + " uses " + _images[use->image].name + " twice");
+        }
+    }
+
+    _passes.push_back({ std::move(name), std::move(uses), std::move(record), output, true });
+}
+
+void RenderGraph::compile()
+{
+    // Walking backwards, a pass is live if it is an output, writes a persistent image, or writes an image a live pass
+    // after it reads before it is written again
+    std::vector<bool> read(_images.size(), false);
+    for (auto pass = _passes.rbegin(); pass != _passes.rend(); ++pass)
+    {
+        pass->live = pass->output || std::any_of(pass->uses.begin(), pass->uses.end(), [&](const ImageUse& use)
+        {
+            return (use.access & WRITE_ACCESS) && (read[use.image] || ImageLifetime::Persistent == _images[use.image].lifetime);
+        });
+
+        if (pass->live)
+        {
+            for (const auto& use : pass->uses)
+            {
+                read[use.image] = 0 != (use.access & ~WRITE_ACCESS) || (!(use.access & WRITE_ACCESS) && read[use.image]);
+            }
+        }
+    }
+
+    for (auto& image : _images)
+    {
+        image.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+        image.firstPass = NO_PASS;
+        image.lastPass = 0;
+    }
+
+    for (uint32_t i = 0; i < _passes.size(); ++i)
+    {
+        if (_passes[i].live)
+        {
+            for (const auto& use : _passes[i].uses)
+            {
+                auto& image = _images[use.image];
+                image.firstPass = std::min(image.firstPass, i);
+                image.lastPass = std::max(image.lastPass, i);
+            }
+        }
+    }
+
+    // In order of first use, each aliased image takes the first memory whose images are done with it by then
+    std::vector<uint32_t> aliased;
+    for (uint32_t i = 0; i < _images.size(); ++i)
+    {
+        if (ImageLifetime::Aliased == _images[i].lifetime)
+        {
+            aliased.push_back(i);
+        }
+    }
+    std::stable_sort(aliased.begin(), aliased.end(), [&](uint32_t lhs, uint32_t rhs) { return _images[lhs].firstPass < _images[rhs].firstPass; });
+
+    std::vector<uint32_t> memoryLastPass;
+    for (const auto index : aliased)
+    {
+        auto& image = _images[index];
+        const auto free = std::find_if(memoryLastPass.begin(), memoryLastPass.end(), [&](uint32_t lastPass)
+        {
+            return NO_PASS != image.firstPass && lastPass < image.firstPass;
+        });
+
+        if (memoryLastPass.end() == free)
+        {
+            image.memory = memoryLastPass.size();
+            memoryLastPass.push_back(image.lastPass);
+        }
+        else
+        {
+            image.memory = free - memoryLastPass.begin();
+            *free = image.lastPass;
+        }
+    }
+
+    // The rest have memory of their own
+    uint32_t memoryCount = memoryLastPass.size();
+    for (auto& image : _images)
+    {
+        if (ImageLifetime::Aliased != image.lifetime)
+        {
+            image.memory = memoryCount++;
+        }
+    }
+
+    _memory.assign(memoryCount, MemoryState{});
+}
+
+void RenderGraph::allocate(VkDevice device, VmaAllocator allocator, std::vector<VmaAllocation>& memory) const
+{
+    VmaAllocationCreateInfo allocationCreateInfo = {};
+    allocationCreateInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+    const auto bind = [&](const VkMemoryRequirements& requirements, const std::vector<VkImage>& images)
+    {
+        VmaAllocation allocation;
+        check_success(vmaAllocateMemory(allocator, &requirements, &allocationCreateInfo, &allocation, nullptr));
+        memory.push_back(allocation);
+
+        for (const auto image : images)
+        {
+            check_success(vmaBindImageMemory(allocator, allocation, image));
+        }
+    };
+
+    for (uint32_t i = 0; i < _memory.size(); ++i)
+    {
+        VkMemoryRequirements shared = { 0, 1, ~0u };
+        std::vector<VkImage> images;
+        std::vector<VkMemoryRequirements> requirements;
+        for (const auto& image : _images)
+        {
+            if (ImageLifetime::Aliased == image.lifetime && i == image.memory)
+            {
+                images.push_back(image.image);
+                requirements.emplace_back();
+                vkGetImageMemoryRequirements(device, image.image, &requirements.back());
+
+                shared.size = std::max(shared.size, requirements.back().size);
+                shared.alignment = std::max(shared.alignment, requirements.back().alignment);
+                shared.memoryTypeBits &= requirements.back().memoryTypeBits;
+            }
+        }
+
+        if (images.empty())
+        {
+            continue;
+        }
+
+        // Images with no memory type in common are still synchronized as if they shared, they just don't
+        if (shared.memoryTypeBits)
+        {
+            bind(shared, images);
+        }
+        else
+        {
+            for (size_t j = 0; j < images.size(); ++j)
+            {
+                bind(requirements[j], { images[j] });
+            }
+        }
+    }
+}
+
+// Reads only wait for the last write, and not at all once it is visible to them. Writes and layout transitions wait
+// for every access since the last write.
+void RenderGraph::execute(VkCommandBuffer commandBuffer)
+{
+    for (uint32_t i = 0; i < _passes.size(); ++i)
+    {
+        const auto& pass = _passes[i];
+        if (!pass.live)
+        {
+            continue;
+        }
+
+        VkPipelineStageFlags srcStages = 0;
+        VkPipelineStageFlags dstStages = 0;
+        _barriers.clear();
+
+        const auto add_barrier = [&](const Image& image, VkAccessFlags srcAccess, const ImageUse& use, VkImageLayout oldLayout)
+        {
+            VkImageMemoryBarrier barrier = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+            barrier.srcAccessMask = srcAccess;
+            barrier.dstAccessMask = use.access;
+            barrier.oldLayout = oldLayout;
+            barrier.newLayout = use.layout;
+            barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.image = image.image;
+            barrier.subresourceRange = image.range;
+            _barriers.push_back(barrier);
+
+            dstStages |= use.stages;
+        };
+
+        for (const auto& use : pass.uses)
+        {
+            auto& image = _images[use.image];
+            auto& memory = _memory[image.memory];
+
+            const bool discard = i == image.firstPass && ImageLifetime::Persistent != image.lifetime;
+            const bool writes = use.access & WRITE_ACCESS;
+
+            if (!writes && !discard && use.layout == image.layout)
+            {
+                const bool visible = !(use.stages & ~memory.visibleStages) && !(use.access & ~memory.visibleAccess);
+                if (memory.writeStages && !visible)
+                {
+                    srcStages |= memory.writeStages;
+                    add_barrier(image, memory.writeAccess, use, image.layout);
+
+                    memory.visibleStages |= use.stages;
+                    memory.visibleAccess |= use.access;
+                }
+                memory.readStages |= use.stages;
+            }
+            else
+            {
+                srcStages |= memory.writeStages | memory.readStages;
+                add_barrier(image, memory.writeAccess, use, discard ? VK_IMAGE_LAYOUT_UNDEFINED : image.layout);
+
+                // A write isn't visible to later reads, even at the writer's own stages. A read-only transition is
+                // visible to the reads it was made for.
+                image.layout = use.layout;
+                memory = writes
+                    ? MemoryState{ use.stages, use.access & WRITE_ACCESS, 0, 0, 0 }
+                    : MemoryState{ use.stages, 0, 0, use.stages, use.access };
+            }
+        }
+
+        if (!_barriers.empty())
+        {
+            vkCmdPipelineBarrier(commandBuffer, srcStages ? srcStages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, dstStages, 0,
+                0, nullptr, 0, nullptr, _barriers.size(), _barriers.data());
+        }
+
+        pass.record(commandBuffer);
+    }
+}
\ No newline at end of file
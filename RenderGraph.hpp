@@ -0,0 +1,87 @@
+#pragma once
+
+#include <vk_mem_alloc.h>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+using GraphResource = uint32_t;
+
+enum class ImageLifetime
+{
+    Persistent, // Keeps its contents from one execution to the next
+    Transient, // Discarded before its first use in each execution
+    Aliased // Transient, and bound by RenderGraph::allocate to memory shared with images whose passes don't overlap
+};
+
+// How a pass accesses an image. Whether it writes is told by the access flags, render passes are expected to keep
+// their attachments in the layout they are used in.
+struct ImageUse
+{
+    GraphResource image;
+    VkPipelineStageFlags stages;
+    VkAccessFlags access;
+    VkImageLayout layout;
+};
+
+// Records passes in the order they were added, each declaring the images it reads and writes, with the barriers and
+// layout transitions between them derived from those uses. Passes whose writes are never read are culled, unless they
+// are outputs, whose results are used outside the graph.
+//
+// Every execution of the graph is synchronized with the one before it, so the same graph is meant to be executed every
+// frame. Work outside it has to synchronize with its images itself.
+class RenderGraph
+{
+public:
+    GraphResource add_image(std::string name, VkImage image, const VkImageSubresourceRange& range, ImageLifetime lifetime);
+
+    // Throws std::logic_error if the pass uses an image twice
+    void add_pass(std::string name, std::vector<ImageUse> uses, std::function<void(VkCommandBuffer)> record, bool output = false);
+
+    // Culls passes and decides which aliased images share memory, once every pass has been added
+    void compile();
+
+    // Binds the aliased images, appending the memory they share to be freed once they are destroyed. It is appended as
+    // it is allocated, so none is lost if binding fails.
+    void allocate(VkDevice device, VmaAllocator allocator, std::vector<VmaAllocation>& memory) const;
+
+    void execute(VkCommandBuffer commandBuffer);
+
+private:
+    struct Image
+    {
+        std::string name;
+        VkImage image;
+        VkImageSubresourceRange range;
+        ImageLifetime lifetime;
+        VkImageLayout layout;
+        uint32_t memory; // Index into _memory
+        uint32_t firstPass; // Of the live passes using it
+        uint32_t lastPass;
+    };
+
+    struct Pass
+    {
+        std::string name;
+        std::vector<ImageUse> uses;
+        std::function<void(VkCommandBuffer)> record;
+        bool output;
+        bool live;
+    };
+
+    // Accesses to memory since it was last written or transitioned, shared by the images aliasing it
+    struct MemoryState
+    {
+        VkPipelineStageFlags writeStages;
+        VkAccessFlags writeAccess;
+        VkPipelineStageFlags readStages;
+        VkPipelineStageFlags visibleStages; // Readers the last write is already visible to
+        VkAccessFlags visibleAccess;
+    };
+
+    std::vector<Image> _images;
+    std::vector<Pass> _passes;
+    std::vector<MemoryState> _memory;
+    std::vector<VkImageMemoryBarrier> _barriers;
+};
\ No newline at end of file
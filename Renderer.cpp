@@ -5,60 +5,274 @@
 #include <glm/gtx/transform.hpp>
 
 #include <algorithm>
+#include <chrono>
+#include <cstdio>
 #include <cstring>
+#include <filesystem>
 #include <fstream>
 #include <iterator>
+#include <string_view>
+
+constexpr uint32_t MAX_MATERIALS = 16;
+
+// View space is split into a grid of light clusters, exponentially in depth, each listing the lights that reach into it
+constexpr uint32_t LIGHT_GRID_X = 16;
+constexpr uint32_t LIGHT_GRID_Y = 9;
+constexpr uint32_t LIGHT_GRID_Z = 24;
+constexpr uint32_t LIGHT_GRID_CLUSTERS = LIGHT_GRID_X * LIGHT_GRID_Y * LIGHT_GRID_Z;
+constexpr uint32_t LIGHT_GRID_MAX_CLUSTER_LIGHTS = 31; // Any more lights reaching a cluster are dropped
+constexpr float LIGHT_GRID_NEAR = 1.0f; // The first depth slice extends from the camera to here
+constexpr float LIGHT_GRID_FAR = 100.0f; // The last depth slice extends past this
+constexpr uint32_t LIGHT_CULL_WORKGROUP_SIZE = 64;
+
+// A light's range ends where its intensity falls below this, main.frag fades it out on the way
+constexpr float LIGHT_MIN_INTENSITY = 0.01f;
+
+struct LightGridSpecConstants {
+    uint32_t gridX;
+    uint32_t gridY;
+    uint32_t gridZ;
+    uint32_t maxClusterLights;
+};
+
+struct VertexSpecConstants {
+    VkBool32 packedVertices;
+};
+
+struct PushConstants
+{
+    uint32_t materialIndex;
+};
 
-constexpr uint32_t MAX_LIGHTS = 2;
-constexpr uint32_t MAX_MATERIALS = 1;
+// Pushed to shadow.vert, after the fragment stage's PushConstants
+struct ShadowPushConstants
+{
+    glm::mat4 shadowMatrix;
+};
 
-constexpr uint32_t NUM_LIGHTS = 2;
+constexpr uint32_t SHADOW_PUSH_CONSTANTS_OFFSET = 16;
+static_assert(sizeof(PushConstants) <= SHADOW_PUSH_CONSTANTS_OFFSET);
 
-struct Light {
-    glm::vec3 position;
-    float _padding;
-    glm::vec3 color;
-    float power;
+struct DepthPyramidPushConstants
+{
+    glm::ivec2 sourceSize; // Only the rendered part of the depth attachment is reduced
 };
 
-struct Material {
-    glm::vec3 ambient;
-    float _padding0;
-    glm::vec3 diffuse;
-    float _padding1;
-    glm::vec3 specular;
-    float shininess;
+// The part of the HDR image the scene was rendered into, in texture coordinates, and the centre of its last texel
+struct SceneRegion
+{
+    glm::vec2 scale;
+    glm::vec2 max;
 };
 
-struct SpecConstants {
-    uint32_t numLights;
+struct BloomPushConstants
+{
+    SceneRegion source; // The whole level past the first
+    float threshold;
 };
 
-struct PushConstants
+struct TonemapPushConstants
 {
-    uint32_t materialIndex;
+    SceneRegion scene;
+    float sharpness;
 };
 
+constexpr SceneRegion WHOLE_LEVEL = { glm::vec2(1.0f), glm::vec2(1.0f) };
+
 struct LightingUniforms {
-    Light lights[MAX_LIGHTS];
     Material materials[MAX_MATERIALS];
+    glm::mat4 shadowFaces[RENDERER_SHADOW_FACES];
+};
+
+// Each frame's changed lights, materials and shadow faces are staged in its own slice of the upload ring, at most all of them
+constexpr VkDeviceSize LIGHTING_UPLOAD_SIZE = sizeof(Light) * RENDERER_MAX_LIGHTS + sizeof(Material) * MAX_MATERIALS +
+    sizeof(glm::mat4) * RENDERER_SHADOW_FACES;
+
+// std430 pads the struct to a multiple of its vec3's alignment
+static_assert(sizeof(Light) % (4 * sizeof(float)) == 0);
+
+// Per light cluster, a count followed by the indices of its lights
+constexpr VkDeviceSize LIGHT_GRID_SIZE = LIGHT_GRID_CLUSTERS * (1 + LIGHT_GRID_MAX_CLUSTER_LIGHTS) * sizeof(uint32_t);
+
+struct CullSpecConstants {
+    uint32_t maxInstances;
 };
 
 struct TransformUniforms
 {
-    glm::mat4 modelViewMatrix;
     glm::mat4 projectionMatrix;
-    glm::mat4 normalMatrix;
+    glm::mat4 viewMatrix;
+    glm::mat4 previousViewMatrix;
+    std::array<glm::vec4, 5> frustumPlanes;
+    std::array<glm::vec4, 5> viewFrustumPlanes;
+    glm::vec4 positionMin;
+    glm::vec4 positionScale;
+    glm::vec4 lodErrors;
+    glm::vec4 boundingSphere;
+    uint32_t instanceCount;
+    uint32_t occlusionEnabled;
+    uint32_t meshletCount;
+    uint32_t lodCount;
+    float lodScale;
+    uint32_t materialCount;
+    uint32_t firstIndex;
+    int32_t vertexOffset;
+    uint32_t firstMeshlet;
+    uint32_t lightCount;
+    float lightDepthScale;
+    float lightDepthBias;
+    glm::vec2 lightTileScale;
+    uint32_t lightGridOffset; // In elements, the light grid is bound whole rather than as a fifth dynamic buffer
+};
+
+// std140 aligns a vec2 to 8 bytes, glm doesn't
+static_assert(offsetof(TransformUniforms, lightTileScale) % (2 * sizeof(float)) == 0);
+
+static_assert(MESH_MAX_LODS == sizeof(TransformUniforms::lodErrors) / sizeof(float));
+
+// The coarsest LOD whose error stays under LOD_ERROR_PIXELS at this distance, matching cull.comp
+static uint32_t select_lod(const std::vector<MeshLod>& lods, float distance, float lodScale)
+{
+    uint32_t lod = 0;
+    while (lod + 1 < lods.size() && lods[lod + 1].error * lodScale <= distance)
+    {
+        ++lod;
+    }
+    return lod;
+}
+
+// Distance at which power / distance^2 falls to LIGHT_MIN_INTENSITY
+static float light_radius(float power)
+{
+    return glm::sqrt(power / LIGHT_MIN_INTENSITY);
+}
+
+// Per-instance vertex stream, written by the transform kernel straight from the World's component arrays
+using InstanceStream = std::array<InstanceTransform, MAX_ENTITIES>;
+
+// Raw component arrays for GPU culling, read by cull.comp as one flat float array
+struct InstanceInputs
+{
+    std::array<glm::quat, MAX_ENTITIES> rotations;
+    std::array<glm::vec3, MAX_ENTITIES> positions;
+};
+
+// One draw per LOD for each material
+constexpr uint32_t MAX_INDIRECT_DRAWS = MESH_MAX_LODS;
+
+// Reset every frame, then filled in by cull.comp
+struct IndirectDraws
+{
+    uint32_t drawCount;
+    std::array<VkDrawIndexedIndirectCommand, MAX_INDIRECT_DRAWS> commands;
+};
+
+// Materials are drawn one after another, so each gets its own list of draws and a single push constant update
+using MaterialDraws = std::array<IndirectDraws, MAX_MATERIALS>;
+
+// Cluster draws use the same layout per material, a count followed by the commands, but sized by the mesh's meshlet count
+constexpr VkDeviceSize INDIRECT_COMMANDS_OFFSET = sizeof(uint32_t);
+static_assert(offsetof(IndirectDraws, commands) == INDIRECT_COMMANDS_OFFSET);
+
+struct ClusterCullSpecConstants {
+    uint32_t maxClusterDraws;
 };
 
+constexpr uint32_t CULL_WORKGROUP_SIZE = 64;
+
+// clustercull.comp forwards every (coarser LOD, material) draw from its first workgroup
+static_assert((MESH_MAX_LODS - 1) * MAX_MATERIALS <= CULL_WORKGROUP_SIZE);
+
+constexpr VkFormat DEPTH_PYRAMID_FORMAT = VK_FORMAT_R32_SFLOAT;
+constexpr uint32_t DEPTH_PYRAMID_WORKGROUP_SIZE = 8;
+
+// Each shadow casting light draws its cube faces into a row of square tiles, one column per face
+constexpr uint32_t SHADOW_TILE_SIZE = 512;
+constexpr VkExtent2D SHADOW_ATLAS_EXTENT = { RENDERER_SHADOW_FACES * SHADOW_TILE_SIZE, RENDERER_MAX_SHADOW_LIGHTS * SHADOW_TILE_SIZE };
+constexpr float SHADOW_NEAR_PLANE = 0.05f;
+
+// Negative as depth is reversed, pushing casters away from the light so lit surfaces don't shadow themselves
+constexpr float SHADOW_DEPTH_BIAS_CONSTANT = -2.0f;
+constexpr float SHADOW_DEPTH_BIAS_SLOPE = -2.5f;
+
+// Shadow instance streams hold the fighters and projectiles first, then the props from here
+constexpr uint32_t SHADOW_STATIC_FIRST_INSTANCE = MAX_FIGHTERS + MAX_PROJECTILES;
+
+// The scene is lit into the first of these that can be rendered to and filtered, B10G11R11 at half the bandwidth
+constexpr std::array HDR_FORMATS = { VK_FORMAT_B10G11R11_UFLOAT_PACK32, VK_FORMAT_R16G16B16A16_SFLOAT };
+
+// Bloom levels are written by compute, which every device supports for RGBA16F. Levels stop halving before the
+// smaller side drops below BLOOM_MIN_SIZE.
+constexpr VkFormat BLOOM_FORMAT = VK_FORMAT_R16G16B16A16_SFLOAT;
+constexpr uint32_t BLOOM_MIN_SIZE = 8;
+constexpr uint32_t BLOOM_WORKGROUP_SIZE = 8;
+constexpr float BLOOM_THRESHOLD = 1.0f; // Only what is brighter than white blooms
+
+// Tonemapped color is graded through a 3D LUT, baked at startup from a slight saturation boost and warm tint
+constexpr VkFormat COLOR_GRADING_FORMAT = VK_FORMAT_A2B10G10R10_UNORM_PACK32;
+constexpr uint32_t COLOR_GRADING_LUT_SIZE = 32;
+constexpr float COLOR_GRADING_SATURATION = 1.1f;
+constexpr glm::vec3 COLOR_GRADING_TINT = { 1.02f, 1.0f, 0.96f };
+
+// The scene's resolution follows GPU frame time, see Renderer::scale_resolution
+constexpr float DYNAMIC_RESOLUTION_MIN_SCALE = 0.5f;
+constexpr float DYNAMIC_RESOLUTION_HEADROOM = 0.15f; // Of the budget, for spikes and tonemapping
+constexpr float DYNAMIC_RESOLUTION_TOLERANCE = 0.05f; // Frame times this close to the target leave the scale alone
+constexpr float DYNAMIC_RESOLUTION_MAX_STEP = 0.05f; // Per frame, as timings lag a few frames behind
+constexpr float UPSCALE_SHARPNESS = 0.25f; // At the minimum scale, less the closer to full resolution
+
 constexpr uint32_t DEFAULT_IMAGE_COUNT = 3;
 
-constexpr VkFormat DEPTH_FORMAT = VK_FORMAT_D16_UNORM;
+// Written before the render pass, after the depth prepass, after the render pass, after each half of bloom, after
+// tonemapping, at the start of the frame and before bloom, by every frame in flight
+constexpr uint32_t TIMESTAMPS_PER_FRAME = 8;
+
+// Most precise first. Depth is reversed, so a float format spreads its precision evenly over distance.
+constexpr std::array DEPTH_FORMATS = { VK_FORMAT_D32_SFLOAT, VK_FORMAT_X8_D24_UNORM_PACK32, VK_FORMAT_D16_UNORM };
 constexpr float FIELD_OF_VIEW = glm::radians(45.0f);
-constexpr float NEAR_CLIP_PLANE = 1.0f;
+constexpr float NEAR_CLIP_PLANE = 0.1f;
+constexpr float LOD_ERROR_PIXELS = 1.0f;
 constexpr char PIPELINE_CACHE_FILENAME[] = "pipelinecache.bin";
+constexpr char SHADER_DIRECTORY[] = "shaders";
 constexpr VkDeviceSize STAGING_BUFFER_SIZE = 1 << 17;
 
+static_assert(COLOR_GRADING_LUT_SIZE * COLOR_GRADING_LUT_SIZE * COLOR_GRADING_LUT_SIZE * sizeof(uint32_t) <= STAGING_BUFFER_SIZE);
+
+// Every mesh's vertices, indices and meshlets are sub-allocated from one buffer each, of this many elements
+constexpr uint32_t GEOMETRY_MAX_VERTICES = 1 << 20;
+constexpr uint32_t GEOMETRY_MAX_INDICES = 1 << 22;
+constexpr uint32_t GEOMETRY_MAX_MESHLETS = 1 << 16;
+constexpr uint32_t GEOMETRY_MAX_MESHES = 256;
+
+// Cluster draw lists are sized before any mesh is loaded, meshes with more full detail meshlets of one material than
+// this are drawn without cluster culling. Covers the bundled models, at about 0.5MB of draw lists per meshlet.
+constexpr uint32_t CLUSTER_MAX_MATERIAL_MESHLETS = 64;
+
+// Loaded meshes kept in memory, counting the CPU side copy
+constexpr size_t ASSET_MESH_BUDGET = 64 << 20;
+constexpr uint32_t ASSET_NUM_WORKERS = 2;
+
+constexpr MeshHandle NO_MESH = UINT32_MAX;
+
+// main.frag and lightcull.comp share the grid's dimensions
+static std::array<VkSpecializationMapEntry, 4> light_grid_spec_map()
+{
+    std::array<VkSpecializationMapEntry, 4> specMap = {};
+    specMap[0].constantID = 0;
+    specMap[0].offset = offsetof(LightGridSpecConstants, gridX);
+    specMap[0].size = sizeof(LightGridSpecConstants::gridX);
+    specMap[1].constantID = 1;
+    specMap[1].offset = offsetof(LightGridSpecConstants, gridY);
+    specMap[1].size = sizeof(LightGridSpecConstants::gridY);
+    specMap[2].constantID = 2;
+    specMap[2].offset = offsetof(LightGridSpecConstants, gridZ);
+    specMap[2].size = sizeof(LightGridSpecConstants::gridZ);
+    specMap[3].constantID = 3;
+    specMap[3].offset = offsetof(LightGridSpecConstants, maxClusterLights);
+    specMap[3].size = sizeof(LightGridSpecConstants::maxClusterLights);
+    return specMap;
+}
+
 constexpr void check_success(VkResult vkResult)
 {
     if (vkResult)
@@ -67,6 +281,11 @@ constexpr void check_success(VkResult vkResult)
     }
 }
 
+constexpr VkDeviceSize align_up(VkDeviceSize size, VkDeviceSize alignment)
+{
+    return (size + alignment - 1) / alignment * alignment;
+}
+
 static std::vector<uint8_t> load_file(const std::string& name)
 {
     std::ifstream file(name, std::ios::binary);
@@ -79,12 +298,29 @@ static std::vector<uint8_t> load_file(const std::string& name)
 
 static std::vector<uint32_t> load_shader(const std::string& name)
 {
-    const auto raw = load_file("shaders/" + name + ".spv");
+    const auto raw = load_file(std::string(SHADER_DIRECTORY) + "/" + name + ".spv");
+    if (raw.empty())
+    {
+        throw std::runtime_error("Unable to load shader " + name);
+    }
+
     std::vector<uint32_t> ret(raw.size() / sizeof(uint32_t));
     memcpy(ret.data(), raw.data(), ret.size() * sizeof(uint32_t));
     return ret;
 }
 
+static VkShaderModule create_shader_module(VkDevice device, const std::string& name)
+{
+    const auto shaderData = load_shader(name);
+    VkShaderModuleCreateInfo shaderModuleCreateInfo = { VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO };
+    shaderModuleCreateInfo.codeSize = shaderData.size() * sizeof(uint32_t);
+    shaderModuleCreateInfo.pCode = shaderData.data();
+
+    VkShaderModule shaderModule;
+    check_success(vkCreateShaderModule(device, &shaderModuleCreateInfo, nullptr, &shaderModule));
+    return shaderModule;
+}
+
 template<typename T>
 static void save_file(const std::string& name, T begin, T end)
 {
@@ -117,6 +353,112 @@ static VkSurfaceFormatKHR select_format(VkPhysicalDevice physicalDevice, VkSurfa
     return surfaceFormats[0];
 }
 
+static VkFormat select_depth_format(VkPhysicalDevice physicalDevice, VkFormatFeatureFlags requiredFeatures)
+{
+    for (const auto depthFormat : DEPTH_FORMATS)
+    {
+        VkFormatProperties formatProperties;
+        vkGetPhysicalDeviceFormatProperties(physicalDevice, depthFormat, &formatProperties);
+        if (requiredFeatures == (formatProperties.optimalTilingFeatures & requiredFeatures))
+        {
+            return depthFormat;
+        }
+    }
+
+    throw std::runtime_error("No supported depth format");
+}
+
+static VkFormat select_hdr_format(VkPhysicalDevice physicalDevice)
+{
+    constexpr VkFormatFeatureFlags requiredFeatures = VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT |
+        VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+
+    for (const auto hdrFormat : HDR_FORMATS)
+    {
+        VkFormatProperties formatProperties;
+        vkGetPhysicalDeviceFormatProperties(physicalDevice, hdrFormat, &formatProperties);
+        if (requiredFeatures == (formatProperties.optimalTilingFeatures & requiredFeatures))
+        {
+            return hdrFormat;
+        }
+    }
+
+    throw std::runtime_error("No supported HDR format");
+}
+
+// Transient attachments never leave tile memory on GPUs that offer lazily allocated memory, elsewhere they fall back to
+// ordinary device memory
+static void create_attachment_image(VmaAllocator allocator, const VkImageCreateInfo& imageCreateInfo, VkImage *pImage, VmaAllocation *pMemory)
+{
+    VmaAllocationCreateInfo allocationCreateInfo = {};
+    allocationCreateInfo.flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
+    allocationCreateInfo.usage = (imageCreateInfo.usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT)
+        ? VMA_MEMORY_USAGE_GPU_LAZILY_ALLOCATED : VMA_MEMORY_USAGE_GPU_ONLY;
+
+    auto result = vmaCreateImage(allocator, &imageCreateInfo, &allocationCreateInfo, pImage, pMemory, nullptr);
+    if (VK_ERROR_FEATURE_NOT_PRESENT == result && VMA_MEMORY_USAGE_GPU_LAZILY_ALLOCATED == allocationCreateInfo.usage)
+    {
+        allocationCreateInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+        result = vmaCreateImage(allocator, &imageCreateInfo, &allocationCreateInfo, pImage, pMemory, nullptr);
+    }
+    check_success(result);
+}
+
+// Reversed-Z with the far plane at infinity, depth is near / z so it is 1 at the near plane and falls to 0
+static glm::mat4 reversed_infinite_perspective(float fieldOfView, float aspectRatio, float near)
+{
+    const float scale = 1.0f / glm::tan(fieldOfView * 0.5f);
+
+    glm::mat4 projectionMatrix(0.0f);
+    projectionMatrix[0][0] = scale / aspectRatio;
+    projectionMatrix[1][1] = scale;
+    projectionMatrix[2][3] = 1.0f;
+    projectionMatrix[3][2] = near;
+    return projectionMatrix;
+}
+
+// View projections of the cube faces around a light at the origin, in the +X, -X, +Y, -Y, +Z, -Z order main.frag picks
+// them in. Each covers the directions whose largest component is its axis.
+static std::array<glm::mat4, RENDERER_SHADOW_FACES> shadow_face_matrices()
+{
+    constexpr std::array<std::pair<glm::vec3, glm::vec3>, RENDERER_SHADOW_FACES> faceDirections = { {
+        { { 1, 0, 0 }, { 0, 1, 0 } },
+        { { -1, 0, 0 }, { 0, 1, 0 } },
+        { { 0, 1, 0 }, { 0, 0, -1 } },
+        { { 0, -1, 0 }, { 0, 0, 1 } },
+        { { 0, 0, 1 }, { 0, 1, 0 } },
+        { { 0, 0, -1 }, { 0, 1, 0 } }
+    } };
+
+    const auto projectionMatrix = reversed_infinite_perspective(glm::radians(90.0f), 1.0f, SHADOW_NEAR_PLANE);
+
+    std::array<glm::mat4, RENDERER_SHADOW_FACES> faceMatrices;
+    for (uint32_t face = 0; face < RENDERER_SHADOW_FACES; ++face)
+    {
+        const auto& [forward, up] = faceDirections[face];
+        faceMatrices[face] = projectionMatrix * glm::lookAt(glm::vec3(0.0f), forward, up);
+    }
+    return faceMatrices;
+}
+
+static SceneRegion scene_region(VkExtent2D renderExtent, VkExtent2D surfaceExtent)
+{
+    const glm::vec2 renderSize(renderExtent.width, renderExtent.height);
+    const glm::vec2 surfaceSize(surfaceExtent.width, surfaceExtent.height);
+    return { renderSize / surfaceSize, (renderSize - 0.5f) / surfaceSize };
+}
+
+// Between the levels of a bloom pass, each reading the one the previous dispatch wrote
+static void level_barrier(VkCommandBuffer commandBuffer)
+{
+    VkMemoryBarrier levelBarrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+    levelBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    levelBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+        1, &levelBarrier, 0, nullptr, 0, nullptr);
+}
+
 static VkPresentModeKHR select_present_mode(VkPhysicalDevice physicalDevice, VkSurfaceKHR surface)
 {
     uint32_t numPresentModes;
@@ -137,24 +479,97 @@ static VkPresentModeKHR select_present_mode(VkPhysicalDevice physicalDevice, VkS
 }
 
 Renderer::Renderer(RendererFlags flags, xcb_connection_t *connection, xcb_window_t window)
-    :_mesh("../models/monkey_smooth.obj")
+    :_assets(ASSET_MESH_BUDGET, ASSET_NUM_WORKERS), _transformKernel(select_transform_kernel()), _stats{},
+    _visibleIndices(MAX_ENTITIES), _visiblePositions(MAX_ENTITIES), _visibleRotations(MAX_ENTITIES),
+    _visibleLods(MAX_ENTITIES), _lodPositions(MAX_ENTITIES), _lodRotations(MAX_ENTITIES), _lodInstanceCounts{},
+    _vertexAllocator(GEOMETRY_MAX_VERTICES, GEOMETRY_MAX_MESHES), _indexAllocator(GEOMETRY_MAX_INDICES, GEOMETRY_MAX_MESHES),
+    _meshletAllocator(GEOMETRY_MAX_MESHLETS, GEOMETRY_MAX_MESHES), _uploadingMesh(NO_MESH), _uploadPending(false),
+    _frameNumber(0), _materialsMesh(NO_MESH), _lights(RENDERER_MAX_LIGHTS), _materials(MAX_MATERIALS),
+    _shadowFaces(RENDERER_SHADOW_FACES), _shadowLightCount(0), _shadowCaches{}, _shadowMesh(NO_MESH), _shadowPropCount(0),
+    _shadowAtlasesInitialized(false), _timings{}, _frameMesh(nullptr), _frameGeometry(nullptr), _imageIndex(0),
+    _frameClusterDraws(0)
 {
+    sampleCount = VK_SAMPLE_COUNT_1_BIT;
+    requestedSampleCount = VK_SAMPLE_COUNT_1_BIT;
+    renderScale = 1.0f;
+    frameTimeBudget = 0.0f;
+    gpuDrivenCulling = RendererFlags::None != (RendererFlags::GpuDrivenCulling & flags);
+    occlusionCulling = gpuDrivenCulling && RendererFlags::None != (RendererFlags::OcclusionCulling & flags);
+    clusterCulling = gpuDrivenCulling && RendererFlags::None != (RendererFlags::ClusterCulling & flags);
+    packedVertices = RendererFlags::None != (RendererFlags::PackedVertices & flags);
+    depthPrepass = RendererFlags::None != (RendererFlags::DepthPrepass & flags);
+    previousViewMatrix = glm::mat4(1.0f);
+    timestampsWritten.fill(false);
+
+    const auto faceMatrices = shadow_face_matrices();
+    for (uint32_t face = 0; face < RENDERER_SHADOW_FACES; ++face)
+    {
+        _shadowFaces.set(face, faceMatrices[face]);
+    }
+
+    if (RendererFlags::None != (RendererFlags::HotReload & flags))
+    {
+        _watcher = std::make_unique<FileWatcher>();
+        _watcher->watch(SHADER_DIRECTORY);
+    }
+
     create_instance(flags);
     create_surface(connection, window);
     select_physical_device();
     create_device(flags);
     create_upload_objects();
     allocate_static_memory();
-    begin_data_upload();
     create_common();
     create_descriptors();
     create_pipeline();
+    create_shadow_atlases();
+    create_color_grading();
     create_swapchain();
-    finish_data_upload();
+}
+
+Renderer::~Renderer()
+{
+    // A rebuild that failed has already destroyed what it created
+    if (_pipelineRebuild.valid())
+    {
+        try
+        {
+            destroy_pipelines(_pipelineRebuild.get());
+        }
+        catch (const std::exception&)
+        {
+        }
+    }
+
+    vkDeviceWaitIdle(d.device);
+    for (const auto& retired : _retiredPipelines)
+    {
+        destroy_pipelines(retired.second);
+    }
+}
+
+MeshHandle Renderer::request_mesh(const std::string& filename, AssetPriority priority)
+{
+    if (_watcher)
+    {
+        _watcher->watch(std::filesystem::path(filename).parent_path().string());
+    }
+
+    return _assets.request_mesh(filename, priority);
 }
 
 void Renderer::render(const Scene& scene)
 {
+    stream_meshes();
+    if (_watcher)
+    {
+        hot_reload();
+    }
+    if (requestedSampleCount != sampleCount)
+    {
+        rebuild_render_pass();
+    }
+
     uint32_t imageIndex;
     const auto acquireResult = vkAcquireNextImageKHR(d.device, d.swapchain, UINT64_MAX, d.acquireCompleteSemaphore, nullptr, &imageIndex);
 
@@ -184,6 +599,7 @@ void Renderer::render(const Scene& scene)
         check_success(vkWaitForFences(d.device, 1, &frameData.fence, VK_TRUE, UINT64_MAX));
         check_success(vkResetFences(d.device, 1, &frameData.fence));
 
+        read_timestamps(frameIndex);
         record_command_buffer(frameIndex, imageIndex, scene);
 
         constexpr VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
@@ -224,6 +640,65 @@ void Renderer::render(const Scene& scene)
     }
 }
 
+void Renderer::set_depth_prepass(bool enabled) noexcept
+{
+    depthPrepass = enabled;
+}
+
+bool Renderer::depth_prepass() const noexcept
+{
+    return depthPrepass;
+}
+
+uint32_t Renderer::set_msaa_samples(uint32_t samples) noexcept
+{
+    const auto& limits = physicalDeviceProperties.limits;
+    VkSampleCountFlags supported = limits.framebufferColorSampleCounts & limits.framebufferDepthSampleCounts;
+    if (occlusionCulling)
+    {
+        // The depth pyramid reads every sample of the depth attachment
+        supported &= limits.sampledImageDepthSampleCounts;
+    }
+
+    uint32_t clamped = VK_SAMPLE_COUNT_1_BIT;
+    while (clamped * 2 <= samples && clamped * 2 <= VK_SAMPLE_COUNT_64_BIT && (supported & (clamped * 2)))
+    {
+        clamped *= 2;
+    }
+
+    requestedSampleCount = static_cast<VkSampleCountFlagBits>(clamped);
+    return requestedSampleCount;
+}
+
+uint32_t Renderer::msaa_samples() const noexcept
+{
+    return requestedSampleCount;
+}
+
+void Renderer::set_frame_time_budget(float milliseconds) noexcept
+{
+    frameTimeBudget = milliseconds;
+    if (frameTimeBudget <= 0.0f)
+    {
+        renderScale = 1.0f;
+    }
+}
+
+float Renderer::render_scale() const noexcept
+{
+    return renderScale;
+}
+
+const CullStats& Renderer::stats() const noexcept
+{
+    return _stats;
+}
+
+const RenderTimings& Renderer::timings() const noexcept
+{
+    return _timings;
+}
+
 void Renderer::save_caches()
 {
     size_t dataSize;
@@ -287,10 +762,13 @@ void Renderer::select_physical_device()
             VkBool32 surfaceSupported;
             check_success(vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevice, i, d.surface, &surfaceSupported));
 
-            if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT && surfaceSupported)
+            // Culling runs as compute on the graphics queue
+            if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT && queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT && surfaceSupported)
             {
                 this->physicalDevice = physicalDevice;
                 queueFamilyIndex = i;
+                timestampsSupported = queueFamily.timestampValidBits > 0;
+                vkGetPhysicalDeviceProperties(physicalDevice, &physicalDeviceProperties);
                 return;
             }
         }
@@ -311,9 +789,29 @@ void Renderer::create_device(RendererFlags flags)
     queueCreateInfo.queueCount = 1;
     queueCreateInfo.pQueuePriorities = &queuePriority;
 
-    constexpr std::array deviceExtensions = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
+    uint32_t numAvailableExtensions;
+    check_success(vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &numAvailableExtensions, nullptr));
+    std::vector<VkExtensionProperties> availableExtensions(numAvailableExtensions);
+    check_success(vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &numAvailableExtensions, availableExtensions.data()));
+
+    const auto extension_available = [&](const char *name)
+    {
+        return availableExtensions.end() != std::find_if(availableExtensions.begin(), availableExtensions.end(),
+            [name](const VkExtensionProperties& extension) { return 0 == strcmp(extension.extensionName, name); });
+    };
+
+    std::vector deviceExtensions = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
+
+    const bool drawIndirectCountSupported = extension_available(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+    if (drawIndirectCountSupported)
+    {
+        deviceExtensions.emplace_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+    }
 
     VkPhysicalDeviceFeatures enabledFeatures = {};
+    enabledFeatures.multiDrawIndirect = availableFeatures.multiDrawIndirect;
+    enabledFeatures.drawIndirectFirstInstance = availableFeatures.drawIndirectFirstInstance;
+    multiDrawIndirectSupported = availableFeatures.multiDrawIndirect;
 
     if (RendererFlags::None != (RendererFlags::SupportGpuAssistedDebugging & flags))
     {
@@ -331,6 +829,21 @@ void Renderer::create_device(RendererFlags flags)
     check_success(vkCreateDevice(physicalDevice, &deviceCreateInfo, nullptr, &d.device));
     vkGetDeviceQueue(d.device, queueFamilyIndex, 0, &queue);
 
+    cmdDrawIndexedIndirectCount = nullptr;
+    if (drawIndirectCountSupported)
+    {
+        cmdDrawIndexedIndirectCount = reinterpret_cast<PFN_vkCmdDrawIndexedIndirectCountKHR>(vkGetDeviceProcAddr(d.device, "vkCmdDrawIndexedIndirectCountKHR"));
+    }
+
+    // Every (instance, meshlet) pair can become a draw in its material's list, which needs one multi-draw with per-draw
+    // instance offsets. Meshlets only cover full detail, so the coarser LODs' draws are passed through whole.
+    maxClusterDraws = MAX_ENTITIES * CLUSTER_MAX_MATERIAL_MESHLETS + MAX_INDIRECT_DRAWS - 1;
+    clusterDrawListSize = INDIRECT_COMMANDS_OFFSET + maxClusterDraws * sizeof(VkDrawIndexedIndirectCommand);
+    clusterCulling = clusterCulling
+        && (drawIndirectCountSupported || availableFeatures.multiDrawIndirect)
+        && availableFeatures.drawIndirectFirstInstance
+        && maxClusterDraws <= physicalDeviceProperties.limits.maxDrawIndirectCount;
+
     VmaAllocatorCreateInfo allocatorCreateInfo = {};
     allocatorCreateInfo.physicalDevice = physicalDevice;
     allocatorCreateInfo.device = d.device;
@@ -369,8 +882,15 @@ void Renderer::allocate_static_memory()
 
     check_success(vmaCreateBuffer(d.allocator, &stagingBufferCreateInfo, &stagingBufferAllocationCreateInfo, &d.stagingBuffer, &d.stagingMemory, nullptr));
 
+    const auto& limits = physicalDeviceProperties.limits;
+    transformUniformStride = align_up(sizeof(TransformUniforms), limits.minUniformBufferOffsetAlignment);
+    instanceInputStride = align_up(sizeof(InstanceInputs), limits.minStorageBufferOffsetAlignment);
+    culledInstanceStride = align_up(MAX_INDIRECT_DRAWS * sizeof(InstanceStream), limits.minStorageBufferOffsetAlignment);
+    indirectStride = align_up(sizeof(MaterialDraws), limits.minStorageBufferOffsetAlignment);
+    clusterDrawStride = align_up(MAX_MATERIALS * clusterDrawListSize, limits.minStorageBufferOffsetAlignment);
+
     VkBufferCreateInfo transformUniformBufferCreateInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
-    transformUniformBufferCreateInfo.size = RENDERER_MAX_FRAMES_IN_FLIGHT * sizeof(TransformUniforms);
+    transformUniformBufferCreateInfo.size = RENDERER_MAX_FRAMES_IN_FLIGHT * transformUniformStride;
     transformUniformBufferCreateInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
 
     VmaAllocationCreateInfo transformUniformBufferAllocationInfo = { };
@@ -389,64 +909,112 @@ void Renderer::allocate_static_memory()
     check_success(vmaCreateBuffer(d.allocator, &lightingUniformBufferCreateInfo, &lightingUniformBufferAllocationInfo, &d.lightingUniformBuffer, &d.lightingUniformMemory, nullptr));
 
     VkBufferCreateInfo vertexBufferCreateInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
-    vertexBufferCreateInfo.size = sizeof(PerVertex) * _mesh.verticies.size();
+    vertexBufferCreateInfo.size = (packedVertices ? sizeof(PackedVertex) : sizeof(PerVertex)) * GEOMETRY_MAX_VERTICES;
     vertexBufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
 
     VmaAllocationCreateInfo vertexBufferAllocationCreateInfo = {};
     vertexBufferAllocationCreateInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
 
     check_success(vmaCreateBuffer(d.allocator, &vertexBufferCreateInfo, &vertexBufferAllocationCreateInfo, &d.vertexBuffer, &d.vertexMemory, nullptr));
-}
 
-void Renderer::begin_data_upload()
-{  
-    void *pData;
-    check_success(vmaMapMemory(d.allocator, d.stagingMemory, &pData));
+    VkBufferCreateInfo indexBufferCreateInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+    indexBufferCreateInfo.size = sizeof(uint32_t) * GEOMETRY_MAX_INDICES;
+    indexBufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
 
-    constexpr VkDeviceSize lightingOffset = 0;
-    constexpr VkDeviceSize lightingSize = sizeof(LightingUniforms);
-    constexpr VkBufferCopy lightingRegion { lightingOffset, 0, lightingSize };
+    VmaAllocationCreateInfo indexBufferAllocationCreateInfo = {};
+    indexBufferAllocationCreateInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
 
-    LightingUniforms lightingData;
-    lightingData.lights[0].position = { 2.0f, 10.0f, 0.0f };
-    lightingData.lights[0].color = { 1.0f, 1.0f, 1.0f };
-    lightingData.lights[0].power = 40.0f;
-    lightingData.lights[1].position = { 2.0f, -2.0f, 0.0f };
-    lightingData.lights[1].color = { 1.0f, 0.7f, 0.7f };
-    lightingData.lights[1].power = 4.0f;
-    lightingData.materials[0].ambient = { 0.1, 0.1, 0.1 };
-    lightingData.materials[0].diffuse = { 0.7, 0.5, 0.3 };
-    lightingData.materials[0].specular = { 1.0, 1.0, 1.0 };
-    lightingData.materials[0].shininess = 16.0f;
+    check_success(vmaCreateBuffer(d.allocator, &indexBufferCreateInfo, &indexBufferAllocationCreateInfo, &d.indexBuffer, &d.indexMemory, nullptr));
 
-    memcpy(reinterpret_cast<void *>(reinterpret_cast<uintptr_t>(pData) + lightingOffset), &lightingData, lightingSize);
+    VkBufferCreateInfo instanceBufferCreateInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+    instanceBufferCreateInfo.size = RENDERER_MAX_FRAMES_IN_FLIGHT * sizeof(InstanceStream);
+    instanceBufferCreateInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
 
-    const VkDeviceSize vertexOffset = lightingOffset + lightingSize;
-    const VkDeviceSize vertexSize = sizeof(PerVertex) * _mesh.verticies.size();
-    const VkBufferCopy vertexRegion { vertexOffset, 0, vertexSize };
+    VmaAllocationCreateInfo instanceBufferAllocationCreateInfo = {};
+    instanceBufferAllocationCreateInfo.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
 
-    memcpy(reinterpret_cast<void *>(reinterpret_cast<uintptr_t>(pData) + vertexOffset), _mesh.verticies.data(), vertexSize);
+    check_success(vmaCreateBuffer(d.allocator, &instanceBufferCreateInfo, &instanceBufferAllocationCreateInfo, &d.instanceBuffer, &d.instanceMemory, nullptr));
 
-    const VkDeviceSize finalOffset = vertexOffset + vertexSize;
-    if (finalOffset > STAGING_BUFFER_SIZE)
-    {
-        throw std::runtime_error("Out of GPU memory");
-    }
+    VkBufferCreateInfo instanceInputBufferCreateInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+    instanceInputBufferCreateInfo.size = RENDERER_MAX_FRAMES_IN_FLIGHT * instanceInputStride;
+    instanceInputBufferCreateInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
 
-    vmaUnmapMemory(d.allocator, d.stagingMemory);
+    VmaAllocationCreateInfo instanceInputBufferAllocationCreateInfo = {};
+    instanceInputBufferAllocationCreateInfo.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
 
-    VkCommandBufferBeginInfo commandBufferBeginInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
-    commandBufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    check_success(vmaCreateBuffer(d.allocator, &instanceInputBufferCreateInfo, &instanceInputBufferAllocationCreateInfo, &d.instanceInputBuffer, &d.instanceInputMemory, nullptr));
 
-    check_success(vkBeginCommandBuffer(d.uploadCommandBuffer, &commandBufferBeginInfo));
-        vkCmdCopyBuffer(d.uploadCommandBuffer, d.stagingBuffer, d.lightingUniformBuffer, 1, &lightingRegion);
-        vkCmdCopyBuffer(d.uploadCommandBuffer, d.stagingBuffer, d.vertexBuffer, 1, &vertexRegion);
-    check_success(vkEndCommandBuffer(d.uploadCommandBuffer));
+    VkBufferCreateInfo culledInstanceBufferCreateInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+    culledInstanceBufferCreateInfo.size = RENDERER_MAX_FRAMES_IN_FLIGHT * culledInstanceStride;
+    culledInstanceBufferCreateInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
 
-    VkSubmitInfo submitInfo = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &d.uploadCommandBuffer;
-    check_success(vkQueueSubmit(queue, 1, &submitInfo, d.uploadFence));
+    VmaAllocationCreateInfo culledInstanceBufferAllocationCreateInfo = {};
+    culledInstanceBufferAllocationCreateInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+    check_success(vmaCreateBuffer(d.allocator, &culledInstanceBufferCreateInfo, &culledInstanceBufferAllocationCreateInfo, &d.culledInstanceBuffer, &d.culledInstanceMemory, nullptr));
+
+    VkBufferCreateInfo indirectBufferCreateInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+    indirectBufferCreateInfo.size = RENDERER_MAX_FRAMES_IN_FLIGHT * indirectStride;
+    indirectBufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
+
+    VmaAllocationCreateInfo indirectBufferAllocationCreateInfo = {};
+    indirectBufferAllocationCreateInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+    check_success(vmaCreateBuffer(d.allocator, &indirectBufferCreateInfo, &indirectBufferAllocationCreateInfo, &d.indirectBuffer, &d.indirectMemory, nullptr));
+
+    VkBufferCreateInfo meshletBufferCreateInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+    meshletBufferCreateInfo.size = sizeof(Meshlet) * GEOMETRY_MAX_MESHLETS;
+    meshletBufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+
+    VmaAllocationCreateInfo meshletBufferAllocationCreateInfo = {};
+    meshletBufferAllocationCreateInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+    check_success(vmaCreateBuffer(d.allocator, &meshletBufferCreateInfo, &meshletBufferAllocationCreateInfo, &d.meshletBuffer, &d.meshletMemory, nullptr));
+
+    VkBufferCreateInfo clusterDrawBufferCreateInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+    clusterDrawBufferCreateInfo.size = RENDERER_MAX_FRAMES_IN_FLIGHT * clusterDrawStride;
+    clusterDrawBufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
+
+    VmaAllocationCreateInfo clusterDrawBufferAllocationCreateInfo = {};
+    clusterDrawBufferAllocationCreateInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+    check_success(vmaCreateBuffer(d.allocator, &clusterDrawBufferCreateInfo, &clusterDrawBufferAllocationCreateInfo, &d.clusterDrawBuffer, &d.clusterDrawMemory, nullptr));
+
+    VkBufferCreateInfo lightBufferCreateInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+    lightBufferCreateInfo.size = sizeof(Light) * RENDERER_MAX_LIGHTS;
+    lightBufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+
+    VmaAllocationCreateInfo lightBufferAllocationCreateInfo = {};
+    lightBufferAllocationCreateInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+    check_success(vmaCreateBuffer(d.allocator, &lightBufferCreateInfo, &lightBufferAllocationCreateInfo, &d.lightBuffer, &d.lightMemory, nullptr));
+
+    VkBufferCreateInfo lightingUploadBufferCreateInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+    lightingUploadBufferCreateInfo.size = RENDERER_MAX_FRAMES_IN_FLIGHT * LIGHTING_UPLOAD_SIZE;
+    lightingUploadBufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+
+    VmaAllocationCreateInfo lightingUploadBufferAllocationCreateInfo = {};
+    lightingUploadBufferAllocationCreateInfo.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+
+    check_success(vmaCreateBuffer(d.allocator, &lightingUploadBufferCreateInfo, &lightingUploadBufferAllocationCreateInfo, &d.lightingUploadBuffer, &d.lightingUploadMemory, nullptr));
+
+    VkBufferCreateInfo lightGridBufferCreateInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+    lightGridBufferCreateInfo.size = RENDERER_MAX_FRAMES_IN_FLIGHT * LIGHT_GRID_SIZE;
+    lightGridBufferCreateInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+
+    VmaAllocationCreateInfo lightGridBufferAllocationCreateInfo = {};
+    lightGridBufferAllocationCreateInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+    check_success(vmaCreateBuffer(d.allocator, &lightGridBufferCreateInfo, &lightGridBufferAllocationCreateInfo, &d.lightGridBuffer, &d.lightGridMemory, nullptr));
+
+    VkBufferCreateInfo shadowInstanceBufferCreateInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+    shadowInstanceBufferCreateInfo.size = RENDERER_MAX_FRAMES_IN_FLIGHT * sizeof(InstanceStream);
+    shadowInstanceBufferCreateInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+
+    VmaAllocationCreateInfo shadowInstanceBufferAllocationCreateInfo = {};
+    shadowInstanceBufferAllocationCreateInfo.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+
+    check_success(vmaCreateBuffer(d.allocator, &shadowInstanceBufferCreateInfo, &shadowInstanceBufferAllocationCreateInfo, &d.shadowInstanceBuffer, &d.shadowInstanceMemory, nullptr));
 }
 
 void Renderer::create_common()
@@ -457,46 +1025,173 @@ void Renderer::create_common()
 
     check_success(vkCreateCommandPool(d.device, &commandPoolCreateInfo, nullptr, &d.commandPool));
 
-    std::array<VkDescriptorSetLayoutBinding, 2> descriptorSetBindings = {};
+    std::array<VkDescriptorSetLayoutBinding, 11> descriptorSetBindings = {};
     descriptorSetBindings[0].binding = 0;
     descriptorSetBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
     descriptorSetBindings[0].descriptorCount = 1;
-    descriptorSetBindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    descriptorSetBindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
     descriptorSetBindings[1].binding = 1;
     descriptorSetBindings[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
     descriptorSetBindings[1].descriptorCount = 1;
     descriptorSetBindings[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    for (uint32_t i = 2; i < 5; ++i)
+    {
+        descriptorSetBindings[i].binding = i;
+        descriptorSetBindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+        descriptorSetBindings[i].descriptorCount = 1;
+        descriptorSetBindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+    descriptorSetBindings[5].binding = 5;
+    descriptorSetBindings[5].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    descriptorSetBindings[5].descriptorCount = 1;
+    descriptorSetBindings[5].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    descriptorSetBindings[6].binding = 6;
+    descriptorSetBindings[6].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    descriptorSetBindings[6].descriptorCount = 1;
+    descriptorSetBindings[6].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    descriptorSetBindings[7].binding = 7;
+    descriptorSetBindings[7].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+    descriptorSetBindings[7].descriptorCount = 1;
+    descriptorSetBindings[7].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    descriptorSetBindings[8].binding = 8;
+    descriptorSetBindings[8].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    descriptorSetBindings[8].descriptorCount = 1;
+    descriptorSetBindings[8].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+    descriptorSetBindings[9].binding = 9;
+    descriptorSetBindings[9].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    descriptorSetBindings[9].descriptorCount = 1;
+    descriptorSetBindings[9].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+    descriptorSetBindings[10].binding = 10;
+    descriptorSetBindings[10].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    descriptorSetBindings[10].descriptorCount = 1;
+    descriptorSetBindings[10].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 
     VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCreateInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
     descriptorSetLayoutCreateInfo.bindingCount = descriptorSetBindings.size();
     descriptorSetLayoutCreateInfo.pBindings = descriptorSetBindings.data();
     check_success(vkCreateDescriptorSetLayout(d.device, &descriptorSetLayoutCreateInfo, nullptr, &d.descriptorSetLayout));
 
-    constexpr VkPushConstantRange pushConstantRange { VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(PushConstants) };
+    // Each pyramid level is reduced from the one above it, level 0 from the depth buffer
+    std::array<VkDescriptorSetLayoutBinding, 2> depthPyramidBindings = {};
+    depthPyramidBindings[0].binding = 0;
+    depthPyramidBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    depthPyramidBindings[0].descriptorCount = 1;
+    depthPyramidBindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    depthPyramidBindings[1].binding = 1;
+    depthPyramidBindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    depthPyramidBindings[1].descriptorCount = 1;
+    depthPyramidBindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    VkDescriptorSetLayoutCreateInfo depthPyramidSetLayoutCreateInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
+    depthPyramidSetLayoutCreateInfo.bindingCount = depthPyramidBindings.size();
+    depthPyramidSetLayoutCreateInfo.pBindings = depthPyramidBindings.data();
+    check_success(vkCreateDescriptorSetLayout(d.device, &depthPyramidSetLayoutCreateInfo, nullptr, &d.depthPyramidSetLayout));
+
+    constexpr VkPushConstantRange depthPyramidPushConstantRange = { VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(DepthPyramidPushConstants) };
+
+    VkPipelineLayoutCreateInfo depthPyramidPipelineLayoutCreateInfo = { VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
+    depthPyramidPipelineLayoutCreateInfo.setLayoutCount = 1;
+    depthPyramidPipelineLayoutCreateInfo.pSetLayouts = &d.depthPyramidSetLayout;
+    depthPyramidPipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+    depthPyramidPipelineLayoutCreateInfo.pPushConstantRanges = &depthPyramidPushConstantRange;
+    check_success(vkCreatePipelineLayout(d.device, &depthPyramidPipelineLayoutCreateInfo, nullptr, &d.depthPyramidPipelineLayout));
+
+    // Bloom levels are downsampled from the one above, then upsampled back up onto it, read through the sampler
+    std::array<VkDescriptorSetLayoutBinding, 2> bloomBindings = {};
+    bloomBindings[0].binding = 0;
+    bloomBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    bloomBindings[0].descriptorCount = 1;
+    bloomBindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    bloomBindings[1].binding = 1;
+    bloomBindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    bloomBindings[1].descriptorCount = 1;
+    bloomBindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    VkDescriptorSetLayoutCreateInfo bloomSetLayoutCreateInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
+    bloomSetLayoutCreateInfo.bindingCount = bloomBindings.size();
+    bloomSetLayoutCreateInfo.pBindings = bloomBindings.data();
+    check_success(vkCreateDescriptorSetLayout(d.device, &bloomSetLayoutCreateInfo, nullptr, &d.bloomSetLayout));
+
+    constexpr VkPushConstantRange bloomPushConstantRange = { VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(BloomPushConstants) };
+
+    VkPipelineLayoutCreateInfo bloomPipelineLayoutCreateInfo = { VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
+    bloomPipelineLayoutCreateInfo.setLayoutCount = 1;
+    bloomPipelineLayoutCreateInfo.pSetLayouts = &d.bloomSetLayout;
+    bloomPipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+    bloomPipelineLayoutCreateInfo.pPushConstantRanges = &bloomPushConstantRange;
+    check_success(vkCreatePipelineLayout(d.device, &bloomPipelineLayoutCreateInfo, nullptr, &d.bloomPipelineLayout));
+
+    // The lit scene, bloom level 0 and the color grading LUT
+    std::array<VkDescriptorSetLayoutBinding, 3> tonemapBindings = {};
+    for (uint32_t i = 0; i < tonemapBindings.size(); ++i)
+    {
+        tonemapBindings[i].binding = i;
+        tonemapBindings[i].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        tonemapBindings[i].descriptorCount = 1;
+        tonemapBindings[i].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    }
+
+    VkDescriptorSetLayoutCreateInfo tonemapSetLayoutCreateInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
+    tonemapSetLayoutCreateInfo.bindingCount = tonemapBindings.size();
+    tonemapSetLayoutCreateInfo.pBindings = tonemapBindings.data();
+    check_success(vkCreateDescriptorSetLayout(d.device, &tonemapSetLayoutCreateInfo, nullptr, &d.tonemapSetLayout));
+
+    constexpr VkPushConstantRange tonemapPushConstantRange = { VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(TonemapPushConstants) };
+
+    VkPipelineLayoutCreateInfo tonemapPipelineLayoutCreateInfo = { VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
+    tonemapPipelineLayoutCreateInfo.setLayoutCount = 1;
+    tonemapPipelineLayoutCreateInfo.pSetLayouts = &d.tonemapSetLayout;
+    tonemapPipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+    tonemapPipelineLayoutCreateInfo.pPushConstantRanges = &tonemapPushConstantRange;
+    check_success(vkCreatePipelineLayout(d.device, &tonemapPipelineLayoutCreateInfo, nullptr, &d.tonemapPipelineLayout));
+
+    VkSamplerCreateInfo pointSamplerCreateInfo = { VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+    pointSamplerCreateInfo.magFilter = VK_FILTER_NEAREST;
+    pointSamplerCreateInfo.minFilter = VK_FILTER_NEAREST;
+    pointSamplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    pointSamplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    pointSamplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    pointSamplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    pointSamplerCreateInfo.maxLod = VK_LOD_CLAMP_NONE;
+    check_success(vkCreateSampler(d.device, &pointSamplerCreateInfo, nullptr, &d.pointSampler));
+
+    VkSamplerCreateInfo linearSamplerCreateInfo = { VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+    linearSamplerCreateInfo.magFilter = VK_FILTER_LINEAR;
+    linearSamplerCreateInfo.minFilter = VK_FILTER_LINEAR;
+    linearSamplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    linearSamplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    linearSamplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    linearSamplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    check_success(vkCreateSampler(d.device, &linearSamplerCreateInfo, nullptr, &d.linearSampler));
+
+    constexpr std::array<VkPushConstantRange, 2> pushConstantRanges = {{
+        { VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(PushConstants) },
+        { VK_SHADER_STAGE_VERTEX_BIT, SHADOW_PUSH_CONSTANTS_OFFSET, sizeof(ShadowPushConstants) }
+    }};
 
     VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = { VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
     pipelineLayoutCreateInfo.setLayoutCount = 1;
     pipelineLayoutCreateInfo.pSetLayouts = &d.descriptorSetLayout;
-    pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
-    pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+    pipelineLayoutCreateInfo.pushConstantRangeCount = pushConstantRanges.size();
+    pipelineLayoutCreateInfo.pPushConstantRanges = pushConstantRanges.data();
     check_success(vkCreatePipelineLayout(d.device, &pipelineLayoutCreateInfo, nullptr, &d.pipelineLayout));
 
     constexpr VkSemaphoreCreateInfo semaphoreCreateInfo = { VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
     check_success(vkCreateSemaphore(d.device, &semaphoreCreateInfo, nullptr, &d.acquireCompleteSemaphore));
 
-    std::vector<uint32_t> fragmentShaderData = load_shader("main.frag");
-    VkShaderModuleCreateInfo fragmentShaderModuleCreateInfo = { VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO };
-    fragmentShaderModuleCreateInfo.codeSize = fragmentShaderData.size() * sizeof(uint32_t);
-    fragmentShaderModuleCreateInfo.pCode = fragmentShaderData.data();
-
-    check_success(vkCreateShaderModule(d.device, &fragmentShaderModuleCreateInfo, nullptr, &d.fragmentModule));
-
-    std::vector<uint32_t> vertexShaderData = load_shader("main.vert");
-    VkShaderModuleCreateInfo vertexShaderModuleCreateInfo = { VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO };
-    vertexShaderModuleCreateInfo.codeSize = vertexShaderData.size() * sizeof(uint32_t);
-    vertexShaderModuleCreateInfo.pCode = vertexShaderData.data();
-
-    check_success(vkCreateShaderModule(d.device, &vertexShaderModuleCreateInfo, nullptr, &d.vertexModule));
+    d.fragmentModule = create_shader_module(d.device, "main.frag");
+    d.vertexModule = create_shader_module(d.device, "main.vert");
+    d.cullModule = create_shader_module(d.device, "cull.comp");
+    d.depthPyramidModule = create_shader_module(d.device, "depthpyramid.comp");
+    d.clusterCullModule = create_shader_module(d.device, "clustercull.comp");
+    d.lightCullModule = create_shader_module(d.device, "lightcull.comp");
+    d.depthModule = create_shader_module(d.device, "depth.vert");
+    d.shadowModule = create_shader_module(d.device, "shadow.vert");
+    d.depthPyramidMsModule = create_shader_module(d.device, "depthpyramidms.comp");
+    d.bloomDownModule = create_shader_module(d.device, "bloomdown.comp");
+    d.bloomUpModule = create_shader_module(d.device, "bloomup.comp");
+    d.fullscreenModule = create_shader_module(d.device, "fullscreen.vert");
+    d.tonemapModule = create_shader_module(d.device, "tonemap.frag");
 
     const auto pipelineCacheData = load_file(PIPELINE_CACHE_FILENAME);
 
@@ -506,6 +1201,15 @@ void Renderer::create_common()
 
     check_success(vkCreatePipelineCache(d.device, &pipelineCacheCreateInfo, nullptr, &d.pipelineCache));
 
+    if (timestampsSupported)
+    {
+        VkQueryPoolCreateInfo queryPoolCreateInfo = { VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+        queryPoolCreateInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        queryPoolCreateInfo.queryCount = RENDERER_MAX_FRAMES_IN_FLIGHT * TIMESTAMPS_PER_FRAME;
+
+        check_success(vkCreateQueryPool(d.device, &queryPoolCreateInfo, nullptr, &d.timestampQueryPool));
+    }
+
     VkCommandBufferAllocateInfo commandBufferAllocateInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
     commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
     commandBufferAllocateInfo.commandPool = d.commandPool;
@@ -529,9 +1233,12 @@ void Renderer::create_common()
 
 void Renderer::create_descriptors()
 {
-    constexpr std::array<VkDescriptorPoolSize, 2> poolSizes = {{
+    constexpr std::array<VkDescriptorPoolSize, 5> poolSizes = {{
         {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1},
-        {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1}
+        {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1},
+        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3},
+        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 4},
+        {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2}
     }};
 
     VkDescriptorPoolCreateInfo descriptorPoolCreateInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
@@ -550,8 +1257,15 @@ void Renderer::create_descriptors()
 
     const VkDescriptorBufferInfo transformUniformBufferInfo = { d.transformUniformBuffer, 0, sizeof(TransformUniforms) };
     const VkDescriptorBufferInfo lightingUniformBufferInfo = { d.lightingUniformBuffer, 0, sizeof(LightingUniforms) };
-
-    std::array<VkWriteDescriptorSet, 2> descriptorWrites = {};
+    const VkDescriptorBufferInfo instanceInputBufferInfo = { d.instanceInputBuffer, 0, sizeof(InstanceInputs) };
+    const VkDescriptorBufferInfo culledInstanceBufferInfo = { d.culledInstanceBuffer, 0, MAX_INDIRECT_DRAWS * sizeof(InstanceStream) };
+    const VkDescriptorBufferInfo indirectBufferInfo = { d.indirectBuffer, 0, sizeof(MaterialDraws) };
+    const VkDescriptorBufferInfo meshletBufferInfo = { d.meshletBuffer, 0, VK_WHOLE_SIZE };
+    const VkDescriptorBufferInfo clusterDrawBufferInfo = { d.clusterDrawBuffer, 0, MAX_MATERIALS * clusterDrawListSize };
+    const VkDescriptorBufferInfo lightBufferInfo = { d.lightBuffer, 0, VK_WHOLE_SIZE };
+    const VkDescriptorBufferInfo lightGridBufferInfo = { d.lightGridBuffer, 0, VK_WHOLE_SIZE };
+
+    std::array<VkWriteDescriptorSet, 9> descriptorWrites = {};
     descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
     descriptorWrites[0].dstSet = d.descriptorSet;
     descriptorWrites[0].dstBinding = 0;
@@ -564,6 +1278,48 @@ void Renderer::create_descriptors()
     descriptorWrites[1].descriptorCount = 1;
     descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
     descriptorWrites[1].pBufferInfo = &lightingUniformBufferInfo;
+    descriptorWrites[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrites[2].dstSet = d.descriptorSet;
+    descriptorWrites[2].dstBinding = 2;
+    descriptorWrites[2].descriptorCount = 1;
+    descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+    descriptorWrites[2].pBufferInfo = &instanceInputBufferInfo;
+    descriptorWrites[3].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrites[3].dstSet = d.descriptorSet;
+    descriptorWrites[3].dstBinding = 3;
+    descriptorWrites[3].descriptorCount = 1;
+    descriptorWrites[3].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+    descriptorWrites[3].pBufferInfo = &culledInstanceBufferInfo;
+    descriptorWrites[4].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrites[4].dstSet = d.descriptorSet;
+    descriptorWrites[4].dstBinding = 4;
+    descriptorWrites[4].descriptorCount = 1;
+    descriptorWrites[4].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+    descriptorWrites[4].pBufferInfo = &indirectBufferInfo;
+    descriptorWrites[5].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrites[5].dstSet = d.descriptorSet;
+    descriptorWrites[5].dstBinding = 6;
+    descriptorWrites[5].descriptorCount = 1;
+    descriptorWrites[5].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    descriptorWrites[5].pBufferInfo = &meshletBufferInfo;
+    descriptorWrites[6].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrites[6].dstSet = d.descriptorSet;
+    descriptorWrites[6].dstBinding = 7;
+    descriptorWrites[6].descriptorCount = 1;
+    descriptorWrites[6].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+    descriptorWrites[6].pBufferInfo = &clusterDrawBufferInfo;
+    descriptorWrites[7].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrites[7].dstSet = d.descriptorSet;
+    descriptorWrites[7].dstBinding = 8;
+    descriptorWrites[7].descriptorCount = 1;
+    descriptorWrites[7].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    descriptorWrites[7].pBufferInfo = &lightBufferInfo;
+    descriptorWrites[8].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrites[8].dstSet = d.descriptorSet;
+    descriptorWrites[8].dstBinding = 9;
+    descriptorWrites[8].descriptorCount = 1;
+    descriptorWrites[8].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    descriptorWrites[8].pBufferInfo = &lightGridBufferInfo;
     vkUpdateDescriptorSets(d.device, descriptorWrites.size(), descriptorWrites.data(), 0, nullptr);
 }
 
@@ -571,24 +1327,147 @@ void Renderer::create_pipeline()
 {
     surfaceFormat = select_format(physicalDevice, d.surface);
 
-    std::array<VkAttachmentDescription, 2> attachmentDescriptions = {};
-    attachmentDescriptions[0].format = surfaceFormat.format;
-    attachmentDescriptions[0].samples = VK_SAMPLE_COUNT_1_BIT;
+    // Occlusion culling samples depth to build the depth pyramid
+    depthFormat = select_depth_format(physicalDevice, occlusionCulling
+        ? VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT
+        : VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT);
+
+    hdrFormat = select_hdr_format(physicalDevice);
+
+    // Shadows are copied from the static atlas and filtered by a comparison sampler where the format allows
+    shadowFormat = select_depth_format(physicalDevice, VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT |
+        VK_FORMAT_FEATURE_TRANSFER_SRC_BIT | VK_FORMAT_FEATURE_TRANSFER_DST_BIT);
+
+    VkFormatProperties shadowFormatProperties;
+    vkGetPhysicalDeviceFormatProperties(physicalDevice, shadowFormat, &shadowFormatProperties);
+    shadowFilter = (shadowFormatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT)
+        ? VK_FILTER_LINEAR : VK_FILTER_NEAREST;
+
+    create_render_pass();
+
+    // Shadow atlases keep their contents between frames, render_shadows clears the tiles it redraws and handles the
+    // layout transitions around each pass
+    VkAttachmentDescription shadowAttachmentDescription = {};
+    shadowAttachmentDescription.format = shadowFormat;
+    shadowAttachmentDescription.samples = VK_SAMPLE_COUNT_1_BIT;
+    shadowAttachmentDescription.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+    shadowAttachmentDescription.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    shadowAttachmentDescription.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    shadowAttachmentDescription.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    shadowAttachmentDescription.initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    shadowAttachmentDescription.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    VkAttachmentReference shadowAttachmentRef = {};
+    shadowAttachmentRef.attachment = 0;
+    shadowAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    VkSubpassDescription shadowSubpass = {};
+    shadowSubpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    shadowSubpass.pDepthStencilAttachment = &shadowAttachmentRef;
+
+    VkRenderPassCreateInfo shadowRenderPassCreateInfo = { VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO };
+    shadowRenderPassCreateInfo.attachmentCount = 1;
+    shadowRenderPassCreateInfo.pAttachments = &shadowAttachmentDescription;
+    shadowRenderPassCreateInfo.subpassCount = 1;
+    shadowRenderPassCreateInfo.pSubpasses = &shadowSubpass;
+
+    check_success(vkCreateRenderPass(d.device, &shadowRenderPassCreateInfo, nullptr, &d.shadowRenderPass));
+
+    // Tonemapping covers every pixel of the swapchain image, so its old contents are never loaded
+    VkAttachmentDescription postAttachmentDescription = {};
+    postAttachmentDescription.format = surfaceFormat.format;
+    postAttachmentDescription.samples = VK_SAMPLE_COUNT_1_BIT;
+    postAttachmentDescription.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    postAttachmentDescription.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    postAttachmentDescription.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    postAttachmentDescription.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    postAttachmentDescription.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    postAttachmentDescription.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+    VkAttachmentReference postAttachmentRef = {};
+    postAttachmentRef.attachment = 0;
+    postAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+    VkSubpassDescription postSubpass = {};
+    postSubpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    postSubpass.colorAttachmentCount = 1;
+    postSubpass.pColorAttachments = &postAttachmentRef;
+
+    std::array<VkSubpassDependency, 2> postDependencies = {};
+    postDependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+    postDependencies[0].dstSubpass = 0;
+    postDependencies[0].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT; // Waited on for the acquired image
+    postDependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    postDependencies[0].srcAccessMask = 0;
+    postDependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    postDependencies[0].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+    postDependencies[1].srcSubpass = 0;
+    postDependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+    postDependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    postDependencies[1].dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+    postDependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    postDependencies[1].dstAccessMask = 0;
+    postDependencies[1].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+
+    VkRenderPassCreateInfo postRenderPassCreateInfo = { VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO };
+    postRenderPassCreateInfo.attachmentCount = 1;
+    postRenderPassCreateInfo.pAttachments = &postAttachmentDescription;
+    postRenderPassCreateInfo.subpassCount = 1;
+    postRenderPassCreateInfo.pSubpasses = &postSubpass;
+    postRenderPassCreateInfo.dependencyCount = postDependencies.size();
+    postRenderPassCreateInfo.pDependencies = postDependencies.data();
+
+    check_success(vkCreateRenderPass(d.device, &postRenderPassCreateInfo, nullptr, &d.postRenderPass));
+
+    d.pipeline = create_graphics_pipeline(d.vertexModule, d.fragmentModule, GraphicsPass::Forward);
+    d.depthPrepassPipeline = create_graphics_pipeline(d.depthModule, VK_NULL_HANDLE, GraphicsPass::DepthPrepass);
+    d.prepassShadingPipeline = create_graphics_pipeline(d.vertexModule, d.fragmentModule, GraphicsPass::PrepassShading);
+    d.shadowPipeline = create_graphics_pipeline(d.shadowModule, VK_NULL_HANDLE, GraphicsPass::Shadow);
+    d.cullPipeline = create_cull_pipeline(d.cullModule);
+    d.depthPyramidPipeline = create_depth_pyramid_pipeline(d.depthPyramidModule);
+    d.depthPyramidMsPipeline = create_depth_pyramid_pipeline(d.depthPyramidMsModule);
+    d.clusterCullPipeline = create_cluster_cull_pipeline(d.clusterCullModule);
+    d.lightCullPipeline = create_light_cull_pipeline(d.lightCullModule);
+    d.bloomDownPipeline = create_bloom_pipeline(d.bloomDownModule);
+    d.bloomUpPipeline = create_bloom_pipeline(d.bloomUpModule);
+    d.tonemapPipeline = create_tonemap_pipeline(d.fullscreenModule, d.tonemapModule);
+}
+
+// The scene is lit into the HDR image for post processing to read. With MSAA it renders into a multisampled color
+// attachment that only lives during the subpass, resolved into the HDR image at its end.
+void Renderer::create_render_pass()
+{
+    const bool multisampled = VK_SAMPLE_COUNT_1_BIT != sampleCount;
+
+    // The frame graph transitions the attachments and synchronizes them with the passes around this one
+    std::array<VkAttachmentDescription, 3> attachmentDescriptions = {};
+    attachmentDescriptions[0].format = hdrFormat;
+    attachmentDescriptions[0].samples = sampleCount;
     attachmentDescriptions[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    attachmentDescriptions[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-    attachmentDescriptions[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    attachmentDescriptions[0].finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-    attachmentDescriptions[1].format = DEPTH_FORMAT;
-    attachmentDescriptions[1].samples = VK_SAMPLE_COUNT_1_BIT;
+    attachmentDescriptions[0].storeOp = multisampled ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE;
+    attachmentDescriptions[0].initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    attachmentDescriptions[0].finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    attachmentDescriptions[1].format = depthFormat;
+    attachmentDescriptions[1].samples = sampleCount;
     attachmentDescriptions[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    attachmentDescriptions[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    attachmentDescriptions[1].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    attachmentDescriptions[1].storeOp = occlusionCulling ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachmentDescriptions[1].initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
     attachmentDescriptions[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    attachmentDescriptions[2].format = hdrFormat;
+    attachmentDescriptions[2].samples = VK_SAMPLE_COUNT_1_BIT;
+    attachmentDescriptions[2].loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attachmentDescriptions[2].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    attachmentDescriptions[2].initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    attachmentDescriptions[2].finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
     std::array<VkAttachmentReference, 1> colorAttachmentRefs = {};
     colorAttachmentRefs[0].attachment = 0;
     colorAttachmentRefs[0].layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
+    std::array<VkAttachmentReference, 1> resolveAttachmentRefs = {};
+    resolveAttachmentRefs[0].attachment = 2;
+    resolveAttachmentRefs[0].layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
     VkAttachmentReference depthAttachmentRef = {};
     depthAttachmentRef.attachment = 1;
     depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
@@ -597,91 +1476,100 @@ void Renderer::create_pipeline()
     subpasses[0].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
     subpasses[0].colorAttachmentCount = colorAttachmentRefs.size();
     subpasses[0].pColorAttachments = colorAttachmentRefs.data();
+    subpasses[0].pResolveAttachments = multisampled ? resolveAttachmentRefs.data() : nullptr;
     subpasses[0].pDepthStencilAttachment = &depthAttachmentRef;
 
-    std::array<VkSubpassDependency, 4> subpassDependencies = {};
-    subpassDependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
-    subpassDependencies[0].dstSubpass = 0;
-    subpassDependencies[0].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    subpassDependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    subpassDependencies[0].srcAccessMask = 0;
-    subpassDependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-    subpassDependencies[0].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
-    subpassDependencies[1].srcSubpass = 0;
-    subpassDependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
-    subpassDependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    subpassDependencies[1].dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-    subpassDependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-    subpassDependencies[1].dstAccessMask = 0;
-    subpassDependencies[1].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
-    subpassDependencies[2].srcSubpass = VK_SUBPASS_EXTERNAL;
-    subpassDependencies[2].dstSubpass = 0;
-    subpassDependencies[2].srcStageMask = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-    subpassDependencies[2].dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
-    subpassDependencies[2].srcAccessMask = 0;
-    subpassDependencies[2].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-    subpassDependencies[2].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
-    subpassDependencies[3].srcSubpass = 0;
-    subpassDependencies[3].dstSubpass = VK_SUBPASS_EXTERNAL;
-    subpassDependencies[3].srcStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
-    subpassDependencies[3].dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-    subpassDependencies[3].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-    subpassDependencies[3].dstAccessMask = 0;
-    subpassDependencies[3].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
-
     VkRenderPassCreateInfo renderPassCreateInfo = { VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO };
-    renderPassCreateInfo.attachmentCount = attachmentDescriptions.size();
+    renderPassCreateInfo.attachmentCount = multisampled ? 3 : 2;
     renderPassCreateInfo.pAttachments = attachmentDescriptions.data();
     renderPassCreateInfo.subpassCount = subpasses.size();
     renderPassCreateInfo.pSubpasses = subpasses.data();
-    renderPassCreateInfo.dependencyCount = subpassDependencies.size();
-    renderPassCreateInfo.pDependencies = subpassDependencies.data();
 
     check_success(vkCreateRenderPass(d.device, &renderPassCreateInfo, nullptr, &d.renderPass));
+}
 
-    std::array<VkSpecializationMapEntry, 1> fragmentSpecMap = {};
-    fragmentSpecMap[0].constantID = 0;
-    fragmentSpecMap[0].offset = offsetof(SpecConstants, numLights);
-    fragmentSpecMap[0].size = sizeof(SpecConstants::numLights);
+// The create_*_pipeline functions only read state that is fixed after create_pipeline, so hot reloads call them from
+// a background thread
+// The depth prepass and shadows have no fragment shader and leave the fragment module unused
+VkPipeline Renderer::create_graphics_pipeline(VkShaderModule vertexModule, VkShaderModule fragmentModule, GraphicsPass pass) const
+{
+    const bool shadow = GraphicsPass::Shadow == pass;
+    const bool depthOnly = GraphicsPass::DepthPrepass == pass || shadow;
 
-    constexpr SpecConstants fragmentSpecData = { NUM_LIGHTS };
+    const auto lightGridSpecMap = light_grid_spec_map();
+    constexpr LightGridSpecConstants lightGridSpecData = { LIGHT_GRID_X, LIGHT_GRID_Y, LIGHT_GRID_Z, LIGHT_GRID_MAX_CLUSTER_LIGHTS };
 
     const VkSpecializationInfo fragmentSpecInfo = {
-        fragmentSpecMap.size(), fragmentSpecMap.data(),
-        sizeof(fragmentSpecData), &fragmentSpecData
+        lightGridSpecMap.size(), lightGridSpecMap.data(),
+        sizeof(lightGridSpecData), &lightGridSpecData
+    };
+
+    std::array<VkSpecializationMapEntry, 1> vertexSpecMap = {};
+    vertexSpecMap[0].constantID = 0;
+    vertexSpecMap[0].offset = offsetof(VertexSpecConstants, packedVertices);
+    vertexSpecMap[0].size = sizeof(VertexSpecConstants::packedVertices);
+
+    const VertexSpecConstants vertexSpecData = { packedVertices };
+
+    const VkSpecializationInfo vertexSpecInfo = {
+        vertexSpecMap.size(), vertexSpecMap.data(),
+        sizeof(vertexSpecData), &vertexSpecData
     };
 
     std::array<VkPipelineShaderStageCreateInfo, 2> shaderStages = {};
     shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
     shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
-    shaderStages[0].module = d.vertexModule;
+    shaderStages[0].module = vertexModule;
     shaderStages[0].pName = "main";
-    shaderStages[0].pSpecializationInfo = nullptr;
+    shaderStages[0].pSpecializationInfo = &vertexSpecInfo;
     shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
     shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-    shaderStages[1].module = d.fragmentModule;
+    shaderStages[1].module = fragmentModule;
     shaderStages[1].pName = "main";
     shaderStages[1].pSpecializationInfo = &fragmentSpecInfo;
 
-    std::array<VkVertexInputBindingDescription, 1> vertexBindings = {};
+    std::array<VkVertexInputBindingDescription, 2> vertexBindings = {};
     vertexBindings[0].binding = 0;
-    vertexBindings[0].stride = sizeof(PerVertex);
+    vertexBindings[0].stride = packedVertices ? sizeof(PackedVertex) : sizeof(PerVertex);
     vertexBindings[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+    vertexBindings[1].binding = 1;
+    vertexBindings[1].stride = sizeof(InstanceTransform);
+    vertexBindings[1].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
 
-    std::array<VkVertexInputAttributeDescription, 2> vertexAttributes = {};
+    // Depth only passes fetch the first five, positions and model view matrices. Shadows' instance streams hold model
+    // matrices in the same place.
+    constexpr uint32_t depthOnlyAttributeCount = 5;
+
+    std::array<VkVertexInputAttributeDescription, 9> vertexAttributes = {};
     vertexAttributes[0].location = 0;
     vertexAttributes[0].binding = 0;
-    vertexAttributes[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-    vertexAttributes[0].offset = offsetof(PerVertex, position);
-    vertexAttributes[1].location = 1;
-    vertexAttributes[1].binding = 0;
-    vertexAttributes[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-    vertexAttributes[1].offset = offsetof(PerVertex, normal);
+    vertexAttributes[0].format = packedVertices ? VK_FORMAT_R16G16B16A16_UNORM : VK_FORMAT_R32G32B32_SFLOAT;
+    vertexAttributes[0].offset = packedVertices ? offsetof(PackedVertex, position) : offsetof(PerVertex, position);
+    for (uint32_t i = 0; i < 4; ++i)
+    {
+        auto& attribute = vertexAttributes[1 + i];
+        attribute.location = 2 + i;
+        attribute.binding = 1;
+        attribute.format = VK_FORMAT_R32G32B32A32_SFLOAT;
+        attribute.offset = offsetof(InstanceTransform, modelViewMatrix) + i * sizeof(glm::vec4);
+    }
+    vertexAttributes[5].location = 1;
+    vertexAttributes[5].binding = 0;
+    vertexAttributes[5].format = packedVertices ? VK_FORMAT_R16G16_SNORM : VK_FORMAT_R32G32B32_SFLOAT;
+    vertexAttributes[5].offset = packedVertices ? offsetof(PackedVertex, normal) : offsetof(PerVertex, normal);
+    for (uint32_t i = 0; i < 3; ++i)
+    {
+        auto& attribute = vertexAttributes[6 + i];
+        attribute.location = 6 + i;
+        attribute.binding = 1;
+        attribute.format = VK_FORMAT_R32G32B32A32_SFLOAT;
+        attribute.offset = offsetof(InstanceTransform, normalMatrix) + i * sizeof(glm::vec4);
+    }
 
     VkPipelineVertexInputStateCreateInfo vertexInputState = { VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO };
     vertexInputState.vertexBindingDescriptionCount = vertexBindings.size();
     vertexInputState.pVertexBindingDescriptions = vertexBindings.data();
-    vertexInputState.vertexAttributeDescriptionCount = vertexAttributes.size();
+    vertexInputState.vertexAttributeDescriptionCount = depthOnly ? depthOnlyAttributeCount : vertexAttributes.size();
     vertexInputState.pVertexAttributeDescriptions = vertexAttributes.data();
 
     VkPipelineInputAssemblyStateCreateInfo inputAssemblyState = { VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO };
@@ -692,25 +1580,29 @@ void Renderer::create_pipeline()
     viewportState.scissorCount = 1;
 
     VkPipelineRasterizationStateCreateInfo rasterizationState = { VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO };
-    rasterizationState.cullMode = VK_CULL_MODE_BACK_BIT;
+    rasterizationState.cullMode = shadow ? VK_CULL_MODE_NONE : VK_CULL_MODE_BACK_BIT; // Either side of a caster blocks light
     rasterizationState.frontFace = VK_FRONT_FACE_CLOCKWISE;
+    rasterizationState.depthBiasEnable = shadow ? VK_TRUE : VK_FALSE;
+    rasterizationState.depthBiasConstantFactor = SHADOW_DEPTH_BIAS_CONSTANT;
+    rasterizationState.depthBiasSlopeFactor = SHADOW_DEPTH_BIAS_SLOPE;
     rasterizationState.lineWidth = 1.0f;
 
     VkPipelineMultisampleStateCreateInfo multisampleState = { VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO };
-    multisampleState.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+    multisampleState.rasterizationSamples = shadow ? VK_SAMPLE_COUNT_1_BIT : sampleCount;
 
     VkPipelineDepthStencilStateCreateInfo depthStencilState = { VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO };
     depthStencilState.depthTestEnable = VK_TRUE;
-    depthStencilState.depthWriteEnable = VK_TRUE;
-    depthStencilState.depthCompareOp = VK_COMPARE_OP_LESS;
+    depthStencilState.depthWriteEnable = GraphicsPass::PrepassShading == pass ? VK_FALSE : VK_TRUE;
+    depthStencilState.depthCompareOp = GraphicsPass::PrepassShading == pass ? VK_COMPARE_OP_EQUAL : VK_COMPARE_OP_GREATER;
     depthStencilState.minDepthBounds = 0.0f;
     depthStencilState.maxDepthBounds = 1.0f;
 
     std::array<VkPipelineColorBlendAttachmentState, 1> colorAttachmentStates = {};
-    colorAttachmentStates[0].colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+    colorAttachmentStates[0].colorWriteMask = depthOnly ? 0
+        : VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
 
     VkPipelineColorBlendStateCreateInfo colorBlendState = { VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO };
-    colorBlendState.attachmentCount = colorAttachmentStates.size();
+    colorBlendState.attachmentCount = shadow ? 0 : colorAttachmentStates.size();
     colorBlendState.pAttachments = colorAttachmentStates.data();
 
     constexpr std::array dynamicStates = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
@@ -720,7 +1612,7 @@ void Renderer::create_pipeline()
     dynamicState.pDynamicStates = dynamicStates.data();
 
     VkGraphicsPipelineCreateInfo pipelineCreateInfo = { VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO };
-    pipelineCreateInfo.stageCount = shaderStages.size();
+    pipelineCreateInfo.stageCount = depthOnly ? 1 : shaderStages.size();
     pipelineCreateInfo.pStages = shaderStages.data();
     pipelineCreateInfo.pVertexInputState = &vertexInputState;
     pipelineCreateInfo.pInputAssemblyState = &inputAssemblyState;
@@ -731,16 +1623,360 @@ void Renderer::create_pipeline()
     pipelineCreateInfo.pColorBlendState = &colorBlendState;
     pipelineCreateInfo.pDynamicState = &dynamicState;
     pipelineCreateInfo.layout = d.pipelineLayout;
-    pipelineCreateInfo.renderPass = d.renderPass;
+    pipelineCreateInfo.renderPass = shadow ? d.shadowRenderPass : d.renderPass;
     pipelineCreateInfo.subpass = 0;
 
-    check_success(vkCreateGraphicsPipelines(d.device, d.pipelineCache, 1, &pipelineCreateInfo, nullptr, &d.pipeline));
+    VkPipeline pipeline;
+    check_success(vkCreateGraphicsPipelines(d.device, d.pipelineCache, 1, &pipelineCreateInfo, nullptr, &pipeline));
+    return pipeline;
 }
 
-void Renderer::create_swapchain()
+VkPipeline Renderer::create_cull_pipeline(VkShaderModule cullModule) const
 {
-    VkSurfaceCapabilitiesKHR surfaceCaps;
-    check_success(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevice, d.surface, &surfaceCaps));
+    std::array<VkSpecializationMapEntry, 1> cullSpecMap = {};
+    cullSpecMap[0].constantID = 0;
+    cullSpecMap[0].offset = offsetof(CullSpecConstants, maxInstances);
+    cullSpecMap[0].size = sizeof(CullSpecConstants::maxInstances);
+
+    constexpr CullSpecConstants cullSpecData = { MAX_ENTITIES };
+
+    const VkSpecializationInfo cullSpecInfo = {
+        cullSpecMap.size(), cullSpecMap.data(),
+        sizeof(cullSpecData), &cullSpecData
+    };
+
+    VkComputePipelineCreateInfo cullPipelineCreateInfo = { VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
+    cullPipelineCreateInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    cullPipelineCreateInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    cullPipelineCreateInfo.stage.module = cullModule;
+    cullPipelineCreateInfo.stage.pName = "main";
+    cullPipelineCreateInfo.stage.pSpecializationInfo = &cullSpecInfo;
+    cullPipelineCreateInfo.layout = d.pipelineLayout;
+
+    VkPipeline cullPipeline;
+    check_success(vkCreateComputePipelines(d.device, d.pipelineCache, 1, &cullPipelineCreateInfo, nullptr, &cullPipeline));
+    return cullPipeline;
+}
+
+VkPipeline Renderer::create_depth_pyramid_pipeline(VkShaderModule depthPyramidModule) const
+{
+    VkComputePipelineCreateInfo depthPyramidPipelineCreateInfo = { VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
+    depthPyramidPipelineCreateInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    depthPyramidPipelineCreateInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    depthPyramidPipelineCreateInfo.stage.module = depthPyramidModule;
+    depthPyramidPipelineCreateInfo.stage.pName = "main";
+    depthPyramidPipelineCreateInfo.layout = d.depthPyramidPipelineLayout;
+
+    VkPipeline depthPyramidPipeline;
+    check_success(vkCreateComputePipelines(d.device, d.pipelineCache, 1, &depthPyramidPipelineCreateInfo, nullptr, &depthPyramidPipeline));
+    return depthPyramidPipeline;
+}
+
+VkPipeline Renderer::create_cluster_cull_pipeline(VkShaderModule clusterCullModule) const
+{
+    std::array<VkSpecializationMapEntry, 1> clusterCullSpecMap = {};
+    clusterCullSpecMap[0].constantID = 0;
+    clusterCullSpecMap[0].offset = offsetof(ClusterCullSpecConstants, maxClusterDraws);
+    clusterCullSpecMap[0].size = sizeof(ClusterCullSpecConstants::maxClusterDraws);
+
+    const ClusterCullSpecConstants clusterCullSpecData = { maxClusterDraws };
+
+    const VkSpecializationInfo clusterCullSpecInfo = {
+        clusterCullSpecMap.size(), clusterCullSpecMap.data(),
+        sizeof(clusterCullSpecData), &clusterCullSpecData
+    };
+
+    VkComputePipelineCreateInfo clusterCullPipelineCreateInfo = { VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
+    clusterCullPipelineCreateInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    clusterCullPipelineCreateInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    clusterCullPipelineCreateInfo.stage.module = clusterCullModule;
+    clusterCullPipelineCreateInfo.stage.pName = "main";
+    clusterCullPipelineCreateInfo.stage.pSpecializationInfo = &clusterCullSpecInfo;
+    clusterCullPipelineCreateInfo.layout = d.pipelineLayout;
+
+    VkPipeline clusterCullPipeline;
+    check_success(vkCreateComputePipelines(d.device, d.pipelineCache, 1, &clusterCullPipelineCreateInfo, nullptr, &clusterCullPipeline));
+    return clusterCullPipeline;
+}
+
+VkPipeline Renderer::create_light_cull_pipeline(VkShaderModule lightCullModule) const
+{
+    const auto lightGridSpecMap = light_grid_spec_map();
+    constexpr LightGridSpecConstants lightGridSpecData = { LIGHT_GRID_X, LIGHT_GRID_Y, LIGHT_GRID_Z, LIGHT_GRID_MAX_CLUSTER_LIGHTS };
+
+    const VkSpecializationInfo lightCullSpecInfo = {
+        lightGridSpecMap.size(), lightGridSpecMap.data(),
+        sizeof(lightGridSpecData), &lightGridSpecData
+    };
+
+    VkComputePipelineCreateInfo lightCullPipelineCreateInfo = { VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
+    lightCullPipelineCreateInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    lightCullPipelineCreateInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    lightCullPipelineCreateInfo.stage.module = lightCullModule;
+    lightCullPipelineCreateInfo.stage.pName = "main";
+    lightCullPipelineCreateInfo.stage.pSpecializationInfo = &lightCullSpecInfo;
+    lightCullPipelineCreateInfo.layout = d.pipelineLayout;
+
+    VkPipeline lightCullPipeline;
+    check_success(vkCreateComputePipelines(d.device, d.pipelineCache, 1, &lightCullPipelineCreateInfo, nullptr, &lightCullPipeline));
+    return lightCullPipeline;
+}
+
+// Both halves of bloom, bloomdown.comp and bloomup.comp, share a layout
+VkPipeline Renderer::create_bloom_pipeline(VkShaderModule bloomModule) const
+{
+    VkComputePipelineCreateInfo bloomPipelineCreateInfo = { VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
+    bloomPipelineCreateInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    bloomPipelineCreateInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    bloomPipelineCreateInfo.stage.module = bloomModule;
+    bloomPipelineCreateInfo.stage.pName = "main";
+    bloomPipelineCreateInfo.layout = d.bloomPipelineLayout;
+
+    VkPipeline bloomPipeline;
+    check_success(vkCreateComputePipelines(d.device, d.pipelineCache, 1, &bloomPipelineCreateInfo, nullptr, &bloomPipeline));
+    return bloomPipeline;
+}
+
+// One fullscreen triangle adding bloom to the scene, tonemapping and grading it straight into the swapchain image
+VkPipeline Renderer::create_tonemap_pipeline(VkShaderModule vertexModule, VkShaderModule fragmentModule) const
+{
+    std::array<VkPipelineShaderStageCreateInfo, 2> shaderStages = {};
+    shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+    shaderStages[0].module = vertexModule;
+    shaderStages[0].pName = "main";
+    shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+    shaderStages[1].module = fragmentModule;
+    shaderStages[1].pName = "main";
+
+    VkPipelineVertexInputStateCreateInfo vertexInputState = { VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO };
+
+    VkPipelineInputAssemblyStateCreateInfo inputAssemblyState = { VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO };
+    inputAssemblyState.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+    VkPipelineViewportStateCreateInfo viewportState = { VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO };
+    viewportState.viewportCount = 1;
+    viewportState.scissorCount = 1;
+
+    VkPipelineRasterizationStateCreateInfo rasterizationState = { VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO };
+    rasterizationState.cullMode = VK_CULL_MODE_NONE;
+    rasterizationState.frontFace = VK_FRONT_FACE_CLOCKWISE;
+    rasterizationState.lineWidth = 1.0f;
+
+    VkPipelineMultisampleStateCreateInfo multisampleState = { VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO };
+    multisampleState.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+    std::array<VkPipelineColorBlendAttachmentState, 1> colorAttachmentStates = {};
+    colorAttachmentStates[0].colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+
+    VkPipelineColorBlendStateCreateInfo colorBlendState = { VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO };
+    colorBlendState.attachmentCount = colorAttachmentStates.size();
+    colorBlendState.pAttachments = colorAttachmentStates.data();
+
+    constexpr std::array dynamicStates = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+
+    VkPipelineDynamicStateCreateInfo dynamicState = { VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO };
+    dynamicState.dynamicStateCount = dynamicStates.size();
+    dynamicState.pDynamicStates = dynamicStates.data();
+
+    VkGraphicsPipelineCreateInfo pipelineCreateInfo = { VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO };
+    pipelineCreateInfo.stageCount = shaderStages.size();
+    pipelineCreateInfo.pStages = shaderStages.data();
+    pipelineCreateInfo.pVertexInputState = &vertexInputState;
+    pipelineCreateInfo.pInputAssemblyState = &inputAssemblyState;
+    pipelineCreateInfo.pViewportState = &viewportState;
+    pipelineCreateInfo.pRasterizationState = &rasterizationState;
+    pipelineCreateInfo.pMultisampleState = &multisampleState;
+    pipelineCreateInfo.pColorBlendState = &colorBlendState;
+    pipelineCreateInfo.pDynamicState = &dynamicState;
+    pipelineCreateInfo.layout = d.tonemapPipelineLayout;
+    pipelineCreateInfo.renderPass = d.postRenderPass;
+    pipelineCreateInfo.subpass = 0;
+
+    VkPipeline pipeline;
+    check_success(vkCreateGraphicsPipelines(d.device, d.pipelineCache, 1, &pipelineCreateInfo, nullptr, &pipeline));
+    return pipeline;
+}
+
+void Renderer::create_shadow_atlases()
+{
+    std::array<VkImage *, 2> images = { &d.staticShadowImage, &d.shadowImage };
+    std::array<VmaAllocation *, 2> memories = { &d.staticShadowMemory, &d.shadowMemory };
+    std::array<VkImageView *, 2> views = { &d.staticShadowView, &d.shadowView };
+    std::array<VkFramebuffer *, 2> framebuffers = { &d.staticShadowFramebuffer, &d.shadowFramebuffer };
+
+    // The static atlas is only ever copied from, the sampled one is restored from it before dynamic casters are drawn
+    constexpr std::array<VkImageUsageFlags, 2> usages = {
+        VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+        VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT
+    };
+
+    for (uint32_t i = 0; i < images.size(); ++i)
+    {
+        VkImageCreateInfo shadowImageCreateInfo = { VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
+        shadowImageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+        shadowImageCreateInfo.format = shadowFormat;
+        shadowImageCreateInfo.extent = { SHADOW_ATLAS_EXTENT.width, SHADOW_ATLAS_EXTENT.height, 1 };
+        shadowImageCreateInfo.mipLevels = 1;
+        shadowImageCreateInfo.arrayLayers = 1;
+        shadowImageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        shadowImageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        shadowImageCreateInfo.usage = usages[i];
+        shadowImageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+        VmaAllocationCreateInfo shadowAllocationCreateInfo = {};
+        shadowAllocationCreateInfo.flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
+        shadowAllocationCreateInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+        check_success(vmaCreateImage(d.allocator, &shadowImageCreateInfo, &shadowAllocationCreateInfo, images[i], memories[i], nullptr));
+
+        VkImageViewCreateInfo shadowViewCreateInfo = { VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
+        shadowViewCreateInfo.image = *images[i];
+        shadowViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        shadowViewCreateInfo.format = shadowFormat;
+        shadowViewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+        shadowViewCreateInfo.subresourceRange.baseMipLevel = 0;
+        shadowViewCreateInfo.subresourceRange.levelCount = 1;
+        shadowViewCreateInfo.subresourceRange.baseArrayLayer = 0;
+        shadowViewCreateInfo.subresourceRange.layerCount = 1;
+
+        check_success(vkCreateImageView(d.device, &shadowViewCreateInfo, nullptr, views[i]));
+
+        VkFramebufferCreateInfo framebufferCreateInfo = { VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO };
+        framebufferCreateInfo.renderPass = d.shadowRenderPass;
+        framebufferCreateInfo.attachmentCount = 1;
+        framebufferCreateInfo.pAttachments = views[i];
+        framebufferCreateInfo.width = SHADOW_ATLAS_EXTENT.width;
+        framebufferCreateInfo.height = SHADOW_ATLAS_EXTENT.height;
+        framebufferCreateInfo.layers = 1;
+
+        check_success(vkCreateFramebuffer(d.device, &framebufferCreateInfo, nullptr, framebuffers[i]));
+    }
+
+    // Passes where the fragment's depth from the light is at least the nearest caster's, as depth is reversed
+    VkSamplerCreateInfo shadowSamplerCreateInfo = { VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+    shadowSamplerCreateInfo.magFilter = shadowFilter;
+    shadowSamplerCreateInfo.minFilter = shadowFilter;
+    shadowSamplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    shadowSamplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    shadowSamplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    shadowSamplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    shadowSamplerCreateInfo.compareEnable = VK_TRUE;
+    shadowSamplerCreateInfo.compareOp = VK_COMPARE_OP_GREATER_OR_EQUAL;
+    check_success(vkCreateSampler(d.device, &shadowSamplerCreateInfo, nullptr, &d.shadowSampler));
+
+    const VkDescriptorImageInfo shadowImageInfo = { d.shadowSampler, d.shadowView, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL };
+
+    VkWriteDescriptorSet descriptorWrite = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+    descriptorWrite.dstSet = d.descriptorSet;
+    descriptorWrite.dstBinding = 10;
+    descriptorWrite.descriptorCount = 1;
+    descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    descriptorWrite.pImageInfo = &shadowImageInfo;
+    vkUpdateDescriptorSets(d.device, 1, &descriptorWrite, 0, nullptr);
+}
+
+// Bakes the grade into a LUT indexed by tonemapped color, uploaded before the first frame while the staging buffer is
+// still unused
+void Renderer::create_color_grading()
+{
+    VkImageCreateInfo colorGradingCreateInfo = { VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
+    colorGradingCreateInfo.imageType = VK_IMAGE_TYPE_3D;
+    colorGradingCreateInfo.format = COLOR_GRADING_FORMAT;
+    colorGradingCreateInfo.extent = { COLOR_GRADING_LUT_SIZE, COLOR_GRADING_LUT_SIZE, COLOR_GRADING_LUT_SIZE };
+    colorGradingCreateInfo.mipLevels = 1;
+    colorGradingCreateInfo.arrayLayers = 1;
+    colorGradingCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    colorGradingCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    colorGradingCreateInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    colorGradingCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    VmaAllocationCreateInfo colorGradingAllocationCreateInfo = {};
+    colorGradingAllocationCreateInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+    check_success(vmaCreateImage(d.allocator, &colorGradingCreateInfo, &colorGradingAllocationCreateInfo, &d.colorGradingImage, &d.colorGradingMemory, nullptr));
+
+    VkImageViewCreateInfo colorGradingViewCreateInfo = { VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
+    colorGradingViewCreateInfo.image = d.colorGradingImage;
+    colorGradingViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_3D;
+    colorGradingViewCreateInfo.format = COLOR_GRADING_FORMAT;
+    colorGradingViewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    colorGradingViewCreateInfo.subresourceRange.baseMipLevel = 0;
+    colorGradingViewCreateInfo.subresourceRange.levelCount = 1;
+    colorGradingViewCreateInfo.subresourceRange.baseArrayLayer = 0;
+    colorGradingViewCreateInfo.subresourceRange.layerCount = 1;
+
+    check_success(vkCreateImageView(d.device, &colorGradingViewCreateInfo, nullptr, &d.colorGradingView));
+
+    constexpr glm::vec3 luminanceWeights = { 0.2126f, 0.7152f, 0.0722f };
+    constexpr float maxChannel = (1 << 10) - 1;
+
+    void *pData;
+    check_success(vmaMapMemory(d.allocator, d.stagingMemory, &pData));
+    auto *texels = reinterpret_cast<uint32_t *>(pData);
+    for (uint32_t b = 0; b < COLOR_GRADING_LUT_SIZE; ++b)
+    {
+        for (uint32_t g = 0; g < COLOR_GRADING_LUT_SIZE; ++g)
+        {
+            for (uint32_t r = 0; r < COLOR_GRADING_LUT_SIZE; ++r)
+            {
+                const auto color = glm::vec3(r, g, b) / static_cast<float>(COLOR_GRADING_LUT_SIZE - 1);
+                const auto luminance = glm::dot(color, luminanceWeights);
+                const auto graded = glm::clamp(glm::mix(glm::vec3(luminance), color, COLOR_GRADING_SATURATION) * COLOR_GRADING_TINT, 0.0f, 1.0f);
+                const auto channels = glm::uvec3(glm::round(graded * maxChannel));
+
+                *texels++ = (3u << 30) | (channels.b << 20) | (channels.g << 10) | channels.r;
+            }
+        }
+    }
+    vmaUnmapMemory(d.allocator, d.stagingMemory);
+
+    VkImageMemoryBarrier transferBarrier = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+    transferBarrier.srcAccessMask = 0;
+    transferBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    transferBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    transferBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    transferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    transferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    transferBarrier.image = d.colorGradingImage;
+    transferBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+
+    VkImageMemoryBarrier sampleBarrier = transferBarrier;
+    sampleBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    sampleBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    sampleBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    sampleBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+    VkBufferImageCopy region = {};
+    region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+    region.imageExtent = colorGradingCreateInfo.extent;
+
+    VkCommandBufferBeginInfo commandBufferBeginInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+    commandBufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    check_success(vkBeginCommandBuffer(d.uploadCommandBuffer, &commandBufferBeginInfo));
+        vkCmdPipelineBarrier(d.uploadCommandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+            0, nullptr, 0, nullptr, 1, &transferBarrier);
+        vkCmdCopyBufferToImage(d.uploadCommandBuffer, d.stagingBuffer, d.colorGradingImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+        vkCmdPipelineBarrier(d.uploadCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+            0, nullptr, 0, nullptr, 1, &sampleBarrier);
+    check_success(vkEndCommandBuffer(d.uploadCommandBuffer));
+
+    VkSubmitInfo submitInfo = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &d.uploadCommandBuffer;
+    check_success(vkQueueSubmit(queue, 1, &submitInfo, d.uploadFence));
+
+    // Leaves the fence unsignalled, as stream_meshes expects when no mesh upload is pending
+    check_success(vkWaitForFences(d.device, 1, &d.uploadFence, VK_TRUE, UINT64_MAX));
+    check_success(vkResetFences(d.device, 1, &d.uploadFence));
+}
+
+void Renderer::create_swapchain()
+{
+    VkSurfaceCapabilitiesKHR surfaceCaps;
+    check_success(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevice, d.surface, &surfaceCaps));
 
     auto minImageCount = std::max(surfaceCaps.minImageCount + 1, DEFAULT_IMAGE_COUNT);
     if (surfaceCaps.maxImageCount)
@@ -792,25 +2028,85 @@ void Renderer::create_swapchain()
 
     VkImageCreateInfo depthImageCreateInfo = { VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
     depthImageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
-    depthImageCreateInfo.format = DEPTH_FORMAT;
+    depthImageCreateInfo.format = depthFormat;
     depthImageCreateInfo.extent = { surfaceExtent.width, surfaceExtent.height, 1 };
     depthImageCreateInfo.mipLevels = 1;
     depthImageCreateInfo.arrayLayers = 1;
-    depthImageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    depthImageCreateInfo.samples = sampleCount;
     depthImageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
-    depthImageCreateInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+    depthImageCreateInfo.usage = occlusionCulling
+        ? VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT
+        : VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
     depthImageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 
-    VmaAllocationCreateInfo depthAllocationCreateInfo = {};
-    depthAllocationCreateInfo.flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
-    depthAllocationCreateInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY; // TODO: Lazy allocate if available
+    // Sampled depth is allocated by the frame graph, otherwise it can be lazily allocated
+    if (occlusionCulling)
+    {
+        check_success(vkCreateImage(d.device, &depthImageCreateInfo, nullptr, &d.depthImage));
+    }
+    else
+    {
+        create_attachment_image(d.allocator, depthImageCreateInfo, &d.depthImage, &d.depthMemory);
+    }
+
+    VkImageCreateInfo hdrImageCreateInfo = { VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
+    hdrImageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+    hdrImageCreateInfo.format = hdrFormat;
+    hdrImageCreateInfo.extent = { surfaceExtent.width, surfaceExtent.height, 1 };
+    hdrImageCreateInfo.mipLevels = 1;
+    hdrImageCreateInfo.arrayLayers = 1;
+    hdrImageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    hdrImageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    hdrImageCreateInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    hdrImageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    check_success(vkCreateImage(d.device, &hdrImageCreateInfo, nullptr, &d.hdrImage));
+
+    const bool multisampled = VK_SAMPLE_COUNT_1_BIT != sampleCount;
+    if (multisampled)
+    {
+        VkImageCreateInfo colorImageCreateInfo = { VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
+        colorImageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+        colorImageCreateInfo.format = hdrFormat;
+        colorImageCreateInfo.extent = { surfaceExtent.width, surfaceExtent.height, 1 };
+        colorImageCreateInfo.mipLevels = 1;
+        colorImageCreateInfo.arrayLayers = 1;
+        colorImageCreateInfo.samples = sampleCount;
+        colorImageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        colorImageCreateInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+        colorImageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+        create_attachment_image(d.allocator, colorImageCreateInfo, &d.colorImage, &d.colorMemory);
+    }
+
+    // Level 0 is half the surface size, levels stop halving before the smaller side drops below BLOOM_MIN_SIZE
+    bloomExtent = { std::max((surfaceExtent.width + 1) / 2, 1u), std::max((surfaceExtent.height + 1) / 2, 1u) };
+    bloomLevels = 1;
+    while (bloomLevels < RENDERER_MAX_BLOOM_LEVELS && std::min(bloomExtent.width, bloomExtent.height) >> bloomLevels >= BLOOM_MIN_SIZE)
+    {
+        ++bloomLevels;
+    }
+
+    VkImageCreateInfo bloomCreateInfo = { VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
+    bloomCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+    bloomCreateInfo.format = BLOOM_FORMAT;
+    bloomCreateInfo.extent = { bloomExtent.width, bloomExtent.height, 1 };
+    bloomCreateInfo.mipLevels = bloomLevels;
+    bloomCreateInfo.arrayLayers = 1;
+    bloomCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    bloomCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    bloomCreateInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
+    bloomCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    check_success(vkCreateImage(d.device, &bloomCreateInfo, nullptr, &d.bloomImage));
 
-    check_success(vmaCreateImage(d.allocator, &depthImageCreateInfo, &depthAllocationCreateInfo, &d.depthImage, &d.depthMemory, nullptr));
+    // Binds the images allocated by the frame graph, which have to be before their views are created
+    build_frame_graph();
 
     VkImageViewCreateInfo depthImageViewCreateInfo = { VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
     depthImageViewCreateInfo.image = d.depthImage;
     depthImageViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-    depthImageViewCreateInfo.format = DEPTH_FORMAT;
+    depthImageViewCreateInfo.format = depthFormat;
     depthImageViewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
     depthImageViewCreateInfo.subresourceRange.baseMipLevel = 0;
     depthImageViewCreateInfo.subresourceRange.levelCount = 1;
@@ -819,6 +2115,51 @@ void Renderer::create_swapchain()
 
     check_success(vkCreateImageView(d.device, &depthImageViewCreateInfo, nullptr, &d.depthView));
 
+    VkImageViewCreateInfo hdrImageViewCreateInfo = { VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
+    hdrImageViewCreateInfo.image = d.hdrImage;
+    hdrImageViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    hdrImageViewCreateInfo.format = hdrFormat;
+    hdrImageViewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    hdrImageViewCreateInfo.subresourceRange.baseMipLevel = 0;
+    hdrImageViewCreateInfo.subresourceRange.levelCount = 1;
+    hdrImageViewCreateInfo.subresourceRange.baseArrayLayer = 0;
+    hdrImageViewCreateInfo.subresourceRange.layerCount = 1;
+
+    check_success(vkCreateImageView(d.device, &hdrImageViewCreateInfo, nullptr, &d.hdrView));
+
+    if (multisampled)
+    {
+        VkImageViewCreateInfo colorImageViewCreateInfo = { VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
+        colorImageViewCreateInfo.image = d.colorImage;
+        colorImageViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        colorImageViewCreateInfo.format = hdrFormat;
+        colorImageViewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        colorImageViewCreateInfo.subresourceRange.baseMipLevel = 0;
+        colorImageViewCreateInfo.subresourceRange.levelCount = 1;
+        colorImageViewCreateInfo.subresourceRange.baseArrayLayer = 0;
+        colorImageViewCreateInfo.subresourceRange.layerCount = 1;
+
+        check_success(vkCreateImageView(d.device, &colorImageViewCreateInfo, nullptr, &d.colorView));
+    }
+
+    // Matches create_render_pass, the HDR image is the resolve target when multisampled
+    const std::array<VkImageView, 3> sceneAttachments = multisampled
+        ? std::array<VkImageView, 3>{ d.colorView, d.depthView, d.hdrView }
+        : std::array<VkImageView, 3>{ d.hdrView, d.depthView, VK_NULL_HANDLE };
+
+    VkFramebufferCreateInfo sceneFramebufferCreateInfo = { VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO };
+    sceneFramebufferCreateInfo.renderPass = d.renderPass;
+    sceneFramebufferCreateInfo.attachmentCount = multisampled ? 3 : 2;
+    sceneFramebufferCreateInfo.pAttachments = sceneAttachments.data();
+    sceneFramebufferCreateInfo.width = surfaceExtent.width;
+    sceneFramebufferCreateInfo.height = surfaceExtent.height;
+    sceneFramebufferCreateInfo.layers = 1;
+
+    check_success(vkCreateFramebuffer(d.device, &sceneFramebufferCreateInfo, nullptr, &d.sceneFramebuffer));
+
+    create_depth_pyramid();
+    create_bloom();
+
     d.perImageData.resize(numSwapchainImages);
     for (size_t i = 0; i < numSwapchainImages; ++i)
     {
@@ -841,12 +2182,10 @@ void Renderer::create_swapchain()
 
         check_success(vkCreateImageView(d.device, &imageViewCreateInfo, nullptr, &imageData.imageView));
 
-        std::array<VkImageView, 2> framebufferAttachments = { imageData.imageView, d.depthView };
-
         VkFramebufferCreateInfo framebufferCreateInfo = { VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO };
-        framebufferCreateInfo.renderPass = d.renderPass;
-        framebufferCreateInfo.attachmentCount = framebufferAttachments.size();
-        framebufferCreateInfo.pAttachments = framebufferAttachments.data();
+        framebufferCreateInfo.renderPass = d.postRenderPass;
+        framebufferCreateInfo.attachmentCount = 1;
+        framebufferCreateInfo.pAttachments = &imageData.imageView;
         framebufferCreateInfo.width = surfaceExtent.width;
         framebufferCreateInfo.height = surfaceExtent.height;
         framebufferCreateInfo.layers = 1;
@@ -855,97 +2194,1730 @@ void Renderer::create_swapchain()
     }
 }
 
-void Renderer::finish_data_upload()
+// Everything from the scene's render pass on, the culling and shadows in front of it synchronize by hand. Without
+// occlusion culling depth is discarded within the render pass, otherwise it is aliased with bloom, which is only
+// written once the depth pyramid has been reduced from it.
+void Renderer::build_frame_graph()
 {
-    check_success(vkWaitForFences(d.device, 1, &d.uploadFence, VK_TRUE, UINT64_MAX));
-}
+    _frameGraph = RenderGraph();
 
-void Renderer::recreate_swapchain()
-{
-    std::array<VkFence, RENDERER_MAX_FRAMES_IN_FLIGHT> fences;
-    for (uint32_t i = 0; i < RENDERER_MAX_FRAMES_IN_FLIGHT; ++i)
+    const bool multisampled = VK_SAMPLE_COUNT_1_BIT != sampleCount;
+
+    const auto hdr = _frameGraph.add_image("HDR", d.hdrImage, { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 }, ImageLifetime::Aliased);
+    const auto depth = _frameGraph.add_image("Depth", d.depthImage, { VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1 },
+        occlusionCulling ? ImageLifetime::Aliased : ImageLifetime::Transient);
+    const auto bloom = _frameGraph.add_image("Bloom", d.bloomImage, { VK_IMAGE_ASPECT_COLOR_BIT, 0, bloomLevels, 0, 1 }, ImageLifetime::Aliased);
+
+    constexpr VkPipelineStageFlags fragmentTests = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    constexpr VkAccessFlags bloomAccess = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+    std::vector<ImageUse> sceneUses = {
+        { hdr, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL },
+        { depth, fragmentTests, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+            VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL }
+    };
+    if (multisampled)
     {
-        fences[i] = d.perFrameData[i].fence;
+        const auto color = _frameGraph.add_image("Color", d.colorImage, { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 }, ImageLifetime::Transient);
+        sceneUses.push_back({ color, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+            VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL });
     }
-    check_success(vkWaitForFences(d.device, fences.size(), fences.data(), VK_TRUE, UINT64_MAX));
+    _frameGraph.add_pass("Scene", std::move(sceneUses), [this](VkCommandBuffer commandBuffer) { render_scene(commandBuffer); });
 
-    destroy_swapchain();
+    // Its pyramid is read by the next frame's cull, outside the graph
+    if (occlusionCulling)
+    {
+        _frameGraph.add_pass("Depth pyramid", {
+            { depth, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL }
+        }, [this](VkCommandBuffer commandBuffer) { reduce_depth_pyramid(commandBuffer); }, true);
+    }
 
-    create_swapchain();
+    _frameGraph.add_pass("Bloom downsample", {
+        { hdr, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL },
+        { bloom, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, bloomAccess, VK_IMAGE_LAYOUT_GENERAL }
+    }, [this](VkCommandBuffer commandBuffer) { bloom_downsample(commandBuffer); });
+
+    _frameGraph.add_pass("Bloom upsample", {
+        { bloom, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, bloomAccess, VK_IMAGE_LAYOUT_GENERAL }
+    }, [this](VkCommandBuffer commandBuffer) { bloom_upsample(commandBuffer); });
+
+    // Writes the swapchain image, which the post render pass synchronizes with presentation itself
+    _frameGraph.add_pass("Tonemap", {
+        { hdr, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL },
+        { bloom, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL }
+    }, [this](VkCommandBuffer commandBuffer) { tonemap(commandBuffer); }, true);
+
+    _frameGraph.compile();
+    _frameGraph.allocate(d.device, d.allocator, d.transientMemory);
 }
 
-void Renderer::record_command_buffer(uint32_t frameIndex, uint32_t imageIndex, const Scene& scene)
+void Renderer::create_depth_pyramid()
 {
-    const auto& frameData = d.perFrameData[frameIndex];
-    const auto& imageData = d.perImageData[imageIndex];
+    // Power of two below the surface size, so every level after the first halves exactly
+    const auto previous_pow2 = [](uint32_t x)
+    {
+        uint32_t result = 1;
+        while (result * 2 <= x)
+        {
+            result *= 2;
+        }
+        return result;
+    };
 
-    constexpr VkCommandBufferBeginInfo commandBufferBeginInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+    depthPyramidExtent = { previous_pow2(surfaceExtent.width), previous_pow2(surfaceExtent.height) };
+    depthPyramidLevels = 1;
+    while (depthPyramidLevels < RENDERER_MAX_DEPTH_PYRAMID_LEVELS && std::max(depthPyramidExtent.width, depthPyramidExtent.height) >> depthPyramidLevels)
+    {
+        ++depthPyramidLevels;
+    }
+    depthPyramidValid = false;
+
+    VkImageCreateInfo depthPyramidCreateInfo = { VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
+    depthPyramidCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+    depthPyramidCreateInfo.format = DEPTH_PYRAMID_FORMAT;
+    depthPyramidCreateInfo.extent = { depthPyramidExtent.width, depthPyramidExtent.height, 1 };
+    depthPyramidCreateInfo.mipLevels = depthPyramidLevels;
+    depthPyramidCreateInfo.arrayLayers = 1;
+    depthPyramidCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    depthPyramidCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    depthPyramidCreateInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
+    depthPyramidCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    VmaAllocationCreateInfo depthPyramidAllocationCreateInfo = {};
+    depthPyramidAllocationCreateInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+    check_success(vmaCreateImage(d.allocator, &depthPyramidCreateInfo, &depthPyramidAllocationCreateInfo, &d.depthPyramidImage, &d.depthPyramidMemory, nullptr));
+
+    VkImageViewCreateInfo depthPyramidViewCreateInfo = { VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
+    depthPyramidViewCreateInfo.image = d.depthPyramidImage;
+    depthPyramidViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    depthPyramidViewCreateInfo.format = DEPTH_PYRAMID_FORMAT;
+    depthPyramidViewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    depthPyramidViewCreateInfo.subresourceRange.baseMipLevel = 0;
+    depthPyramidViewCreateInfo.subresourceRange.levelCount = depthPyramidLevels;
+    depthPyramidViewCreateInfo.subresourceRange.baseArrayLayer = 0;
+    depthPyramidViewCreateInfo.subresourceRange.layerCount = 1;
+
+    check_success(vkCreateImageView(d.device, &depthPyramidViewCreateInfo, nullptr, &d.depthPyramidView));
+
+    for (uint32_t i = 0; i < depthPyramidLevels; ++i)
+    {
+        depthPyramidViewCreateInfo.subresourceRange.baseMipLevel = i;
+        depthPyramidViewCreateInfo.subresourceRange.levelCount = 1;
+        check_success(vkCreateImageView(d.device, &depthPyramidViewCreateInfo, nullptr, &d.depthPyramidLevelViews[i]));
+    }
 
-    std::array<VkClearValue, 2> clearValues;
-    clearValues[0].color = { 0.0f, 0.0f, 0.0f, 1.0f };
-    clearValues[1].depthStencil = { 1.0f, 0 };
+    // The cull shader always binds the pyramid, but only reduces into it with occlusion culling enabled
+    if (occlusionCulling)
+    {
+        const std::array<VkDescriptorPoolSize, 2> poolSizes = {{
+            {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, depthPyramidLevels},
+            {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, depthPyramidLevels}
+        }};
 
-    VkRenderPassBeginInfo renderPassBeginInfo = { VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO };
-    renderPassBeginInfo.renderPass = d.renderPass;
-    renderPassBeginInfo.framebuffer = imageData.framebuffer;
-    renderPassBeginInfo.renderArea = {{}, surfaceExtent};
-    renderPassBeginInfo.clearValueCount = clearValues.size();
-    renderPassBeginInfo.pClearValues = clearValues.data();
+        VkDescriptorPoolCreateInfo descriptorPoolCreateInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
+        descriptorPoolCreateInfo.maxSets = depthPyramidLevels;
+        descriptorPoolCreateInfo.poolSizeCount = poolSizes.size();
+        descriptorPoolCreateInfo.pPoolSizes = poolSizes.data();
 
-    const uint32_t uniformOffset = frameIndex * sizeof(TransformUniforms);
+        check_success(vkCreateDescriptorPool(d.device, &descriptorPoolCreateInfo, nullptr, &d.depthPyramidDescriptorPool));
 
-    const std::array<VkRect2D, 1> scissors = {{
-        {{0, 0}, surfaceExtent}
-    }};
+        std::array<VkDescriptorSetLayout, RENDERER_MAX_DEPTH_PYRAMID_LEVELS> setLayouts;
+        setLayouts.fill(d.depthPyramidSetLayout);
 
-    const std::array<VkViewport, 1> viewports = {{
-        { 0.0f, 0.0f, static_cast<float>(surfaceExtent.width), static_cast<float>(surfaceExtent.height), 0.0f, 1.0f }
+        VkDescriptorSetAllocateInfo descriptorAllocateInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+        descriptorAllocateInfo.descriptorPool = d.depthPyramidDescriptorPool;
+        descriptorAllocateInfo.descriptorSetCount = depthPyramidLevels;
+        descriptorAllocateInfo.pSetLayouts = setLayouts.data();
+
+        check_success(vkAllocateDescriptorSets(d.device, &descriptorAllocateInfo, d.depthPyramidSets.data()));
+
+        for (uint32_t i = 0; i < depthPyramidLevels; ++i)
+        {
+            const VkDescriptorImageInfo sourceInfo = 0 == i
+                ? VkDescriptorImageInfo{ d.pointSampler, d.depthView, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL }
+                : VkDescriptorImageInfo{ d.pointSampler, d.depthPyramidLevelViews[i - 1], VK_IMAGE_LAYOUT_GENERAL };
+            const VkDescriptorImageInfo destinationInfo = { VK_NULL_HANDLE, d.depthPyramidLevelViews[i], VK_IMAGE_LAYOUT_GENERAL };
+
+            std::array<VkWriteDescriptorSet, 2> descriptorWrites = {};
+            descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrites[0].dstSet = d.depthPyramidSets[i];
+            descriptorWrites[0].dstBinding = 0;
+            descriptorWrites[0].descriptorCount = 1;
+            descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            descriptorWrites[0].pImageInfo = &sourceInfo;
+            descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrites[1].dstSet = d.depthPyramidSets[i];
+            descriptorWrites[1].dstBinding = 1;
+            descriptorWrites[1].descriptorCount = 1;
+            descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+            descriptorWrites[1].pImageInfo = &destinationInfo;
+            vkUpdateDescriptorSets(d.device, descriptorWrites.size(), descriptorWrites.data(), 0, nullptr);
+        }
+    }
+
+    const VkDescriptorImageInfo depthPyramidInfo = { d.pointSampler, d.depthPyramidView, VK_IMAGE_LAYOUT_GENERAL };
+
+    VkWriteDescriptorSet descriptorWrite = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+    descriptorWrite.dstSet = d.descriptorSet;
+    descriptorWrite.dstBinding = 5;
+    descriptorWrite.descriptorCount = 1;
+    descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    descriptorWrite.pImageInfo = &depthPyramidInfo;
+    vkUpdateDescriptorSets(d.device, 1, &descriptorWrite, 0, nullptr);
+}
+
+void Renderer::create_bloom()
+{
+    VkImageViewCreateInfo bloomViewCreateInfo = { VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
+    bloomViewCreateInfo.image = d.bloomImage;
+    bloomViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    bloomViewCreateInfo.format = BLOOM_FORMAT;
+    bloomViewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    bloomViewCreateInfo.subresourceRange.levelCount = 1;
+    bloomViewCreateInfo.subresourceRange.baseArrayLayer = 0;
+    bloomViewCreateInfo.subresourceRange.layerCount = 1;
+
+    for (uint32_t i = 0; i < bloomLevels; ++i)
+    {
+        bloomViewCreateInfo.subresourceRange.baseMipLevel = i;
+        check_success(vkCreateImageView(d.device, &bloomViewCreateInfo, nullptr, &d.bloomLevelViews[i]));
+    }
+
+    // A downsample set per level, an upsample set per level but the smallest, and the tonemap set
+    const uint32_t numSets = 2 * bloomLevels;
+    const std::array<VkDescriptorPoolSize, 2> poolSizes = {{
+        {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, numSets + 2},
+        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, numSets - 1}
     }};
 
-    const std::array<VkBuffer, 1> vertexBuffers = { d.vertexBuffer };
-    const std::array<VkDeviceSize, 1> vertexOffsets = { 0 };
-    static_assert(vertexBuffers.size() == vertexOffsets.size());
+    VkDescriptorPoolCreateInfo descriptorPoolCreateInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
+    descriptorPoolCreateInfo.maxSets = numSets;
+    descriptorPoolCreateInfo.poolSizeCount = poolSizes.size();
+    descriptorPoolCreateInfo.pPoolSizes = poolSizes.data();
 
-    const auto modelMatrix = glm::translate(scene.modelLocation) * glm::mat4_cast(scene.modelRotation);
+    check_success(vkCreateDescriptorPool(d.device, &descriptorPoolCreateInfo, nullptr, &d.postDescriptorPool));
 
-    constexpr glm::vec3 cameraUp{ 0, 1, 0 };
-    const auto viewMatrix = glm::lookAt(scene.cameraLocation, scene.modelLocation, cameraUp);
+    std::array<VkDescriptorSetLayout, RENDERER_MAX_BLOOM_LEVELS> setLayouts;
+    setLayouts.fill(d.bloomSetLayout);
+
+    VkDescriptorSetAllocateInfo descriptorAllocateInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+    descriptorAllocateInfo.descriptorPool = d.postDescriptorPool;
+    descriptorAllocateInfo.descriptorSetCount = bloomLevels;
+    descriptorAllocateInfo.pSetLayouts = setLayouts.data();
 
-    const auto modelViewMatrix = viewMatrix * modelMatrix;
+    check_success(vkAllocateDescriptorSets(d.device, &descriptorAllocateInfo, d.bloomDownSets.data()));
 
-    // TODO: Depth clamp or use a non-infinite perspective
-    auto projectionMatrix = glm::infinitePerspective(FIELD_OF_VIEW, viewports[0].width / viewports[0].height, NEAR_CLIP_PLANE);
-    projectionMatrix[1][1] *= -1; // Correct for OriginUpperLeft (Vulkan) vs OriginLowerLeft (GLM)
+    if (bloomLevels > 1)
+    {
+        descriptorAllocateInfo.descriptorSetCount = bloomLevels - 1;
+        check_success(vkAllocateDescriptorSets(d.device, &descriptorAllocateInfo, d.bloomUpSets.data()));
+    }
 
-    const auto normalMatrix = glm::transpose(glm::inverse(modelViewMatrix));
+    descriptorAllocateInfo.descriptorSetCount = 1;
+    descriptorAllocateInfo.pSetLayouts = &d.tonemapSetLayout;
+    check_success(vkAllocateDescriptorSets(d.device, &descriptorAllocateInfo, &d.tonemapSet));
 
-    const TransformUniforms uniforms { modelViewMatrix, projectionMatrix, normalMatrix };
+    const auto write_bloom_set = [&](VkDescriptorSet set, const VkDescriptorImageInfo& sourceInfo, VkImageView destination)
+    {
+        const VkDescriptorImageInfo destinationInfo = { VK_NULL_HANDLE, destination, VK_IMAGE_LAYOUT_GENERAL };
+
+        std::array<VkWriteDescriptorSet, 2> descriptorWrites = {};
+        descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[0].dstSet = set;
+        descriptorWrites[0].dstBinding = 0;
+        descriptorWrites[0].descriptorCount = 1;
+        descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        descriptorWrites[0].pImageInfo = &sourceInfo;
+        descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[1].dstSet = set;
+        descriptorWrites[1].dstBinding = 1;
+        descriptorWrites[1].descriptorCount = 1;
+        descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        descriptorWrites[1].pImageInfo = &destinationInfo;
+        vkUpdateDescriptorSets(d.device, descriptorWrites.size(), descriptorWrites.data(), 0, nullptr);
+    };
 
-    void *pData;
-    vmaMapMemory(d.allocator, d.transformUniformMemory, &pData);
-        memcpy(reinterpret_cast<void *>(reinterpret_cast<uintptr_t>(pData) + uniformOffset), &uniforms, sizeof(TransformUniforms));
-        vmaFlushAllocation(d.allocator, d.transformUniformMemory, uniformOffset, sizeof(TransformUniforms));
-    vmaUnmapMemory(d.allocator, d.transformUniformMemory);
+    // Level 0 is downsampled from the lit scene, every level is upsampled onto from the one below it
+    for (uint32_t i = 0; i < bloomLevels; ++i)
+    {
+        const VkDescriptorImageInfo sourceInfo = 0 == i
+            ? VkDescriptorImageInfo{ d.linearSampler, d.hdrView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL }
+            : VkDescriptorImageInfo{ d.linearSampler, d.bloomLevelViews[i - 1], VK_IMAGE_LAYOUT_GENERAL };
+        write_bloom_set(d.bloomDownSets[i], sourceInfo, d.bloomLevelViews[i]);
+    }
+    for (uint32_t i = 0; i + 1 < bloomLevels; ++i)
+    {
+        const VkDescriptorImageInfo sourceInfo = { d.linearSampler, d.bloomLevelViews[i + 1], VK_IMAGE_LAYOUT_GENERAL };
+        write_bloom_set(d.bloomUpSets[i], sourceInfo, d.bloomLevelViews[i]);
+    }
 
-    constexpr PushConstants pushConstants = { 0 };
+    const std::array<VkDescriptorImageInfo, 3> tonemapInfos = {{
+        { d.linearSampler, d.hdrView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL },
+        { d.linearSampler, d.bloomLevelViews[0], VK_IMAGE_LAYOUT_GENERAL },
+        { d.linearSampler, d.colorGradingView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL }
+    }};
 
-    check_success(vkResetCommandBuffer(frameData.commandBuffer, 0));
-    check_success(vkBeginCommandBuffer(frameData.commandBuffer, &commandBufferBeginInfo));
+    VkWriteDescriptorSet descriptorWrite = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+    descriptorWrite.dstSet = d.tonemapSet;
+    descriptorWrite.dstBinding = 0;
+    descriptorWrite.descriptorCount = tonemapInfos.size();
+    descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    descriptorWrite.pImageInfo = tonemapInfos.data();
+    vkUpdateDescriptorSets(d.device, 1, &descriptorWrite, 0, nullptr);
+}
 
-    vkCmdSetScissor(frameData.commandBuffer, 0, scissors.size(), scissors.data());
-    vkCmdSetViewport(frameData.commandBuffer, 0, viewports.size(), viewports.data());
+// Called once per frame, before anything is recorded. Never waits on the GPU: a finished upload is picked up on the
+// first frame after it completes.
+void Renderer::stream_meshes()
+{
+    ++_frameNumber;
+
+    const auto update = _assets.update();
+    for (const auto& [filename, error] : update.reloadErrors)
+    {
+        printf("Error: Reloading '%s' failed with '%s'\n", filename.c_str(), error.c_str());
+    }
+
+    const auto retire = [this](MeshHandle handle)
+    {
+        const auto resident = _residentMeshes.find(handle);
+        if (_residentMeshes.end() != resident)
+        {
+            _retiredGeometry.emplace_back(_frameNumber, resident->second);
+            _residentMeshes.erase(resident);
+        }
+        if (_materialsMesh == handle)
+        {
+            _materialsMesh = NO_MESH;
+        }
+        if (_shadowMesh == handle)
+        {
+            _shadowMesh = NO_MESH;
+        }
+    };
 
-    vkCmdBeginRenderPass(frameData.commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+    for (const auto handle : update.loaded)
+    {
+        // A reloaded mesh no longer matches its old geometry, so it isn't drawn until the new geometry is uploaded
+        retire(handle);
+        _deferredUploads.erase(std::remove(_deferredUploads.begin(), _deferredUploads.end(), handle), _deferredUploads.end());
+        if (_pendingUploads.end() == std::find(_pendingUploads.begin(), _pendingUploads.end(), handle))
+        {
+            _pendingUploads.push_back(handle);
+        }
+    }
+    for (const auto handle : update.evicted)
+    {
+        _pendingUploads.erase(std::remove(_pendingUploads.begin(), _pendingUploads.end(), handle), _pendingUploads.end());
+        _deferredUploads.erase(std::remove(_deferredUploads.begin(), _deferredUploads.end(), handle), _deferredUploads.end());
+        retire(handle);
+    }
 
-        vkCmdBindDescriptorSets(frameData.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, d.pipelineLayout, 0, 1, &d.descriptorSet, 1, &uniformOffset);
-        vkCmdBindPipeline(frameData.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, d.pipeline);
-        vkCmdBindVertexBuffers(frameData.commandBuffer, 0, vertexBuffers.size(), vertexBuffers.data(), vertexOffsets.data());
+    if (_uploadPending)
+    {
+        const auto fenceStatus = vkGetFenceStatus(d.device, d.uploadFence);
+        if (VK_NOT_READY != fenceStatus)
+        {
+            check_success(fenceStatus);
 
-        vkCmdPushConstants(frameData.commandBuffer, d.pipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(PushConstants), &pushConstants);
-        
-        vkCmdDraw(frameData.commandBuffer, _mesh.verticies.size(), 1, 0, 0);
+            _uploadPending = false;
+            const auto resident = _residentMeshes.find(_uploadingMesh);
+            if (_residentMeshes.end() == resident)
+            {
+                // Retired while uploading, its geometry is freed below
+                _uploadCopies.clear();
+            }
+            else if (!_uploadCopies.empty())
+            {
+                submit_geometry_copies();
+            }
+            else
+            {
+                resident->second.ready = true;
+            }
+        }
+    }
 
-    vkCmdEndRenderPass(frameData.commandBuffer);
+    // Frames are recorded only after the fence of the frame RENDERER_MAX_FRAMES_IN_FLIGHT back, so by then every frame
+    // that could have drawn the geometry has finished. A pending upload may still be writing to it.
+    while (!_uploadPending && !_retiredGeometry.empty() && _retiredGeometry.front().first + RENDERER_MAX_FRAMES_IN_FLIGHT <= _frameNumber)
+    {
+        release_geometry(_retiredGeometry.front().second);
+        _retiredGeometry.pop_front();
 
-    check_success(vkEndCommandBuffer(frameData.commandBuffer));
+        _pendingUploads.insert(_pendingUploads.begin(), _deferredUploads.begin(), _deferredUploads.end());
+        _deferredUploads.clear();
+    }
+
+    if (!_uploadPending && !_pendingUploads.empty())
+    {
+        const auto handle = _pendingUploads.front();
+        _pendingUploads.pop_front();
+        upload_mesh(handle, *_assets.resolve(handle));
+    }
+}
+
+void Renderer::upload_mesh(MeshHandle handle, const Mesh& mesh)
+{
+    // Streaming runs every frame, so a mesh that can't be uploaded is reported and skipped rather than thrown
+    if (mesh.materials.size() > MAX_MATERIALS)
+    {
+        printf("Error: Mesh %u has %zu materials, more than the %u supported, so is never drawn\n", handle, mesh.materials.size(),
+            MAX_MATERIALS);
+        return;
+    }
+
+    MeshGeometry geometry;
+    geometry.vertices = _vertexAllocator.allocate(mesh.verticies.size());
+    geometry.indices = _indexAllocator.allocate(mesh.indices.size());
+    geometry.meshlets = _meshletAllocator.allocate(mesh.meshlets.size());
+    geometry.ready = false;
+
+    const bool outOfSpace = OFFSET_ALLOCATOR_NO_SPACE == geometry.vertices.offset
+        || OFFSET_ALLOCATOR_NO_SPACE == geometry.indices.offset
+        || OFFSET_ALLOCATOR_NO_SPACE == geometry.meshlets.offset;
+    if (outOfSpace)
+    {
+        release_geometry(geometry);
+        const bool fits = mesh.verticies.size() <= GEOMETRY_MAX_VERTICES && mesh.indices.size() <= GEOMETRY_MAX_INDICES
+            && mesh.meshlets.size() <= GEOMETRY_MAX_MESHLETS;
+        if (fits)
+        {
+            printf("Warning: Out of geometry memory for mesh %u, retrying once evicted geometry is freed\n", handle);
+            _deferredUploads.push_back(handle);
+        }
+        else
+        {
+            printf("Error: Mesh %u is larger than the geometry buffers, so is never drawn\n", handle);
+        }
+        return;
+    }
+
+    std::vector<uint32_t> materialMeshlets(mesh.materials.size());
+    for (const auto& meshlet : mesh.meshlets)
+    {
+        ++materialMeshlets[meshlet.material];
+    }
+    const auto maxMaterialMeshlets = *std::max_element(materialMeshlets.begin(), materialMeshlets.end());
+    geometry.clusterCullable = maxMaterialMeshlets <= CLUSTER_MAX_MATERIAL_MESHLETS;
+    geometry.maxMaterialMeshlets = maxMaterialMeshlets;
+    if (clusterCulling && !geometry.clusterCullable)
+    {
+        printf("Warning: Mesh %u has %u meshlets of one material, more than the %u cluster culling fits, so is drawn whole\n",
+            handle, maxMaterialMeshlets, CLUSTER_MAX_MATERIAL_MESHLETS);
+    }
+
+    const VkDeviceSize vertexStride = packedVertices ? sizeof(PackedVertex) : sizeof(PerVertex);
+    constexpr VkDeviceSize vertexOffset = 0;
+    const VkDeviceSize vertexSize = vertexStride * mesh.verticies.size();
+
+    const VkDeviceSize indexOffset = vertexOffset + vertexSize;
+    const VkDeviceSize indexSize = sizeof(uint32_t) * mesh.indices.size();
+
+    const VkDeviceSize meshletOffset = indexOffset + indexSize;
+    const VkDeviceSize meshletSize = sizeof(Meshlet) * mesh.meshlets.size();
+
+    // Kept until the last copy is staged, the mesh itself may be evicted or reloaded in the meantime
+    _uploadData.resize(meshletOffset + meshletSize);
+    if (packedVertices)
+    {
+        const auto packed = pack_vertices(mesh.verticies, mesh.bounds);
+        memcpy(_uploadData.data() + vertexOffset, packed.data(), vertexSize);
+    }
+    else
+    {
+        memcpy(_uploadData.data() + vertexOffset, mesh.verticies.data(), vertexSize);
+    }
+    memcpy(_uploadData.data() + indexOffset, mesh.indices.data(), indexSize);
+    memcpy(_uploadData.data() + meshletOffset, mesh.meshlets.data(), meshletSize);
+
+    const std::array<GeometryCopy, 3> copies = {{
+        { d.vertexBuffer, vertexOffset, vertexStride * geometry.vertices.offset, vertexSize },
+        { d.indexBuffer, indexOffset, sizeof(uint32_t) * geometry.indices.offset, indexSize },
+        { d.meshletBuffer, meshletOffset, sizeof(Meshlet) * geometry.meshlets.offset, meshletSize }
+    }};
+    for (const auto& copy : copies)
+    {
+        if (copy.size > 0)
+        {
+            _uploadCopies.push_back(copy);
+        }
+    }
+
+    _residentMeshes[handle] = geometry;
+    _uploadingMesh = handle;
+    submit_geometry_copies();
+}
+
+// Stages as much of the current upload as fits in the staging buffer and submits its copies. stream_meshes submits the
+// rest once the fence shows the staging buffer is free again.
+void Renderer::submit_geometry_copies()
+{
+    void *pData;
+    check_success(vmaMapMemory(d.allocator, d.stagingMemory, &pData));
+
+    VkCommandBufferBeginInfo commandBufferBeginInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+    commandBufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    // Frames only draw the mesh once the last fence has been seen signalled, which makes the copies visible to them
+    check_success(vkResetFences(d.device, 1, &d.uploadFence));
+    check_success(vkBeginCommandBuffer(d.uploadCommandBuffer, &commandBufferBeginInfo));
+    VkDeviceSize stagingOffset = 0;
+    while (!_uploadCopies.empty() && stagingOffset < STAGING_BUFFER_SIZE)
+    {
+        auto& copy = _uploadCopies.front();
+        const VkDeviceSize size = std::min(copy.size, STAGING_BUFFER_SIZE - stagingOffset);
+        memcpy(reinterpret_cast<void *>(reinterpret_cast<uintptr_t>(pData) + stagingOffset), _uploadData.data() + copy.sourceOffset, size);
+
+        const VkBufferCopy region { stagingOffset, copy.destinationOffset, size };
+        vkCmdCopyBuffer(d.uploadCommandBuffer, d.stagingBuffer, copy.buffer, 1, &region);
+
+        stagingOffset += size;
+        copy.sourceOffset += size;
+        copy.destinationOffset += size;
+        copy.size -= size;
+        if (0 == copy.size)
+        {
+            _uploadCopies.pop_front();
+        }
+    }
+    check_success(vkEndCommandBuffer(d.uploadCommandBuffer));
+
+    vmaUnmapMemory(d.allocator, d.stagingMemory);
+
+    VkSubmitInfo submitInfo = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &d.uploadCommandBuffer;
+    check_success(vkQueueSubmit(queue, 1, &submitInfo, d.uploadFence));
+
+    _uploadPending = true;
+}
+
+// Updates the CPU copies of the lights and materials, marking what changed for upload_lighting, and hands out the shadow
+// atlas rows. Returns the number of lights to shade with, lights past RENDERER_MAX_LIGHTS are ignored.
+uint32_t Renderer::set_lighting(const Scene& scene, const Mesh& mesh)
+{
+    if (scene.mesh != _materialsMesh)
+    {
+        for (uint32_t i = 0; i < mesh.materials.size(); ++i)
+        {
+            Material material = {};
+            material.ambient = mesh.materials[i].ambient;
+            material.diffuse = mesh.materials[i].diffuse;
+            material.specular = mesh.materials[i].specular;
+            material.shininess = mesh.materials[i].shininess;
+            _materials.set(i, material);
+        }
+        _materialsMesh = scene.mesh;
+    }
+
+    _shadowLightCount = 0;
+
+    const uint32_t lightCount = std::min(scene.lightCount, RENDERER_MAX_LIGHTS);
+    for (uint32_t i = 0; i < lightCount; ++i)
+    {
+        const auto& pointLight = scene.lights[i];
+
+        Light light = {};
+        light.position = pointLight.position;
+        light.radius = light_radius(pointLight.power);
+        light.color = pointLight.color;
+        light.power = pointLight.power;
+        light.shadowIndex = -1;
+        if (pointLight.castsShadows && _shadowLightCount < RENDERER_MAX_SHADOW_LIGHTS)
+        {
+            light.shadowIndex = _shadowLightCount;
+            _shadowLightPositions[_shadowLightCount++] = pointLight.position;
+        }
+        _lights.set(i, light);
+    }
+    return lightCount;
+}
+
+// Copies the lights, materials and shadow faces that changed into their GPU buffers, staged through this frame's slice of the upload
+// ring, which no frame in flight is still reading. The GPU buffers are shared by every frame in flight, so the copies
+// wait for earlier frames to finish shading.
+void Renderer::upload_lighting(VkCommandBuffer commandBuffer, uint32_t frameIndex)
+{
+    const auto lightRanges = _lights.take_dirty_ranges();
+    const auto materialRanges = _materials.take_dirty_ranges();
+    const auto shadowFaceRanges = _shadowFaces.take_dirty_ranges();
+    if (lightRanges.empty() && materialRanges.empty() && shadowFaceRanges.empty())
+    {
+        return;
+    }
+
+    const VkDeviceSize uploadOffset = frameIndex * LIGHTING_UPLOAD_SIZE;
+    VkDeviceSize offset = uploadOffset;
+
+    std::vector<VkBufferCopy> lightRegions, uniformRegions;
+
+    void *pData;
+    check_success(vmaMapMemory(d.allocator, d.lightingUploadMemory, &pData));
+
+    const auto stage = [&](const auto& array, const std::vector<DirtyRange>& ranges, VkDeviceSize destinationOffset,
+        std::vector<VkBufferCopy>& regions)
+    {
+        const VkDeviceSize elementSize = sizeof(array[0]);
+        for (const auto& range : ranges)
+        {
+            const VkDeviceSize size = elementSize * range.count;
+            memcpy(reinterpret_cast<void *>(reinterpret_cast<uintptr_t>(pData) + offset), &array[range.first], size);
+            regions.push_back({ offset, destinationOffset + elementSize * range.first, size });
+            offset += size;
+        }
+    };
+
+    stage(_lights, lightRanges, 0, lightRegions);
+    stage(_materials, materialRanges, offsetof(LightingUniforms, materials), uniformRegions);
+    stage(_shadowFaces, shadowFaceRanges, offsetof(LightingUniforms, shadowFaces), uniformRegions);
+
+    vmaFlushAllocation(d.allocator, d.lightingUploadMemory, uploadOffset, offset - uploadOffset);
+    vmaUnmapMemory(d.allocator, d.lightingUploadMemory);
+
+    // Earlier frames may still be culling and shading with the old values
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+        0, nullptr, 0, nullptr, 0, nullptr);
+
+    if (!lightRegions.empty())
+    {
+        vkCmdCopyBuffer(commandBuffer, d.lightingUploadBuffer, d.lightBuffer, lightRegions.size(), lightRegions.data());
+    }
+    if (!uniformRegions.empty())
+    {
+        vkCmdCopyBuffer(commandBuffer, d.lightingUploadBuffer, d.lightingUniformBuffer, uniformRegions.size(), uniformRegions.data());
+    }
+
+    VkMemoryBarrier lightingBarrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+    lightingBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    lightingBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT;
+
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+        1, &lightingBarrier, 0, nullptr, 0, nullptr);
+}
+
+void Renderer::release_geometry(const MeshGeometry& geometry)
+{
+    const std::array<std::pair<OffsetAllocator *, OffsetAllocation>, 3> allocations = {{
+        { &_vertexAllocator, geometry.vertices },
+        { &_indexAllocator, geometry.indices },
+        { &_meshletAllocator, geometry.meshlets }
+    }};
+
+    for (const auto& [allocator, allocation] : allocations)
+    {
+        if (OFFSET_ALLOCATOR_NO_SPACE != allocation.offset)
+        {
+            allocator->free(allocation);
+        }
+    }
+}
+
+// Called once per frame, after stream_meshes. Changed meshes are reloaded through the AssetManager and uploaded like
+// any other. Changed shaders are rebuilt on a background thread, one batch at a time, and swapped in here between
+// frames, so no frame waits on pipeline compilation. A rebuild that fails keeps the old pipelines.
+void Renderer::hot_reload()
+{
+    const std::string shaderPrefix = std::string(SHADER_DIRECTORY) + "/";
+    constexpr std::string_view shaderSuffix = ".spv";
+
+    for (const auto& path : _watcher->poll())
+    {
+        const bool shader = path.size() > shaderPrefix.size() + shaderSuffix.size()
+            && 0 == path.compare(0, shaderPrefix.size(), shaderPrefix)
+            && 0 == path.compare(path.size() - shaderSuffix.size(), shaderSuffix.size(), shaderSuffix);
+        if (shader)
+        {
+            _changedShaders.insert(path.substr(shaderPrefix.size(), path.size() - shaderPrefix.size() - shaderSuffix.size()));
+        }
+        else
+        {
+            _assets.reload_file(path);
+        }
+    }
+
+    if (_pipelineRebuild.valid() && std::future_status::ready == _pipelineRebuild.wait_for(std::chrono::seconds(0)))
+    {
+        finish_pipeline_rebuild();
+    }
+
+    if (!_pipelineRebuild.valid() && !_changedShaders.empty())
+    {
+        _pipelineRebuild = std::async(std::launch::async, [this, shaders = std::move(_changedShaders)] { return rebuild_pipelines(shaders); });
+        _changedShaders.clear();
+    }
+
+    // Same reasoning as for retired geometry in stream_meshes
+    while (!_retiredPipelines.empty() && _retiredPipelines.front().first + RENDERER_MAX_FRAMES_IN_FLIGHT <= _frameNumber)
+    {
+        destroy_pipelines(_retiredPipelines.front().second);
+        _retiredPipelines.pop_front();
+    }
+}
+
+// Swaps in a finished background rebuild, the pipelines it replaces are destroyed once no frame in flight uses them
+void Renderer::finish_pipeline_rebuild()
+{
+    try
+    {
+        auto rebuilt = _pipelineRebuild.get();
+
+        // Cached shadows were drawn by the old shader
+        if (VK_NULL_HANDLE != rebuilt.shadowPipeline)
+        {
+            _shadowMesh = NO_MESH;
+        }
+
+        // Leaves rebuilt holding whatever it replaced
+        const auto swap_in = [](auto& current, auto& replacement)
+        {
+            if (VK_NULL_HANDLE != replacement)
+            {
+                std::swap(current, replacement);
+            }
+        };
+        swap_in(d.vertexModule, rebuilt.vertexModule);
+        swap_in(d.fragmentModule, rebuilt.fragmentModule);
+        swap_in(d.cullModule, rebuilt.cullModule);
+        swap_in(d.depthPyramidModule, rebuilt.depthPyramidModule);
+        swap_in(d.clusterCullModule, rebuilt.clusterCullModule);
+        swap_in(d.lightCullModule, rebuilt.lightCullModule);
+        swap_in(d.depthModule, rebuilt.depthModule);
+        swap_in(d.shadowModule, rebuilt.shadowModule);
+        swap_in(d.depthPyramidMsModule, rebuilt.depthPyramidMsModule);
+        swap_in(d.bloomDownModule, rebuilt.bloomDownModule);
+        swap_in(d.bloomUpModule, rebuilt.bloomUpModule);
+        swap_in(d.fullscreenModule, rebuilt.fullscreenModule);
+        swap_in(d.tonemapModule, rebuilt.tonemapModule);
+        swap_in(d.pipeline, rebuilt.pipeline);
+        swap_in(d.cullPipeline, rebuilt.cullPipeline);
+        swap_in(d.depthPyramidPipeline, rebuilt.depthPyramidPipeline);
+        swap_in(d.clusterCullPipeline, rebuilt.clusterCullPipeline);
+        swap_in(d.lightCullPipeline, rebuilt.lightCullPipeline);
+        swap_in(d.depthPrepassPipeline, rebuilt.depthPrepassPipeline);
+        swap_in(d.prepassShadingPipeline, rebuilt.prepassShadingPipeline);
+        swap_in(d.shadowPipeline, rebuilt.shadowPipeline);
+        swap_in(d.depthPyramidMsPipeline, rebuilt.depthPyramidMsPipeline);
+        swap_in(d.bloomDownPipeline, rebuilt.bloomDownPipeline);
+        swap_in(d.bloomUpPipeline, rebuilt.bloomUpPipeline);
+        swap_in(d.tonemapPipeline, rebuilt.tonemapPipeline);
+
+        _retiredPipelines.emplace_back(_frameNumber, rebuilt);
+    }
+    catch (const std::exception& e)
+    {
+        printf("Error: Reloading shaders failed with '%s'\n", e.what());
+    }
+}
+
+// Runs on a background thread. The modules and pipelines it doesn't rebuild are only read, and are only replaced by
+// hot_reload once this has finished.
+PipelineSet Renderer::rebuild_pipelines(const std::set<std::string>& shaders) const
+{
+    PipelineSet rebuilt = {};
+    try
+    {
+        const std::array<std::pair<const char *, VkShaderModule *>, 13> modules = {{
+            { "main.vert", &rebuilt.vertexModule },
+            { "main.frag", &rebuilt.fragmentModule },
+            { "cull.comp", &rebuilt.cullModule },
+            { "depthpyramid.comp", &rebuilt.depthPyramidModule },
+            { "clustercull.comp", &rebuilt.clusterCullModule },
+            { "lightcull.comp", &rebuilt.lightCullModule },
+            { "depth.vert", &rebuilt.depthModule },
+            { "shadow.vert", &rebuilt.shadowModule },
+            { "depthpyramidms.comp", &rebuilt.depthPyramidMsModule },
+            { "bloomdown.comp", &rebuilt.bloomDownModule },
+            { "bloomup.comp", &rebuilt.bloomUpModule },
+            { "fullscreen.vert", &rebuilt.fullscreenModule },
+            { "tonemap.frag", &rebuilt.tonemapModule }
+        }};
+
+        for (const auto& [name, module] : modules)
+        {
+            if (shaders.count(name))
+            {
+                *module = create_shader_module(d.device, name);
+            }
+        }
+
+        if (VK_NULL_HANDLE != rebuilt.vertexModule || VK_NULL_HANDLE != rebuilt.fragmentModule)
+        {
+            const auto vertexModule = VK_NULL_HANDLE != rebuilt.vertexModule ? rebuilt.vertexModule : d.vertexModule;
+            const auto fragmentModule = VK_NULL_HANDLE != rebuilt.fragmentModule ? rebuilt.fragmentModule : d.fragmentModule;
+            rebuilt.pipeline = create_graphics_pipeline(vertexModule, fragmentModule, GraphicsPass::Forward);
+            rebuilt.prepassShadingPipeline = create_graphics_pipeline(vertexModule, fragmentModule, GraphicsPass::PrepassShading);
+        }
+        if (VK_NULL_HANDLE != rebuilt.depthModule)
+        {
+            rebuilt.depthPrepassPipeline = create_graphics_pipeline(rebuilt.depthModule, VK_NULL_HANDLE, GraphicsPass::DepthPrepass);
+        }
+        if (VK_NULL_HANDLE != rebuilt.shadowModule)
+        {
+            rebuilt.shadowPipeline = create_graphics_pipeline(rebuilt.shadowModule, VK_NULL_HANDLE, GraphicsPass::Shadow);
+        }
+        if (VK_NULL_HANDLE != rebuilt.cullModule)
+        {
+            rebuilt.cullPipeline = create_cull_pipeline(rebuilt.cullModule);
+        }
+        if (VK_NULL_HANDLE != rebuilt.depthPyramidModule)
+        {
+            rebuilt.depthPyramidPipeline = create_depth_pyramid_pipeline(rebuilt.depthPyramidModule);
+        }
+        if (VK_NULL_HANDLE != rebuilt.depthPyramidMsModule)
+        {
+            rebuilt.depthPyramidMsPipeline = create_depth_pyramid_pipeline(rebuilt.depthPyramidMsModule);
+        }
+        if (VK_NULL_HANDLE != rebuilt.clusterCullModule)
+        {
+            rebuilt.clusterCullPipeline = create_cluster_cull_pipeline(rebuilt.clusterCullModule);
+        }
+        if (VK_NULL_HANDLE != rebuilt.lightCullModule)
+        {
+            rebuilt.lightCullPipeline = create_light_cull_pipeline(rebuilt.lightCullModule);
+        }
+        if (VK_NULL_HANDLE != rebuilt.bloomDownModule)
+        {
+            rebuilt.bloomDownPipeline = create_bloom_pipeline(rebuilt.bloomDownModule);
+        }
+        if (VK_NULL_HANDLE != rebuilt.bloomUpModule)
+        {
+            rebuilt.bloomUpPipeline = create_bloom_pipeline(rebuilt.bloomUpModule);
+        }
+        if (VK_NULL_HANDLE != rebuilt.fullscreenModule || VK_NULL_HANDLE != rebuilt.tonemapModule)
+        {
+            const auto vertexModule = VK_NULL_HANDLE != rebuilt.fullscreenModule ? rebuilt.fullscreenModule : d.fullscreenModule;
+            const auto fragmentModule = VK_NULL_HANDLE != rebuilt.tonemapModule ? rebuilt.tonemapModule : d.tonemapModule;
+            rebuilt.tonemapPipeline = create_tonemap_pipeline(vertexModule, fragmentModule);
+        }
+    }
+    catch (...)
+    {
+        destroy_pipelines(rebuilt);
+        throw;
+    }
+
+    return rebuilt;
+}
+
+void Renderer::destroy_pipelines(const PipelineSet& pipelines) const
+{
+    vkDestroyPipeline(d.device, pipelines.tonemapPipeline, nullptr);
+    vkDestroyPipeline(d.device, pipelines.bloomUpPipeline, nullptr);
+    vkDestroyPipeline(d.device, pipelines.bloomDownPipeline, nullptr);
+    vkDestroyPipeline(d.device, pipelines.depthPyramidMsPipeline, nullptr);
+    vkDestroyPipeline(d.device, pipelines.shadowPipeline, nullptr);
+    vkDestroyPipeline(d.device, pipelines.prepassShadingPipeline, nullptr);
+    vkDestroyPipeline(d.device, pipelines.depthPrepassPipeline, nullptr);
+    vkDestroyPipeline(d.device, pipelines.lightCullPipeline, nullptr);
+    vkDestroyPipeline(d.device, pipelines.clusterCullPipeline, nullptr);
+    vkDestroyPipeline(d.device, pipelines.depthPyramidPipeline, nullptr);
+    vkDestroyPipeline(d.device, pipelines.cullPipeline, nullptr);
+    vkDestroyPipeline(d.device, pipelines.pipeline, nullptr);
+    vkDestroyShaderModule(d.device, pipelines.tonemapModule, nullptr);
+    vkDestroyShaderModule(d.device, pipelines.fullscreenModule, nullptr);
+    vkDestroyShaderModule(d.device, pipelines.bloomUpModule, nullptr);
+    vkDestroyShaderModule(d.device, pipelines.bloomDownModule, nullptr);
+    vkDestroyShaderModule(d.device, pipelines.depthPyramidMsModule, nullptr);
+    vkDestroyShaderModule(d.device, pipelines.shadowModule, nullptr);
+    vkDestroyShaderModule(d.device, pipelines.depthModule, nullptr);
+    vkDestroyShaderModule(d.device, pipelines.lightCullModule, nullptr);
+    vkDestroyShaderModule(d.device, pipelines.clusterCullModule, nullptr);
+    vkDestroyShaderModule(d.device, pipelines.depthPyramidModule, nullptr);
+    vkDestroyShaderModule(d.device, pipelines.cullModule, nullptr);
+    vkDestroyShaderModule(d.device, pipelines.vertexModule, nullptr);
+    vkDestroyShaderModule(d.device, pipelines.fragmentModule, nullptr);
+}
+
+void Renderer::recreate_swapchain()
+{
+    std::array<VkFence, RENDERER_MAX_FRAMES_IN_FLIGHT> fences;
+    for (uint32_t i = 0; i < RENDERER_MAX_FRAMES_IN_FLIGHT; ++i)
+    {
+        fences[i] = d.perFrameData[i].fence;
+    }
+    check_success(vkWaitForFences(d.device, fences.size(), fences.data(), VK_TRUE, UINT64_MAX));
+
+    destroy_swapchain();
+
+    create_swapchain();
+}
+
+// The attachments' sample count is baked into the render pass, the framebuffers and the pipelines drawing in it
+void Renderer::rebuild_render_pass()
+{
+    // A pending rebuild was compiled against the old render pass
+    if (_pipelineRebuild.valid())
+    {
+        _pipelineRebuild.wait();
+        finish_pipeline_rebuild();
+    }
+
+    std::array<VkFence, RENDERER_MAX_FRAMES_IN_FLIGHT> fences;
+    for (uint32_t i = 0; i < RENDERER_MAX_FRAMES_IN_FLIGHT; ++i)
+    {
+        fences[i] = d.perFrameData[i].fence;
+    }
+    check_success(vkWaitForFences(d.device, fences.size(), fences.data(), VK_TRUE, UINT64_MAX));
+
+    destroy_swapchain();
+
+    vkDestroyPipeline(d.device, d.prepassShadingPipeline, nullptr);
+    vkDestroyPipeline(d.device, d.depthPrepassPipeline, nullptr);
+    vkDestroyPipeline(d.device, d.pipeline, nullptr);
+    vkDestroyRenderPass(d.device, d.renderPass, nullptr);
+
+    sampleCount = requestedSampleCount;
+
+    create_render_pass();
+    d.pipeline = create_graphics_pipeline(d.vertexModule, d.fragmentModule, GraphicsPass::Forward);
+    d.depthPrepassPipeline = create_graphics_pipeline(d.depthModule, VK_NULL_HANDLE, GraphicsPass::DepthPrepass);
+    d.prepassShadingPipeline = create_graphics_pipeline(d.vertexModule, d.fragmentModule, GraphicsPass::PrepassShading);
+
+    create_swapchain();
+}
+
+void Renderer::record_command_buffer(uint32_t frameIndex, uint32_t imageIndex, const Scene& scene)
+{
+    const auto& frameData = d.perFrameData[frameIndex];
+
+    renderExtent = {
+        std::clamp(static_cast<uint32_t>(surfaceExtent.width * renderScale + 0.5f), 1u, surfaceExtent.width),
+        std::clamp(static_cast<uint32_t>(surfaceExtent.height * renderScale + 0.5f), 1u, surfaceExtent.height)
+    };
+
+    constexpr VkCommandBufferBeginInfo commandBufferBeginInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+
+    _imageIndex = imageIndex;
+    _frameMesh = nullptr;
+    _frameGeometry = nullptr;
+
+    // The frame is only cleared until the scene's mesh is resident
+    const auto *resolvedMesh = _assets.resolve(scene.mesh);
+    const auto resident = _residentMeshes.find(scene.mesh);
+    if (!resolvedMesh || _residentMeshes.end() == resident || !resident->second.ready)
+    {
+        check_success(vkResetCommandBuffer(frameData.commandBuffer, 0));
+        check_success(vkBeginCommandBuffer(frameData.commandBuffer, &commandBufferBeginInfo));
+            if (timestampsSupported)
+            {
+                vkCmdResetQueryPool(frameData.commandBuffer, d.timestampQueryPool, frameIndex * TIMESTAMPS_PER_FRAME, TIMESTAMPS_PER_FRAME);
+            }
+            _frameGraph.execute(frameData.commandBuffer);
+        check_success(vkEndCommandBuffer(frameData.commandBuffer));
+
+        // Nothing was drawn, so there is no depth to test the next frame against, or time to measure
+        depthPyramidValid = false;
+        timestampsWritten[frameIndex] = false;
+        return;
+    }
+
+    const auto& mesh = *resolvedMesh;
+    const auto& geometry = resident->second;
+    _frameMesh = &mesh;
+    _frameGeometry = &geometry;
+    const bool drawClusters = clusterCulling && geometry.clusterCullable;
+
+    const std::array<uint32_t, 5> dynamicOffsets = {
+        static_cast<uint32_t>(frameIndex * transformUniformStride),
+        static_cast<uint32_t>(frameIndex * instanceInputStride),
+        static_cast<uint32_t>(frameIndex * culledInstanceStride),
+        static_cast<uint32_t>(frameIndex * indirectStride),
+        static_cast<uint32_t>(frameIndex * clusterDrawStride)
+    };
+    const VkDeviceSize uniformOffset = dynamicOffsets[0];
+    const VkDeviceSize indirectOffset = dynamicOffsets[3];
+    const VkDeviceSize clusterDrawOffset = dynamicOffsets[4];
+
+    const glm::vec2 renderSize(renderExtent.width, renderExtent.height);
+
+    constexpr glm::vec3 cameraUp{ 0, 1, 0 };
+    const auto viewMatrix = glm::lookAt(scene.cameraLocation, scene.cameraTarget, cameraUp);
+
+    auto projectionMatrix = reversed_infinite_perspective(FIELD_OF_VIEW, renderSize.x / renderSize.y, NEAR_CLIP_PLANE);
+    projectionMatrix[1][1] *= -1; // Correct for OriginUpperLeft (Vulkan) vs OriginLowerLeft (GLM)
+
+    // Pixels covered by one unit at distance one, over the error in pixels a LOD may introduce
+    const float lodScale = renderSize.y / (2.0f * glm::tan(FIELD_OF_VIEW * 0.5f)) / LOD_ERROR_PIXELS;
+
+    const auto frustum = extract_frustum(projectionMatrix * viewMatrix);
+    const auto lightCount = set_lighting(scene, mesh);
+    const auto instanceCount = gpuDrivenCulling
+        ? upload_instance_inputs(frameIndex, *scene.world)
+        : upload_instances(frameIndex, *scene.world, mesh, viewMatrix, frustum, lodScale);
+
+    TransformUniforms uniforms;
+    uniforms.projectionMatrix = projectionMatrix;
+    uniforms.viewMatrix = viewMatrix;
+    uniforms.previousViewMatrix = previousViewMatrix;
+    uniforms.frustumPlanes = frustum.planes;
+    uniforms.viewFrustumPlanes = extract_frustum(projectionMatrix).planes;
+    uniforms.positionMin = glm::vec4(mesh.bounds.min, 0.0f);
+    uniforms.positionScale = glm::vec4(mesh.bounds.max - mesh.bounds.min, 0.0f);
+    uniforms.lodErrors = glm::vec4(0.0f);
+    for (size_t i = 0; i < mesh.lods.size(); ++i)
+    {
+        uniforms.lodErrors[i] = mesh.lods[i].error;
+    }
+    uniforms.boundingSphere = glm::vec4(mesh.bounds.center, mesh.bounds.radius);
+    uniforms.instanceCount = instanceCount;
+    uniforms.occlusionEnabled = occlusionCulling && depthPyramidValid;
+    uniforms.meshletCount = mesh.meshlets.size();
+    uniforms.lodCount = mesh.lods.size();
+    uniforms.lodScale = lodScale;
+    uniforms.materialCount = mesh.materials.size();
+    uniforms.firstIndex = geometry.indices.offset;
+    uniforms.vertexOffset = geometry.vertices.offset;
+    uniforms.firstMeshlet = geometry.meshlets.offset;
+
+    // Slice = log(depth) * scale + bias, so the slices split [LIGHT_GRID_NEAR, LIGHT_GRID_FAR] exponentially
+    const float lightDepthScale = LIGHT_GRID_Z / glm::log(LIGHT_GRID_FAR / LIGHT_GRID_NEAR);
+    uniforms.lightCount = lightCount;
+    uniforms.lightDepthScale = lightDepthScale;
+    uniforms.lightDepthBias = -lightDepthScale * glm::log(LIGHT_GRID_NEAR);
+    uniforms.lightTileScale = glm::vec2(LIGHT_GRID_X, LIGHT_GRID_Y) / renderSize;
+    uniforms.lightGridOffset = frameIndex * LIGHT_GRID_SIZE / sizeof(uint32_t);
+
+    void *pData;
+    vmaMapMemory(d.allocator, d.transformUniformMemory, &pData);
+        memcpy(reinterpret_cast<void *>(reinterpret_cast<uintptr_t>(pData) + uniformOffset), &uniforms, sizeof(TransformUniforms));
+        vmaFlushAllocation(d.allocator, d.transformUniformMemory, uniformOffset, sizeof(TransformUniforms));
+    vmaUnmapMemory(d.allocator, d.transformUniformMemory);
+
+    check_success(vkResetCommandBuffer(frameData.commandBuffer, 0));
+    check_success(vkBeginCommandBuffer(frameData.commandBuffer, &commandBufferBeginInfo));
+
+    if (timestampsSupported)
+    {
+        vkCmdResetQueryPool(frameData.commandBuffer, d.timestampQueryPool, frameIndex * TIMESTAMPS_PER_FRAME, TIMESTAMPS_PER_FRAME);
+    }
+    write_timestamp(frameData.commandBuffer, frameIndex, 6);
+
+    upload_lighting(frameData.commandBuffer, frameIndex);
+
+    vkCmdBindDescriptorSets(frameData.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, d.pipelineLayout, 0, 1, &d.descriptorSet, dynamicOffsets.size(), dynamicOffsets.data());
+    vkCmdBindDescriptorSets(frameData.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, d.pipelineLayout, 0, 1, &d.descriptorSet, dynamicOffsets.size(), dynamicOffsets.data());
+
+    if (gpuDrivenCulling)
+    {
+        // Every draw starts with no instances, cull.comp appends the visible ones to their LOD's draw of every material
+        MaterialDraws draws = {};
+        for (uint32_t material = 0; material < mesh.materials.size(); ++material)
+        {
+            for (uint32_t i = 0; i < mesh.lods.size(); ++i)
+            {
+                const auto range = material_range(mesh, i, material);
+                draws[material].commands[i].indexCount = range.indexCount;
+                draws[material].commands[i].firstIndex = geometry.indices.offset + range.firstIndex;
+                draws[material].commands[i].vertexOffset = geometry.vertices.offset;
+                draws[material].commands[i].firstInstance = i * MAX_ENTITIES;
+            }
+        }
+        vkCmdUpdateBuffer(frameData.commandBuffer, d.indirectBuffer, indirectOffset, sizeof(MaterialDraws), &draws);
+
+        if (drawClusters)
+        {
+            // One draw per visible (instance, meshlet) pair of the material, and one per coarser LOD passed through whole
+            _frameClusterDraws = std::min(instanceCount * geometry.maxMaterialMeshlets + MAX_INDIRECT_DRAWS - 1, maxClusterDraws);
+
+            // With a count buffer only the counts are read. Without one every command up to the bound is issued, so
+            // those cluster culling doesn't append must be zeroed into empty draws.
+            const VkDeviceSize clearSize = INDIRECT_COMMANDS_OFFSET
+                + (cmdDrawIndexedIndirectCount ? 0 : _frameClusterDraws * sizeof(VkDrawIndexedIndirectCommand));
+            for (uint32_t material = 0; material < mesh.materials.size(); ++material)
+            {
+                vkCmdFillBuffer(frameData.commandBuffer, d.clusterDrawBuffer, clusterDrawOffset + material * clusterDrawListSize, clearSize, 0);
+            }
+        }
+
+        // Also orders the cull after the previous frame's depth pyramid writes
+        VkMemoryBarrier resetBarrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+        resetBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        resetBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+        // A new pyramid has never been written, so there is nothing to preserve
+        VkImageMemoryBarrier depthPyramidBarrier = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+        depthPyramidBarrier.srcAccessMask = 0;
+        depthPyramidBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        depthPyramidBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        depthPyramidBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+        depthPyramidBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        depthPyramidBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        depthPyramidBarrier.image = d.depthPyramidImage;
+        depthPyramidBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, depthPyramidLevels, 0, 1 };
+
+        const uint32_t numImageBarriers = depthPyramidValid ? 0 : 1;
+
+        vkCmdPipelineBarrier(frameData.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+            1, &resetBarrier, 0, nullptr, numImageBarriers, &depthPyramidBarrier);
+
+        vkCmdBindPipeline(frameData.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, d.cullPipeline);
+        vkCmdDispatch(frameData.commandBuffer, (instanceCount + CULL_WORKGROUP_SIZE - 1) / CULL_WORKGROUP_SIZE, 1, 1);
+
+        if (drawClusters)
+        {
+            VkMemoryBarrier instanceBarrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+            instanceBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+            instanceBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+            vkCmdPipelineBarrier(frameData.commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                1, &instanceBarrier, 0, nullptr, 0, nullptr);
+
+            // One invocation per (instance, meshlet), those past the visible instance count exit early. Any visible
+            // instance makes for at least one workgroup, enough for the invocations forwarding the coarser LODs.
+            const uint32_t numClusters = instanceCount * mesh.meshlets.size();
+            vkCmdBindPipeline(frameData.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, d.clusterCullPipeline);
+            vkCmdDispatch(frameData.commandBuffer, (numClusters + CULL_WORKGROUP_SIZE - 1) / CULL_WORKGROUP_SIZE, 1, 1);
+        }
+
+        VkMemoryBarrier cullBarrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+        cullBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        cullBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+
+        vkCmdPipelineBarrier(frameData.commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0,
+            1, &cullBarrier, 0, nullptr, 0, nullptr);
+    }
+
+    // One invocation per light cluster, so shading only loops over the lights that reach its fragment
+    vkCmdBindPipeline(frameData.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, d.lightCullPipeline);
+    vkCmdDispatch(frameData.commandBuffer, (LIGHT_GRID_CLUSTERS + LIGHT_CULL_WORKGROUP_SIZE - 1) / LIGHT_CULL_WORKGROUP_SIZE, 1, 1);
+
+    VkMemoryBarrier lightGridBarrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+    lightGridBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    lightGridBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+    vkCmdPipelineBarrier(frameData.commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+        1, &lightGridBarrier, 0, nullptr, 0, nullptr);
+
+    render_shadows(frameData.commandBuffer, frameIndex, scene.mesh, *scene.world, mesh, geometry);
+
+    _frameGraph.execute(frameData.commandBuffer);
+    timestampsWritten[frameIndex] = timestampsSupported;
+
+    previousViewMatrix = viewMatrix;
+
+    check_success(vkEndCommandBuffer(frameData.commandBuffer));
+}
+
+// Issues the scene's draws with whichever pipeline is bound, the depth prepass doesn't need the materials
+void Renderer::draw_scene(VkCommandBuffer commandBuffer, uint32_t frameIndex, const Mesh& mesh, const MeshGeometry& geometry, bool depthOnly)
+{
+    const bool drawClusters = clusterCulling && geometry.clusterCullable;
+    const VkDeviceSize indirectOffset = frameIndex * indirectStride;
+    const VkDeviceSize clusterDrawOffset = frameIndex * clusterDrawStride;
+
+    // Draws are grouped by material, so each material is set once
+    for (uint32_t material = 0; material < mesh.materials.size(); ++material)
+    {
+        if (!depthOnly)
+        {
+            const PushConstants pushConstants = { material };
+            vkCmdPushConstants(commandBuffer, d.pipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(PushConstants), &pushConstants);
+        }
+
+        if (!gpuDrivenCulling)
+        {
+            uint32_t firstInstance = 0;
+            for (uint32_t i = 0; i < mesh.lods.size(); ++i)
+            {
+                const auto range = material_range(mesh, i, material);
+                if (_lodInstanceCounts[i] && range.indexCount)
+                {
+                    vkCmdDrawIndexed(commandBuffer, range.indexCount, _lodInstanceCounts[i],
+                        geometry.indices.offset + range.firstIndex, geometry.vertices.offset, firstInstance);
+                }
+                firstInstance += _lodInstanceCounts[i];
+            }
+        }
+        else if (drawClusters)
+        {
+            draw_indirect(commandBuffer, d.clusterDrawBuffer, clusterDrawOffset + material * clusterDrawListSize, _frameClusterDraws);
+        }
+        else
+        {
+            draw_indirect(commandBuffer, d.indirectBuffer, indirectOffset + material * sizeof(IndirectDraws), MAX_INDIRECT_DRAWS);
+        }
+    }
+}
+
+// Brings the sampled shadow atlas up to date for this frame's shadow casting lights. A light's props are only redrawn
+// into the static atlas when it moves, or the mesh or props change. The sampled atlas is restored from it for the faces
+// fighters or projectiles are in, or were in last frame, and they are drawn over it.
+void Renderer::render_shadows(VkCommandBuffer commandBuffer, uint32_t frameIndex, MeshHandle meshHandle, const World& world, const Mesh& mesh,
+    const MeshGeometry& geometry)
+{
+    if (meshHandle != _shadowMesh || world.props.count != _shadowPropCount)
+    {
+        for (auto& cache : _shadowCaches)
+        {
+            cache.valid = false;
+        }
+        _shadowMesh = meshHandle;
+        _shadowPropCount = world.props.count;
+    }
+
+    const auto in_frustum = [&](const Frustum& frustum, const auto& archetype)
+    {
+        return 0 < cull_instances(frustum, mesh.bounds.center, mesh.bounds.radius,
+            archetype.positions.data(), archetype.rotations.data(), archetype.count, _visibleIndices.data());
+    };
+
+    // Tiles are numbered row by row, light by light
+    std::vector<uint32_t> staticTiles, restoredTiles, dynamicTiles;
+    for (uint32_t light = 0; light < _shadowLightCount; ++light)
+    {
+        auto& cache = _shadowCaches[light];
+        const auto& position = _shadowLightPositions[light];
+        const bool staticDirty = !cache.valid || position != cache.position;
+        cache.position = position;
+        cache.valid = true;
+
+        for (uint32_t face = 0; face < RENDERER_SHADOW_FACES; ++face)
+        {
+            const uint32_t tile = light * RENDERER_SHADOW_FACES + face;
+            const auto frustum = extract_frustum(_shadowFaces[face] * glm::translate(-position));
+            const bool dynamic = in_frustum(frustum, world.fighters) || in_frustum(frustum, world.projectiles);
+
+            if (staticDirty)
+            {
+                staticTiles.push_back(tile);
+            }
+            if (staticDirty || dynamic || cache.dynamic[face])
+            {
+                restoredTiles.push_back(tile);
+            }
+            if (dynamic)
+            {
+                dynamicTiles.push_back(tile);
+            }
+            cache.dynamic[face] = dynamic;
+        }
+    }
+
+    // Model matrices, as the face matrices include the light's view
+    const VkDeviceSize instanceOffset = frameIndex * sizeof(InstanceStream);
+    const uint32_t dynamicCount = world.fighters.count + world.projectiles.count;
+    {
+        void *pData;
+        check_success(vmaMapMemory(d.allocator, d.shadowInstanceMemory, &pData));
+
+        auto& stream = *reinterpret_cast<InstanceStream *>(reinterpret_cast<uintptr_t>(pData) + instanceOffset);
+
+        const glm::mat4 identity(1.0f);
+        _transformKernel(identity, world.fighters.positions.data(), world.fighters.rotations.data(), world.fighters.count, stream.data());
+        _transformKernel(identity, world.projectiles.positions.data(), world.projectiles.rotations.data(), world.projectiles.count,
+            stream.data() + world.fighters.count);
+        if (!staticTiles.empty())
+        {
+            _transformKernel(identity, world.props.positions.data(), world.props.rotations.data(), world.props.count,
+                stream.data() + SHADOW_STATIC_FIRST_INSTANCE);
+        }
+
+        vmaFlushAllocation(d.allocator, d.shadowInstanceMemory, instanceOffset, sizeof(InstanceStream));
+        vmaUnmapMemory(d.allocator, d.shadowInstanceMemory);
+    }
+
+    const auto transition = [&](VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, VkPipelineStageFlags srcStageMask,
+        VkAccessFlags srcAccessMask, VkPipelineStageFlags dstStageMask, VkAccessFlags dstAccessMask)
+    {
+        VkImageMemoryBarrier barrier = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+        barrier.srcAccessMask = srcAccessMask;
+        barrier.dstAccessMask = dstAccessMask;
+        barrier.oldLayout = oldLayout;
+        barrier.newLayout = newLayout;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = image;
+        barrier.subresourceRange = { VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1 };
+
+        vkCmdPipelineBarrier(commandBuffer, srcStageMask, dstStageMask, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+    };
+
+    constexpr VkPipelineStageFlags fragmentTests = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    constexpr VkAccessFlags depthAccess = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+    // Both atlases rest in the layout they are next used in, the sampled one starts out with no shadows at all
+    if (!_shadowAtlasesInitialized)
+    {
+        transition(d.staticShadowImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0, VK_PIPELINE_STAGE_TRANSFER_BIT, 0);
+        transition(d.shadowImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+
+        VkClearDepthStencilValue clearValue = { 0.0f, 0 };
+        const VkImageSubresourceRange subresourceRange = { VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1 };
+        vkCmdClearDepthStencilImage(commandBuffer, d.shadowImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &clearValue, 1, &subresourceRange);
+
+        transition(d.shadowImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+        _shadowAtlasesInitialized = true;
+    }
+
+    const auto tile_offset = [](uint32_t tile)
+    {
+        return VkOffset2D{ static_cast<int32_t>(tile % RENDERER_SHADOW_FACES * SHADOW_TILE_SIZE),
+            static_cast<int32_t>(tile / RENDERER_SHADOW_FACES * SHADOW_TILE_SIZE) };
+    };
+
+    // LOD 0 only, coarser LODs would shadow the surfaces they approximate
+    const auto render_tiles = [&](VkFramebuffer framebuffer, const std::vector<uint32_t>& tiles, bool clear, uint32_t firstInstance,
+        uint32_t instanceCount)
+    {
+        VkRenderPassBeginInfo renderPassBeginInfo = { VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO };
+        renderPassBeginInfo.renderPass = d.shadowRenderPass;
+        renderPassBeginInfo.framebuffer = framebuffer;
+        renderPassBeginInfo.renderArea = {{}, SHADOW_ATLAS_EXTENT};
+
+        const std::array<VkBuffer, 2> vertexBuffers = { d.vertexBuffer, d.shadowInstanceBuffer };
+        const std::array<VkDeviceSize, 2> vertexOffsets = { 0, instanceOffset };
+
+        vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, d.shadowPipeline);
+            vkCmdBindVertexBuffers(commandBuffer, 0, vertexBuffers.size(), vertexBuffers.data(), vertexOffsets.data());
+            vkCmdBindIndexBuffer(commandBuffer, d.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+
+            for (const auto tile : tiles)
+            {
+                const VkRect2D rect = { tile_offset(tile), { SHADOW_TILE_SIZE, SHADOW_TILE_SIZE } };
+                const VkViewport viewport = { static_cast<float>(rect.offset.x), static_cast<float>(rect.offset.y),
+                    static_cast<float>(SHADOW_TILE_SIZE), static_cast<float>(SHADOW_TILE_SIZE), 0.0f, 1.0f };
+                vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+                vkCmdSetScissor(commandBuffer, 0, 1, &rect);
+
+                if (clear)
+                {
+                    VkClearAttachment clearAttachment = {};
+                    clearAttachment.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+                    clearAttachment.clearValue.depthStencil = { 0.0f, 0 };
+                    const VkClearRect clearRect = { rect, 0, 1 };
+                    vkCmdClearAttachments(commandBuffer, 1, &clearAttachment, 1, &clearRect);
+                }
+
+                const auto& position = _shadowLightPositions[tile / RENDERER_SHADOW_FACES];
+                const ShadowPushConstants pushConstants = { _shadowFaces[tile % RENDERER_SHADOW_FACES] * glm::translate(-position) };
+                vkCmdPushConstants(commandBuffer, d.pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, SHADOW_PUSH_CONSTANTS_OFFSET,
+                    sizeof(ShadowPushConstants), &pushConstants);
+
+                for (uint32_t material = 0; material < mesh.materials.size() && instanceCount; ++material)
+                {
+                    const auto range = material_range(mesh, 0, material);
+                    if (range.indexCount)
+                    {
+                        vkCmdDrawIndexed(commandBuffer, range.indexCount, instanceCount,
+                            geometry.indices.offset + range.firstIndex, geometry.vertices.offset, firstInstance);
+                    }
+                }
+            }
+
+        vkCmdEndRenderPass(commandBuffer);
+    };
+
+    if (!staticTiles.empty())
+    {
+        transition(d.staticShadowImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, 0, fragmentTests, depthAccess);
+        render_tiles(d.staticShadowFramebuffer, staticTiles, true, SHADOW_STATIC_FIRST_INSTANCE, world.props.count);
+        transition(d.staticShadowImage, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            fragmentTests, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+    }
+
+    if (restoredTiles.empty())
+    {
+        return;
+    }
+
+    // Earlier frames may still be shading with the sampled atlas
+    transition(d.shadowImage, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+
+    std::vector<VkImageCopy> regions;
+    for (const auto tile : restoredTiles)
+    {
+        const auto offset = tile_offset(tile);
+
+        VkImageCopy region = {};
+        region.srcSubresource = { VK_IMAGE_ASPECT_DEPTH_BIT, 0, 0, 1 };
+        region.srcOffset = { offset.x, offset.y, 0 };
+        region.dstSubresource = { VK_IMAGE_ASPECT_DEPTH_BIT, 0, 0, 1 };
+        region.dstOffset = { offset.x, offset.y, 0 };
+        region.extent = { SHADOW_TILE_SIZE, SHADOW_TILE_SIZE, 1 };
+        regions.push_back(region);
+    }
+    vkCmdCopyImage(commandBuffer, d.staticShadowImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, d.shadowImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        regions.size(), regions.data());
+
+    if (dynamicTiles.empty())
+    {
+        transition(d.shadowImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+        return;
+    }
+
+    transition(d.shadowImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, fragmentTests, depthAccess);
+    render_tiles(d.shadowFramebuffer, dynamicTiles, false, 0, dynamicCount);
+    transition(d.shadowImage, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL,
+        fragmentTests, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+}
+
+void Renderer::read_timestamps(uint32_t frameIndex)
+{
+    if (!timestampsWritten[frameIndex])
+    {
+        return;
+    }
+
+    // The frame's fence has been waited on, so its queries are available
+    std::array<uint64_t, TIMESTAMPS_PER_FRAME> timestamps;
+    check_success(vkGetQueryPoolResults(d.device, d.timestampQueryPool, frameIndex * TIMESTAMPS_PER_FRAME, TIMESTAMPS_PER_FRAME,
+        sizeof(timestamps), timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT));
+
+    const float millisecondsPerTick = physicalDeviceProperties.limits.timestampPeriod / 1e6f;
+    _timings.depthPrepass = (timestamps[1] - timestamps[0]) * millisecondsPerTick;
+    _timings.shading = (timestamps[2] - timestamps[1]) * millisecondsPerTick;
+    _timings.depthPyramid = (timestamps[7] - timestamps[2]) * millisecondsPerTick;
+    _timings.bloomDownsample = (timestamps[3] - timestamps[7]) * millisecondsPerTick;
+    _timings.bloomUpsample = (timestamps[4] - timestamps[3]) * millisecondsPerTick;
+    _timings.tonemap = (timestamps[5] - timestamps[4]) * millisecondsPerTick;
+    _timings.frame = (timestamps[4] - timestamps[6]) * millisecondsPerTick;
+
+    scale_resolution();
+}
+
+// Most of the frame's cost is per pixel, which goes with the square of the scale, so the scale moves by the square root
+// of how far the frame time is off target. Steps are limited and small errors ignored so it settles rather than
+// oscillating with the timings' lag.
+void Renderer::scale_resolution()
+{
+    if (frameTimeBudget <= 0.0f)
+    {
+        return;
+    }
+
+    const float target = frameTimeBudget * (1.0f - DYNAMIC_RESOLUTION_HEADROOM);
+    const float ratio = target / std::max(_timings.frame, 1e-3f);
+    if (glm::abs(ratio - 1.0f) < DYNAMIC_RESOLUTION_TOLERANCE)
+    {
+        return;
+    }
+
+    const float step = glm::clamp(glm::sqrt(ratio), 1.0f - DYNAMIC_RESOLUTION_MAX_STEP, 1.0f + DYNAMIC_RESOLUTION_MAX_STEP);
+    renderScale = glm::clamp(renderScale * step, DYNAMIC_RESOLUTION_MIN_SCALE, 1.0f);
+}
+
+// Each timestamp waits for everything before it, so the passes are timed without the culling in front of them
+void Renderer::write_timestamp(VkCommandBuffer commandBuffer, uint32_t frameIndex, uint32_t query) const
+{
+    if (timestampsSupported)
+    {
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, d.timestampQueryPool, frameIndex * TIMESTAMPS_PER_FRAME + query);
+    }
+}
+
+void Renderer::draw_indirect(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset, uint32_t maxDraws)
+{
+    const VkDeviceSize commandsOffset = offset + INDIRECT_COMMANDS_OFFSET;
+
+    if (cmdDrawIndexedIndirectCount)
+    {
+        cmdDrawIndexedIndirectCount(commandBuffer, buffer, commandsOffset, buffer, offset, maxDraws, sizeof(VkDrawIndexedIndirectCommand));
+    }
+    else if (multiDrawIndirectSupported)
+    {
+        // Empty draws have an instanceCount of zero, so issuing all of them is still correct
+        vkCmdDrawIndexedIndirect(commandBuffer, buffer, commandsOffset, maxDraws, sizeof(VkDrawIndexedIndirectCommand));
+    }
+    else
+    {
+        for (uint32_t i = 0; i < maxDraws; ++i)
+        {
+            vkCmdDrawIndexedIndirect(commandBuffer, buffer, commandsOffset + i * sizeof(VkDrawIndexedIndirectCommand), 1, sizeof(VkDrawIndexedIndirectCommand));
+        }
+    }
+}
+
+void Renderer::reduce_depth_pyramid(VkCommandBuffer commandBuffer)
+{
+    if (!_frameMesh)
+    {
+        return;
+    }
+
+    // The frame graph makes depth visible to compute, this also waits for this frame's cull to stop reading the pyramid
+    VkMemoryBarrier cullReadBarrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+    cullReadBarrier.srcAccessMask = 0;
+    cullReadBarrier.dstAccessMask = 0;
+
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+        1, &cullReadBarrier, 0, nullptr, 0, nullptr);
+
+    // Level 0 reduces the depth attachment, which has every sample to look at when multisampled
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+        VK_SAMPLE_COUNT_1_BIT != sampleCount ? d.depthPyramidMsPipeline : d.depthPyramidPipeline);
+
+    for (uint32_t i = 0; i < depthPyramidLevels; ++i)
+    {
+        if (1 == i && VK_SAMPLE_COUNT_1_BIT != sampleCount)
+        {
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, d.depthPyramidPipeline);
+        }
+
+        const uint32_t levelWidth = std::max(depthPyramidExtent.width >> i, 1u);
+        const uint32_t levelHeight = std::max(depthPyramidExtent.height >> i, 1u);
+
+        const DepthPyramidPushConstants pushConstants = { 0 == i
+            ? glm::ivec2(renderExtent.width, renderExtent.height)
+            : glm::ivec2(std::max(depthPyramidExtent.width >> (i - 1), 1u), std::max(depthPyramidExtent.height >> (i - 1), 1u)) };
+
+        vkCmdPushConstants(commandBuffer, d.depthPyramidPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(DepthPyramidPushConstants), &pushConstants);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, d.depthPyramidPipelineLayout, 0, 1, &d.depthPyramidSets[i], 0, nullptr);
+        vkCmdDispatch(commandBuffer, (levelWidth + DEPTH_PYRAMID_WORKGROUP_SIZE - 1) / DEPTH_PYRAMID_WORKGROUP_SIZE,
+            (levelHeight + DEPTH_PYRAMID_WORKGROUP_SIZE - 1) / DEPTH_PYRAMID_WORKGROUP_SIZE, 1);
+
+        VkMemoryBarrier levelBarrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+        levelBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        levelBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+            1, &levelBarrier, 0, nullptr, 0, nullptr);
+    }
+
+    depthPyramidValid = true;
+}
+
+// The passes after culling and shadows, see build_frame_graph. They record what record_command_buffer left in
+// _frameMesh, _frameGeometry and _imageIndex.
+void Renderer::render_scene(VkCommandBuffer commandBuffer)
+{
+    std::array<VkClearValue, 2> clearValues;
+    clearValues[0].color = { 0.0f, 0.0f, 0.0f, 1.0f };
+    clearValues[1].depthStencil = { 0.0f, 0 }; // Infinitely far, depth is reversed
+
+    VkRenderPassBeginInfo renderPassBeginInfo = { VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO };
+    renderPassBeginInfo.renderPass = d.renderPass;
+    renderPassBeginInfo.framebuffer = d.sceneFramebuffer;
+    renderPassBeginInfo.renderArea = {{}, renderExtent};
+    renderPassBeginInfo.clearValueCount = clearValues.size();
+    renderPassBeginInfo.pClearValues = clearValues.data();
+
+    // The frame is only cleared until the scene's mesh is resident
+    if (!_frameMesh)
+    {
+        vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+        vkCmdEndRenderPass(commandBuffer);
+        return;
+    }
+
+    const auto& mesh = *_frameMesh;
+    const auto& geometry = *_frameGeometry;
+
+    const std::array<VkRect2D, 1> scissors = {{
+        {{0, 0}, renderExtent}
+    }};
+
+    const std::array<VkViewport, 1> viewports = {{
+        { 0.0f, 0.0f, static_cast<float>(renderExtent.width), static_cast<float>(renderExtent.height), 0.0f, 1.0f }
+    }};
+
+    const std::array<VkBuffer, 2> vertexBuffers = { d.vertexBuffer, gpuDrivenCulling ? d.culledInstanceBuffer : d.instanceBuffer };
+    const std::array<VkDeviceSize, 2> vertexOffsets = { 0, gpuDrivenCulling ? frameIndex * culledInstanceStride : frameIndex * sizeof(InstanceStream) };
+    static_assert(vertexBuffers.size() == vertexOffsets.size());
+
+    vkCmdSetScissor(commandBuffer, 0, scissors.size(), scissors.data());
+    vkCmdSetViewport(commandBuffer, 0, viewports.size(), viewports.data());
+
+    write_timestamp(commandBuffer, frameIndex, 0);
+    vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+        vkCmdBindVertexBuffers(commandBuffer, 0, vertexBuffers.size(), vertexBuffers.data(), vertexOffsets.data());
+        vkCmdBindIndexBuffer(commandBuffer, d.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+
+        // The same draws twice, depth testing within a subpass follows submission order so the shading draws see
+        // the finished depth
+        if (depthPrepass)
+        {
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, d.depthPrepassPipeline);
+            draw_scene(commandBuffer, frameIndex, mesh, geometry, true);
+        }
+        write_timestamp(commandBuffer, frameIndex, 1);
+
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, depthPrepass ? d.prepassShadingPipeline : d.pipeline);
+        draw_scene(commandBuffer, frameIndex, mesh, geometry, false);
+
+    vkCmdEndRenderPass(commandBuffer);
+    write_timestamp(commandBuffer, frameIndex, 2);
+}
+
+// Bloom is downsampled from the lit scene level by level, then upsampled back up with each level adding onto the one
+// above it. Compositing it, tonemapping and grading are merged into the one pass writing the swapchain image, so the
+// full resolution image is only read once more.
+void Renderer::bloom_downsample(VkCommandBuffer commandBuffer)
+{
+    write_timestamp(commandBuffer, frameIndex, 7);
+
+    // Only the first level reads the scene and is thresholded, the ones after it downsample what already passed
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, d.bloomDownPipeline);
+    for (uint32_t i = 0; i < bloomLevels; ++i)
+    {
+        if (i > 0)
+        {
+            level_barrier(commandBuffer);
+        }
+
+        const BloomPushConstants pushConstants = { 0 == i ? scene_region(renderExtent, surfaceExtent) : WHOLE_LEVEL, 0 == i ? BLOOM_THRESHOLD : 0.0f };
+        vkCmdPushConstants(commandBuffer, d.bloomPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(BloomPushConstants), &pushConstants);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, d.bloomPipelineLayout, 0, 1, &d.bloomDownSets[i], 0, nullptr);
+        dispatch_bloom_level(commandBuffer, i);
+    }
+    write_timestamp(commandBuffer, frameIndex, 3);
+}
+
+void Renderer::bloom_upsample(VkCommandBuffer commandBuffer)
+{
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, d.bloomUpPipeline);
+    for (uint32_t i = bloomLevels - 1; i > 0; --i)
+    {
+        if (i < bloomLevels - 1)
+        {
+            level_barrier(commandBuffer);
+        }
+
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, d.bloomPipelineLayout, 0, 1, &d.bloomUpSets[i - 1], 0, nullptr);
+        dispatch_bloom_level(commandBuffer, i - 1);
+    }
+    write_timestamp(commandBuffer, frameIndex, 4);
+}
+
+void Renderer::tonemap(VkCommandBuffer commandBuffer)
+{
+    const auto& imageData = d.perImageData[_imageIndex];
+
+    const VkRect2D scissor = {{0, 0}, surfaceExtent};
+    const VkViewport viewport = { 0.0f, 0.0f, static_cast<float>(surfaceExtent.width), static_cast<float>(surfaceExtent.height), 0.0f, 1.0f };
+
+    VkRenderPassBeginInfo renderPassBeginInfo = { VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO };
+    renderPassBeginInfo.renderPass = d.postRenderPass;
+    renderPassBeginInfo.framebuffer = imageData.framebuffer;
+    renderPassBeginInfo.renderArea = scissor;
+
+    // Bilinear filtering upscales a scene rendered below full resolution, sharpened to make up for the blur
+    const TonemapPushConstants tonemapPushConstants = {
+        scene_region(renderExtent, surfaceExtent),
+        UPSCALE_SHARPNESS * (1.0f - renderScale) / (1.0f - DYNAMIC_RESOLUTION_MIN_SCALE)
+    };
+
+    vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+        vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+        vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, d.tonemapPipeline);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, d.tonemapPipelineLayout, 0, 1, &d.tonemapSet, 0, nullptr);
+        vkCmdPushConstants(commandBuffer, d.tonemapPipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(TonemapPushConstants), &tonemapPushConstants);
+        vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+    vkCmdEndRenderPass(commandBuffer);
+    write_timestamp(commandBuffer, frameIndex, 5);
+}
+
+void Renderer::dispatch_bloom_level(VkCommandBuffer commandBuffer, uint32_t level) const
+{
+    const uint32_t levelWidth = std::max(bloomExtent.width >> level, 1u);
+    const uint32_t levelHeight = std::max(bloomExtent.height >> level, 1u);
+
+    vkCmdDispatch(commandBuffer, (levelWidth + BLOOM_WORKGROUP_SIZE - 1) / BLOOM_WORKGROUP_SIZE,
+        (levelHeight + BLOOM_WORKGROUP_SIZE - 1) / BLOOM_WORKGROUP_SIZE, 1);
+}
+
+uint32_t Renderer::upload_instances(uint32_t frameIndex, const World& world, const Mesh& mesh, const glm::mat4& viewMatrix, const Frustum& frustum, float lodScale)
+{
+    const VkDeviceSize instanceOffset = frameIndex * sizeof(InstanceStream);
+
+    void *pData;
+    check_success(vmaMapMemory(d.allocator, d.instanceMemory, &pData));
+
+    auto& stream = *reinterpret_cast<InstanceStream *>(reinterpret_cast<uintptr_t>(pData) + instanceOffset);
+
+    _stats = {};
+
+    _lodInstanceCounts = {};
+
+    uint32_t instanceCount = 0;
+    const auto append_instances = [&](const auto& archetype)
+    {
+        const auto numVisible = cull_instances(frustum, mesh.bounds.center, mesh.bounds.radius,
+            archetype.positions.data(), archetype.rotations.data(), archetype.count, _visibleIndices.data());
+
+        for (uint32_t i = 0; i < numVisible; ++i)
+        {
+            const auto& position = archetype.positions[_visibleIndices[i]];
+            const auto& rotation = archetype.rotations[_visibleIndices[i]];
+            const auto center = glm::vec3(viewMatrix * glm::vec4(position + rotation * mesh.bounds.center, 1.0f));
+            const auto lod = select_lod(mesh.lods, glm::length(center) - mesh.bounds.radius, lodScale);
+
+            _visiblePositions[instanceCount + i] = position;
+            _visibleRotations[instanceCount + i] = rotation;
+            _visibleLods[instanceCount + i] = lod;
+            ++_lodInstanceCounts[lod];
+        }
+        instanceCount += numVisible;
+
+        _stats.instancesTested += archetype.count;
+        _stats.instancesDrawn += numVisible;
+    };
+    append_instances(world.fighters);
+    append_instances(world.projectiles);
+    append_instances(world.props);
+
+    // Group the instances by LOD, so each LOD is a single instanced draw
+    std::array<uint32_t, MESH_MAX_LODS> lodOffsets;
+    uint32_t offset = 0;
+    for (size_t i = 0; i < MESH_MAX_LODS; ++i)
+    {
+        lodOffsets[i] = offset;
+        offset += _lodInstanceCounts[i];
+    }
+    for (uint32_t i = 0; i < instanceCount; ++i)
+    {
+        const auto slot = lodOffsets[_visibleLods[i]]++;
+        _lodPositions[slot] = _visiblePositions[i];
+        _lodRotations[slot] = _visibleRotations[i];
+    }
+
+    _transformKernel(viewMatrix, _lodPositions.data(), _lodRotations.data(), instanceCount, stream.data());
+
+    vmaFlushAllocation(d.allocator, d.instanceMemory, instanceOffset, instanceCount * sizeof(InstanceTransform));
+    vmaUnmapMemory(d.allocator, d.instanceMemory);
+
+    return instanceCount;
+}
+
+uint32_t Renderer::upload_instance_inputs(uint32_t frameIndex, const World& world)
+{
+    const VkDeviceSize inputOffset = frameIndex * instanceInputStride;
+
+    void *pData;
+    check_success(vmaMapMemory(d.allocator, d.instanceInputMemory, &pData));
+
+    auto& inputs = *reinterpret_cast<InstanceInputs *>(reinterpret_cast<uintptr_t>(pData) + inputOffset);
+
+    // Culling happens on the GPU and is never read back, so only the tested count is known here
+    _stats = {};
+
+    uint32_t instanceCount = 0;
+    const auto append_instances = [&](const auto& archetype)
+    {
+        memcpy(&inputs.rotations[instanceCount], archetype.rotations.data(), archetype.count * sizeof(glm::quat));
+        memcpy(&inputs.positions[instanceCount], archetype.positions.data(), archetype.count * sizeof(glm::vec3));
+        instanceCount += archetype.count;
+    };
+    append_instances(world.fighters);
+    append_instances(world.projectiles);
+    append_instances(world.props);
+
+    _stats.instancesTested = instanceCount;
+
+    vmaFlushAllocation(d.allocator, d.instanceInputMemory, inputOffset, sizeof(InstanceInputs));
+    vmaUnmapMemory(d.allocator, d.instanceInputMemory);
+
+    return instanceCount;
 }
\ No newline at end of file
@@ -1,26 +1,180 @@
 #pragma once
 
-#define GLM_FORCE_DEPTH_ZERO_TO_ONE
-#define GLM_FORCE_LEFT_HANDED
 #define VK_USE_PLATFORM_XCB_KHR
 
+#include "AssetManager.hpp"
+#include "Culling.hpp"
+#include "DirtyArray.hpp"
+#include "Entities.hpp"
+#include "FileWatcher.hpp"
 #include "Mesh.hpp"
+#include "OffsetAllocator.hpp"
+#include "RenderGraph.hpp"
 #include "RendererBase.hpp"
+#include "Transform.hpp"
 
 #include <glm/gtc/quaternion.hpp>
 
+#include <deque>
+#include <future>
+#include <memory>
+#include <set>
+#include <unordered_map>
+
+constexpr uint32_t RENDERER_MAX_LIGHTS = 1024;
+constexpr uint32_t RENDERER_MAX_SHADOW_LIGHTS = 4;
+constexpr uint32_t RENDERER_SHADOW_FACES = 6;
+
+// In world space, attenuating with the inverse square of distance out to a range that grows with its power
+struct PointLight
+{
+    glm::vec3 position;
+    glm::vec3 color;
+    float power;
+
+    // Only the first RENDERER_MAX_SHADOW_LIGHTS that ask for shadows get them
+    bool castsShadows;
+};
+
 struct Scene
 {
     glm::vec3 cameraLocation;
-    glm::vec3 modelLocation;
-    glm::quat modelRotation;
+    glm::vec3 cameraTarget;
+    const World *world;
+
+    // Nothing is drawn until it is resident
+    MeshHandle mesh;
+
+    // Only the lights that changed since the last frame are uploaded, so static ones are best kept at the same index
+    // Props' shadows are cached until a light casting them moves, fighters and projectiles are redrawn into them every frame.
+    const PointLight *lights;
+    uint32_t lightCount;
+};
+
+// GPU layouts of the lights and materials, see main.frag
+struct Light
+{
+    glm::vec3 position;
+    float radius;
+    glm::vec3 color;
+    float power;
+    int32_t shadowIndex; // Row of its cube faces in the shadow atlas, or -1
+    glm::vec3 _padding;
+};
+
+struct Material
+{
+    glm::vec3 ambient;
+    float _padding0;
+    glm::vec3 diffuse;
+    float _padding1;
+    glm::vec3 specular;
+    float shininess;
 };
 
 enum class RendererFlags
 {
     None = 0,
     EnableValidation = 1 << 0,
-    SupportGpuAssistedDebugging = 1 << 1
+    SupportGpuAssistedDebugging = 1 << 1,
+    GpuDrivenCulling = 1 << 2,
+    OcclusionCulling = 1 << 3, // Requires GpuDrivenCulling
+    ClusterCulling = 1 << 4, // Requires GpuDrivenCulling
+    PackedVertices = 1 << 5,
+    HotReload = 1 << 6, // Reloads meshes and shaders when their files change
+    DepthPrepass = 1 << 7 // Initial setting, see Renderer::set_depth_prepass
+};
+
+// GPU time spent in the main render pass, the depth pyramid reduction and each post processing pass, in milliseconds.
+// Lags a few frames behind, and is zero until something is drawn.
+struct RenderTimings
+{
+    float depthPrepass;
+    float shading;
+    float depthPyramid;
+    float bloomDownsample;
+    float bloomUpsample;
+    float tonemap;
+
+    // Everything before tonemapping, culling and shadows included. Tonemapping waits for the swapchain image, so isn't
+    // counted against the frame time budget.
+    float frame;
+};
+
+// Without a depth prepass the scene is drawn once, shading every fragment that passes the depth test at the time.
+// With one, depth is laid down first, then the shading draws only pass where they match it. Shadows are depth only
+// too, drawn from each shadow casting light into the shadow atlas.
+enum class GraphicsPass
+{
+    Forward,
+    DepthPrepass,
+    PrepassShading,
+    Shadow
+};
+
+// Where a mesh lives in the shared vertex, index and meshlet buffers, in elements
+struct MeshGeometry
+{
+    OffsetAllocation vertices;
+    OffsetAllocation indices;
+    OffsetAllocation meshlets;
+
+    // Whether its meshlets fit the cluster draw lists, and the most full detail meshlets of any one material
+    bool clusterCullable;
+    uint32_t maxMaterialMeshlets;
+
+    // Set once its upload has finished
+    bool ready;
+};
+
+// Part of a mesh upload still to be staged, as a range of the upload's data and where it goes in one geometry buffer
+struct GeometryCopy
+{
+    VkBuffer buffer;
+    VkDeviceSize sourceOffset;
+    VkDeviceSize destinationOffset;
+    VkDeviceSize size;
+};
+
+// Shader modules and the pipelines built from them, swapped in by a hot reload. Null handles were left unchanged.
+struct PipelineSet
+{
+    VkShaderModule vertexModule;
+    VkShaderModule fragmentModule;
+    VkShaderModule cullModule;
+    VkShaderModule depthPyramidModule;
+    VkShaderModule clusterCullModule;
+    VkShaderModule lightCullModule;
+    VkShaderModule depthModule;
+    VkShaderModule shadowModule;
+    VkShaderModule depthPyramidMsModule;
+    VkShaderModule bloomDownModule;
+    VkShaderModule bloomUpModule;
+    VkShaderModule fullscreenModule;
+    VkShaderModule tonemapModule;
+    VkPipeline pipeline;
+    VkPipeline cullPipeline;
+    VkPipeline depthPyramidPipeline;
+    VkPipeline clusterCullPipeline;
+    VkPipeline lightCullPipeline;
+    VkPipeline depthPrepassPipeline;
+    VkPipeline prepassShadingPipeline;
+    VkPipeline shadowPipeline;
+    VkPipeline depthPyramidMsPipeline;
+    VkPipeline bloomDownPipeline;
+    VkPipeline bloomUpPipeline;
+    VkPipeline tonemapPipeline;
+};
+
+// A shadow casting light's row of the shadow atlas
+struct ShadowCache
+{
+    // Where the props' shadows in the static atlas were drawn from, if valid
+    glm::vec3 position;
+    bool valid;
+
+    // Whether fighters or projectiles were drawn over each face last frame, so it has to be restored
+    std::array<bool, RENDERER_SHADOW_FACES> dynamic;
 };
 
 inline RendererFlags operator|(RendererFlags lhs, RendererFlags rhs)
@@ -40,10 +194,32 @@ public:
 #ifdef VK_USE_PLATFORM_XCB_KHR
     Renderer(RendererFlags flags, xcb_connection_t *connection, xcb_window_t window);
 #endif
+    ~Renderer();
+
+    // Loads the mesh in the background and uploads it once loaded, see AssetManager
+    MeshHandle request_mesh(const std::string& filename, AssetPriority priority);
 
     void render(const Scene& scene);
     void save_caches();
 
+    // Takes effect from the next frame, both ways are always ready
+    void set_depth_prepass(bool enabled) noexcept;
+    bool depth_prepass() const noexcept;
+
+    // Clamped to what the device supports, 1 turns MSAA off. Returns the sample count from the next frame on, changing it
+    // rebuilds the render pass and its pipelines.
+    uint32_t set_msaa_samples(uint32_t samples) noexcept;
+    uint32_t msaa_samples() const noexcept;
+
+    // Lowers the resolution the scene is rendered at while the GPU takes longer than the budget less some headroom,
+    // upscaling it to the surface, and raises it again once there is time to spare. Zero always renders at full resolution.
+    void set_frame_time_budget(float milliseconds) noexcept;
+    float render_scale() const noexcept;
+
+    // Of the last frame. With GPU driven culling the visible instances are never read back, so none count as drawn.
+    const CullStats& stats() const noexcept;
+    const RenderTimings& timings() const noexcept;
+
 private:
     void create_instance(RendererFlags flags);
     void create_surface(xcb_connection_t *connection, xcb_window_t window);
@@ -51,26 +227,175 @@ private:
     void create_device(RendererFlags flags);
     void create_upload_objects();
     void allocate_static_memory();
-    void begin_data_upload();
     void create_common();
     void create_descriptors();
     void create_pipeline();
+    void create_render_pass();
+    VkPipeline create_graphics_pipeline(VkShaderModule vertexModule, VkShaderModule fragmentModule, GraphicsPass pass) const;
+    VkPipeline create_cull_pipeline(VkShaderModule cullModule) const;
+    VkPipeline create_depth_pyramid_pipeline(VkShaderModule depthPyramidModule) const;
+    VkPipeline create_cluster_cull_pipeline(VkShaderModule clusterCullModule) const;
+    VkPipeline create_light_cull_pipeline(VkShaderModule lightCullModule) const;
+    VkPipeline create_bloom_pipeline(VkShaderModule bloomModule) const;
+    VkPipeline create_tonemap_pipeline(VkShaderModule vertexModule, VkShaderModule fragmentModule) const;
+    void create_shadow_atlases();
+    void create_color_grading();
     void create_swapchain();
-    void finish_data_upload();
+    void build_frame_graph();
+    void create_depth_pyramid();
+    void create_bloom();
+
+    void stream_meshes();
+    void upload_mesh(MeshHandle handle, const Mesh& mesh);
+    void submit_geometry_copies();
+    void release_geometry(const MeshGeometry& geometry);
+    uint32_t set_lighting(const Scene& scene, const Mesh& mesh);
+    void upload_lighting(VkCommandBuffer commandBuffer, uint32_t frameIndex);
+
+    void hot_reload();
+    void finish_pipeline_rebuild();
+    PipelineSet rebuild_pipelines(const std::set<std::string>& shaders) const;
+    void destroy_pipelines(const PipelineSet& pipelines) const;
 
     void record_command_buffer(uint32_t frameIndex, uint32_t imageIndex, const Scene& scene);
+    void read_timestamps(uint32_t frameIndex);
+    void scale_resolution();
+    uint32_t upload_instances(uint32_t frameIndex, const World& world, const Mesh& mesh, const glm::mat4& viewMatrix, const Frustum& frustum, float lodScale);
+    uint32_t upload_instance_inputs(uint32_t frameIndex, const World& world);
+    void draw_scene(VkCommandBuffer commandBuffer, uint32_t frameIndex, const Mesh& mesh, const MeshGeometry& geometry, bool depthOnly);
+    void render_shadows(VkCommandBuffer commandBuffer, uint32_t frameIndex, MeshHandle meshHandle, const World& world, const Mesh& mesh,
+        const MeshGeometry& geometry);
+    void draw_indirect(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset, uint32_t maxDraws);
+    void render_scene(VkCommandBuffer commandBuffer);
+    void reduce_depth_pyramid(VkCommandBuffer commandBuffer);
+    void bloom_downsample(VkCommandBuffer commandBuffer);
+    void bloom_upsample(VkCommandBuffer commandBuffer);
+    void tonemap(VkCommandBuffer commandBuffer);
+    void dispatch_bloom_level(VkCommandBuffer commandBuffer, uint32_t level) const;
+    void write_timestamp(VkCommandBuffer commandBuffer, uint32_t frameIndex, uint32_t query) const;
     void recreate_swapchain();
+    void rebuild_render_pass();
 
 private:
-    const Mesh _mesh;
+    AssetManager _assets;
+    const TransformKernel _transformKernel;
+
+    CullStats _stats;
+    RenderTimings _timings;
+    std::vector<uint32_t> _visibleIndices;
+    std::vector<glm::vec3> _visiblePositions;
+    std::vector<glm::quat> _visibleRotations;
+    std::vector<uint32_t> _visibleLods;
+    std::vector<glm::vec3> _lodPositions;
+    std::vector<glm::quat> _lodRotations;
+
+    // Instances in the CPU culled stream are grouped by LOD, in this many runs
+    std::array<uint32_t, MESH_MAX_LODS> _lodInstanceCounts;
+
+    OffsetAllocator _vertexAllocator;
+    OffsetAllocator _indexAllocator;
+    OffsetAllocator _meshletAllocator;
+
+    // Uploaded one at a time through the upload command buffer, in the order they finished loading, in as many
+    // submissions as it takes to fit the rest of the mesh through the staging buffer
+    std::deque<MeshHandle> _pendingUploads;
+    std::unordered_map<MeshHandle, MeshGeometry> _residentMeshes;
+    MeshHandle _uploadingMesh;
+    bool _uploadPending;
+    std::vector<uint8_t> _uploadData;
+    std::deque<GeometryCopy> _uploadCopies;
+
+    // Meshes that didn't fit the geometry buffers, queued again whenever retired geometry is freed
+    std::vector<MeshHandle> _deferredUploads;
+
+    // Geometry of evicted meshes and the frame they were evicted in, freed once no frame in flight can draw it
+    std::deque<std::pair<uint64_t, MeshGeometry>> _retiredGeometry;
+    uint64_t _frameNumber;
+
+    // The mesh whose materials are in LightingUniforms
+    MeshHandle _materialsMesh;
+
+    // Uploaded as they change, see upload_lighting
+    DirtyArray<Light> _lights;
+    DirtyArray<Material> _materials;
+    DirtyArray<glm::mat4> _shadowFaces;
+
+    // Props are drawn into the static atlas, which is copied into the sampled one before fighters and projectiles are drawn
+    // over it, only for the faces they are in
+    std::array<glm::vec3, RENDERER_MAX_SHADOW_LIGHTS> _shadowLightPositions;
+    uint32_t _shadowLightCount;
+    std::array<ShadowCache, RENDERER_MAX_SHADOW_LIGHTS> _shadowCaches;
+    MeshHandle _shadowMesh;
+    uint32_t _shadowPropCount;
+    bool _shadowAtlasesInitialized;
+
+    // Null unless hot reloading. Shaders that changed while a rebuild was running wait for the next one.
+    std::unique_ptr<FileWatcher> _watcher;
+    std::set<std::string> _changedShaders;
+    std::future<PipelineSet> _pipelineRebuild;
+
+    // Replaced pipelines and the frame they were replaced in, destroyed like retired geometry
+    std::deque<std::pair<uint64_t, PipelineSet>> _retiredPipelines;
+
+    // Rebuilt with the swapchain. Its passes record the frame's mesh, null until it is resident, and swapchain image.
+    RenderGraph _frameGraph;
+    const Mesh *_frameMesh;
+    const MeshGeometry *_frameGeometry;
+    uint32_t _imageIndex;
+
+    // The most draws cluster culling can append to one material's list this frame, at most maxClusterDraws
+    uint32_t _frameClusterDraws;
 
     VkPhysicalDevice physicalDevice;
+    VkPhysicalDeviceProperties physicalDeviceProperties;
     uint32_t queueFamilyIndex;
 
+    bool gpuDrivenCulling;
+    bool occlusionCulling;
+    bool clusterCulling;
+    bool packedVertices;
+    bool depthPrepass;
+    uint32_t maxClusterDraws;
+    VkDeviceSize clusterDrawListSize;
+    bool multiDrawIndirectSupported;
+    PFN_vkCmdDrawIndexedIndirectCountKHR cmdDrawIndexedIndirectCount;
+
+    // Per-frame slices of the dynamic buffers, padded to the device's offset alignment
+    VkDeviceSize transformUniformStride, instanceInputStride, culledInstanceStride, indirectStride, clusterDrawStride;
+
     VkQueue queue;
 
     VkSurfaceFormatKHR surfaceFormat;
+    VkFormat depthFormat;
+    VkFormat hdrFormat;
+    VkFormat shadowFormat;
+    VkFilter shadowFilter;
     VkExtent2D surfaceExtent;
 
+    // The scene is rendered into the top left renderExtent of its attachments, which are sized for the whole surface so
+    // the scale can change every frame without reallocating them
+    VkExtent2D renderExtent;
+    float renderScale;
+    float frameTimeBudget;
+
+    // The main render pass renders with sampleCount samples, resolving into the HDR image if more than one.
+    // A different requested count rebuilds it before the next frame.
+    VkSampleCountFlagBits sampleCount;
+    VkSampleCountFlagBits requestedSampleCount;
+
+    // Built from the previous frame's depth, so instances are tested against the view it was rendered with
+    VkExtent2D depthPyramidExtent;
+    uint32_t depthPyramidLevels;
+    bool depthPyramidValid;
+    glm::mat4 previousViewMatrix;
+
+    // Level 0 is half the surface size, each level after it half the one before
+    VkExtent2D bloomExtent;
+    uint32_t bloomLevels;
+
+    // Whether each frame in flight wrote its render pass timestamps, which are read back once its fence is signalled
+    bool timestampsSupported;
+    std::array<bool, RENDERER_MAX_FRAMES_IN_FLIGHT> timestampsWritten;
+
     uint32_t frameIndex;
 };
\ No newline at end of file
@@ -19,19 +19,74 @@ RendererBase::~RendererBase()
             vkDestroyFence(d.device, perFrame.fence, nullptr);
         }
      
+        vkDestroyImageView(d.device, d.colorGradingView, nullptr);
+        vmaDestroyImage(d.allocator, d.colorGradingImage, d.colorGradingMemory);
+
+        vkDestroySampler(d.device, d.shadowSampler, nullptr);
+        vkDestroyFramebuffer(d.device, d.shadowFramebuffer, nullptr);
+        vkDestroyFramebuffer(d.device, d.staticShadowFramebuffer, nullptr);
+        vkDestroyImageView(d.device, d.shadowView, nullptr);
+        vkDestroyImageView(d.device, d.staticShadowView, nullptr);
+        vmaDestroyImage(d.allocator, d.shadowImage, d.shadowMemory);
+        vmaDestroyImage(d.allocator, d.staticShadowImage, d.staticShadowMemory);
+
+        vkDestroyPipeline(d.device, d.tonemapPipeline, nullptr);
+        vkDestroyPipeline(d.device, d.bloomUpPipeline, nullptr);
+        vkDestroyPipeline(d.device, d.bloomDownPipeline, nullptr);
+        vkDestroyPipeline(d.device, d.depthPyramidMsPipeline, nullptr);
+        vkDestroyPipeline(d.device, d.shadowPipeline, nullptr);
+        vkDestroyPipeline(d.device, d.prepassShadingPipeline, nullptr);
+        vkDestroyPipeline(d.device, d.depthPrepassPipeline, nullptr);
+        vkDestroyPipeline(d.device, d.lightCullPipeline, nullptr);
+        vkDestroyPipeline(d.device, d.clusterCullPipeline, nullptr);
+        vkDestroyPipeline(d.device, d.depthPyramidPipeline, nullptr);
+        vkDestroyPipeline(d.device, d.cullPipeline, nullptr);
         vkDestroyPipeline(d.device, d.pipeline, nullptr);
+        vkDestroyRenderPass(d.device, d.postRenderPass, nullptr);
+        vkDestroyRenderPass(d.device, d.shadowRenderPass, nullptr);
         vkDestroyRenderPass(d.device, d.renderPass, nullptr);
 
         vkDestroyDescriptorPool(d.device, d.descriptorPool, nullptr);
 
+        vkDestroyQueryPool(d.device, d.timestampQueryPool, nullptr);
         vkDestroyPipelineCache(d.device, d.pipelineCache, nullptr);
+        vkDestroyShaderModule(d.device, d.tonemapModule, nullptr);
+        vkDestroyShaderModule(d.device, d.fullscreenModule, nullptr);
+        vkDestroyShaderModule(d.device, d.bloomUpModule, nullptr);
+        vkDestroyShaderModule(d.device, d.bloomDownModule, nullptr);
+        vkDestroyShaderModule(d.device, d.depthPyramidMsModule, nullptr);
+        vkDestroyShaderModule(d.device, d.shadowModule, nullptr);
+        vkDestroyShaderModule(d.device, d.depthModule, nullptr);
+        vkDestroyShaderModule(d.device, d.lightCullModule, nullptr);
+        vkDestroyShaderModule(d.device, d.clusterCullModule, nullptr);
+        vkDestroyShaderModule(d.device, d.depthPyramidModule, nullptr);
+        vkDestroyShaderModule(d.device, d.cullModule, nullptr);
         vkDestroyShaderModule(d.device, d.vertexModule, nullptr);
         vkDestroyShaderModule(d.device, d.fragmentModule, nullptr);
         vkDestroySemaphore(d.device, d.acquireCompleteSemaphore, nullptr);
+        vkDestroySampler(d.device, d.linearSampler, nullptr);
+        vkDestroySampler(d.device, d.pointSampler, nullptr);
+        vkDestroyPipelineLayout(d.device, d.tonemapPipelineLayout, nullptr);
+        vkDestroyPipelineLayout(d.device, d.bloomPipelineLayout, nullptr);
+        vkDestroyPipelineLayout(d.device, d.depthPyramidPipelineLayout, nullptr);
         vkDestroyPipelineLayout(d.device, d.pipelineLayout, nullptr);
+        vkDestroyDescriptorSetLayout(d.device, d.tonemapSetLayout, nullptr);
+        vkDestroyDescriptorSetLayout(d.device, d.bloomSetLayout, nullptr);
+        vkDestroyDescriptorSetLayout(d.device, d.depthPyramidSetLayout, nullptr);
         vkDestroyDescriptorSetLayout(d.device, d.descriptorSetLayout, nullptr);
         vkDestroyCommandPool(d.device, d.commandPool, nullptr);
 
+        vmaDestroyBuffer(d.allocator, d.shadowInstanceBuffer, d.shadowInstanceMemory);
+        vmaDestroyBuffer(d.allocator, d.lightingUploadBuffer, d.lightingUploadMemory);
+        vmaDestroyBuffer(d.allocator, d.lightGridBuffer, d.lightGridMemory);
+        vmaDestroyBuffer(d.allocator, d.lightBuffer, d.lightMemory);
+        vmaDestroyBuffer(d.allocator, d.clusterDrawBuffer, d.clusterDrawMemory);
+        vmaDestroyBuffer(d.allocator, d.meshletBuffer, d.meshletMemory);
+        vmaDestroyBuffer(d.allocator, d.indirectBuffer, d.indirectMemory);
+        vmaDestroyBuffer(d.allocator, d.culledInstanceBuffer, d.culledInstanceMemory);
+        vmaDestroyBuffer(d.allocator, d.instanceInputBuffer, d.instanceInputMemory);
+        vmaDestroyBuffer(d.allocator, d.instanceBuffer, d.instanceMemory);
+        vmaDestroyBuffer(d.allocator, d.indexBuffer, d.indexMemory);
         vmaDestroyBuffer(d.allocator, d.vertexBuffer, d.vertexMemory);
         vmaDestroyBuffer(d.allocator, d.transformUniformBuffer, d.transformUniformMemory);
         vmaDestroyBuffer(d.allocator, d.lightingUniformBuffer, d.lightingUniformMemory);
@@ -60,6 +115,50 @@ void RendererBase::destroy_swapchain()
     }
     d.perImageData.clear();
 
+    vkDestroyDescriptorPool(d.device, d.postDescriptorPool, nullptr);
+    d.postDescriptorPool = VK_NULL_HANDLE;
+
+    for (auto& levelView : d.bloomLevelViews)
+    {
+        vkDestroyImageView(d.device, levelView, nullptr);
+        levelView = VK_NULL_HANDLE;
+    }
+
+    vkDestroyImage(d.device, d.bloomImage, nullptr);
+    d.bloomImage = VK_NULL_HANDLE;
+
+    vkDestroyFramebuffer(d.device, d.sceneFramebuffer, nullptr);
+    d.sceneFramebuffer = VK_NULL_HANDLE;
+
+    vkDestroyImageView(d.device, d.hdrView, nullptr);
+    d.hdrView = VK_NULL_HANDLE;
+
+    vkDestroyImage(d.device, d.hdrImage, nullptr);
+    d.hdrImage = VK_NULL_HANDLE;
+
+    vkDestroyDescriptorPool(d.device, d.depthPyramidDescriptorPool, nullptr);
+    d.depthPyramidDescriptorPool = VK_NULL_HANDLE;
+
+    for (auto& levelView : d.depthPyramidLevelViews)
+    {
+        vkDestroyImageView(d.device, levelView, nullptr);
+        levelView = VK_NULL_HANDLE;
+    }
+
+    vkDestroyImageView(d.device, d.depthPyramidView, nullptr);
+    d.depthPyramidView = VK_NULL_HANDLE;
+
+    vmaDestroyImage(d.allocator, d.depthPyramidImage, d.depthPyramidMemory);
+    d.depthPyramidMemory = VK_NULL_HANDLE;
+    d.depthPyramidImage = VK_NULL_HANDLE;
+
+    vkDestroyImageView(d.device, d.colorView, nullptr);
+    d.colorView = VK_NULL_HANDLE;
+
+    vmaDestroyImage(d.allocator, d.colorImage, d.colorMemory);
+    d.colorMemory = VK_NULL_HANDLE;
+    d.colorImage = VK_NULL_HANDLE;
+
     vkDestroyImageView(d.device, d.depthView, nullptr);
     d.depthView = nullptr;
 
@@ -67,6 +166,12 @@ void RendererBase::destroy_swapchain()
     d.depthMemory = VK_NULL_HANDLE;
     d.depthImage = VK_NULL_HANDLE;
 
+    for (const auto memory : d.transientMemory)
+    {
+        vmaFreeMemory(d.allocator, memory);
+    }
+    d.transientMemory.clear();
+
     vkDestroySwapchainKHR(d.device, d.swapchain, nullptr);
     d.swapchain = nullptr;
 }
\ No newline at end of file
@@ -6,6 +6,8 @@
 #include <vector>
 
 constexpr uint32_t RENDERER_MAX_FRAMES_IN_FLIGHT = 2;
+constexpr uint32_t RENDERER_MAX_DEPTH_PYRAMID_LEVELS = 16;
+constexpr uint32_t RENDERER_MAX_BLOOM_LEVELS = 8;
 
 struct PerFrame
 {
@@ -52,16 +54,23 @@ protected:
         VkFence uploadFence;
 
         // Static memory
-        VkBuffer stagingBuffer, lightingUniformBuffer, transformUniformBuffer, vertexBuffer;
-        VmaAllocation stagingMemory, lightingUniformMemory, transformUniformMemory, vertexMemory;
+        VkBuffer stagingBuffer, lightingUniformBuffer, transformUniformBuffer, vertexBuffer, indexBuffer, instanceBuffer,
+            instanceInputBuffer, culledInstanceBuffer, indirectBuffer, meshletBuffer, clusterDrawBuffer, lightBuffer, lightGridBuffer,
+            lightingUploadBuffer, shadowInstanceBuffer;
+        VmaAllocation stagingMemory, lightingUniformMemory, transformUniformMemory, vertexMemory, indexMemory, instanceMemory,
+            instanceInputMemory, culledInstanceMemory, indirectMemory, meshletMemory, clusterDrawMemory, lightMemory, lightGridMemory,
+            lightingUploadMemory, shadowInstanceMemory;
 
         // Common
         VkCommandPool commandPool;
-        VkDescriptorSetLayout descriptorSetLayout;
-        VkPipelineLayout pipelineLayout;
+        VkDescriptorSetLayout descriptorSetLayout, depthPyramidSetLayout, bloomSetLayout, tonemapSetLayout;
+        VkPipelineLayout pipelineLayout, depthPyramidPipelineLayout, bloomPipelineLayout, tonemapPipelineLayout;
+        VkSampler pointSampler, linearSampler;
         VkSemaphore acquireCompleteSemaphore;
-        VkShaderModule fragmentModule, vertexModule;
+        VkShaderModule fragmentModule, vertexModule, cullModule, depthPyramidModule, clusterCullModule, lightCullModule, depthModule,
+            shadowModule, depthPyramidMsModule, bloomDownModule, bloomUpModule, fullscreenModule, tonemapModule;
         VkPipelineCache pipelineCache;
+        VkQueryPool timestampQueryPool;
         std::array<PerFrame, RENDERER_MAX_FRAMES_IN_FLIGHT> perFrameData;
 
         // Descriptors
@@ -69,14 +78,44 @@ protected:
         VkDescriptorSet descriptorSet;
 
         // Pipeline
-        VkRenderPass renderPass;
-        VkPipeline pipeline;
+        VkRenderPass renderPass, shadowRenderPass, postRenderPass;
+        VkPipeline pipeline, cullPipeline, depthPyramidPipeline, clusterCullPipeline, lightCullPipeline, depthPrepassPipeline,
+            prepassShadingPipeline, shadowPipeline, depthPyramidMsPipeline, bloomDownPipeline, bloomUpPipeline, tonemapPipeline;
+
+        // Shadows
+        VkImage staticShadowImage, shadowImage;
+        VmaAllocation staticShadowMemory, shadowMemory;
+        VkImageView staticShadowView, shadowView;
+        VkFramebuffer staticShadowFramebuffer, shadowFramebuffer;
+        VkSampler shadowSampler;
+
+        // Color grading
+        VkImage colorGradingImage;
+        VmaAllocation colorGradingMemory;
+        VkImageView colorGradingView;
 
         // Swapchain
         VkSwapchainKHR swapchain;
-        VkImage depthImage;
-        VmaAllocation depthMemory;
-        VkImageView depthView;
+        VkImage depthImage, colorImage, hdrImage;
+        VmaAllocation depthMemory, colorMemory;
+        VkImageView depthView, colorView, hdrView;
+        VkFramebuffer sceneFramebuffer;
+        std::vector<VmaAllocation> transientMemory; // Shared by the frame graph's aliased images, freed after them
+
+        // Depth pyramid
+        VkImage depthPyramidImage;
+        VmaAllocation depthPyramidMemory;
+        VkImageView depthPyramidView;
+        std::array<VkImageView, RENDERER_MAX_DEPTH_PYRAMID_LEVELS> depthPyramidLevelViews;
+        VkDescriptorPool depthPyramidDescriptorPool;
+        std::array<VkDescriptorSet, RENDERER_MAX_DEPTH_PYRAMID_LEVELS> depthPyramidSets;
+
+        // Post processing
+        VkImage bloomImage;
+        std::array<VkImageView, RENDERER_MAX_BLOOM_LEVELS> bloomLevelViews;
+        VkDescriptorPool postDescriptorPool;
+        std::array<VkDescriptorSet, RENDERER_MAX_BLOOM_LEVELS> bloomDownSets, bloomUpSets;
+        VkDescriptorSet tonemapSet;
 
         std::vector<PerImage> perImageData;
     } d;
@@ -0,0 +1,158 @@
+#include "Replay.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+constexpr char REPLAY_MAGIC[4] = { 'V', 'F', 'R', 'P' };
+constexpr uint32_t REPLAY_VERSION = 1;
+
+enum class ReplayRecordType : uint8_t
+{
+    Input = 'I',
+    Checksum = 'C'
+};
+
+struct ReplayHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t stateSize;
+    uint32_t checksumInterval;
+};
+
+template<typename T>
+static void write_pod(std::ofstream& file, const T& value)
+{
+    file.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template<typename T>
+static bool read_pod(std::ifstream& file, T& value)
+{
+    return static_cast<bool>(file.read(reinterpret_cast<char *>(&value), sizeof(T)));
+}
+
+ReplayWriter::ReplayWriter(const char *filename)
+    :_file(filename, std::ios::binary | std::ios::trunc), _runInput{}, _runLength(0)
+{
+    if (!_file)
+    {
+        throw std::runtime_error("Unable to open replay file");
+    }
+
+    ReplayHeader header = {};
+    memcpy(header.magic, REPLAY_MAGIC, sizeof(REPLAY_MAGIC));
+    header.version = REPLAY_VERSION;
+    header.stateSize = sizeof(SimulationState);
+    header.checksumInterval = REPLAY_CHECKSUM_INTERVAL;
+    write_pod(_file, header);
+}
+
+ReplayWriter::~ReplayWriter()
+{
+    flush_run();
+}
+
+void ReplayWriter::record(const TickInput& input, const SimulationState& state)
+{
+    if (_runLength && (UINT16_MAX == _runLength || memcmp(&input, &_runInput, sizeof(TickInput))))
+    {
+        flush_run();
+    }
+    _runInput = input;
+    ++_runLength;
+
+    if (0 == state.frame % REPLAY_CHECKSUM_INTERVAL)
+    {
+        flush_run();
+        write_pod(_file, ReplayRecordType::Checksum);
+        write_pod(_file, state.frame);
+        write_pod(_file, checksum(state));
+    }
+}
+
+void ReplayWriter::flush_run()
+{
+    if (_runLength)
+    {
+        write_pod(_file, ReplayRecordType::Input);
+        write_pod(_file, _runLength);
+        write_pod(_file, _runInput);
+        _runLength = 0;
+    }
+}
+
+int run_replay(const char *filename)
+{
+    std::ifstream file(filename, std::ios::binary);
+
+    ReplayHeader header;
+    if (!read_pod(file, header) || memcmp(header.magic, REPLAY_MAGIC, sizeof(REPLAY_MAGIC)))
+    {
+        printf("Error: '%s' is not a replay\n", filename);
+        return EXIT_FAILURE;
+    }
+    if (REPLAY_VERSION != header.version || sizeof(SimulationState) != header.stateSize)
+    {
+        printf("Error: '%s' was recorded by an incompatible build\n", filename);
+        return EXIT_FAILURE;
+    }
+
+    Simulation simulation;
+    uint32_t numChecksums = 0, numDesyncs = 0;
+
+    const auto start = std::chrono::steady_clock::now();
+
+    ReplayRecordType recordType;
+    while (read_pod(file, recordType))
+    {
+        switch (recordType)
+        {
+        case ReplayRecordType::Input: {
+            uint16_t runLength;
+            TickInput input;
+            if (!read_pod(file, runLength) || !read_pod(file, input))
+            {
+                puts("Error: Truncated replay");
+                return EXIT_FAILURE;
+            }
+            for (uint16_t i = 0; i < runLength; ++i)
+            {
+                simulation.advance(input);
+            }
+            break;
+        }
+        case ReplayRecordType::Checksum: {
+            uint32_t frame, expectedChecksum;
+            if (!read_pod(file, frame) || !read_pod(file, expectedChecksum))
+            {
+                puts("Error: Truncated replay");
+                return EXIT_FAILURE;
+            }
+            ++numChecksums;
+            if (frame != simulation.frame() || expectedChecksum != checksum(simulation.state()))
+            {
+                if (!numDesyncs)
+                {
+                    printf("Desync: First mismatch at frame %u\n", frame);
+                }
+                ++numDesyncs;
+            }
+            break;
+        }
+        default:
+            puts("Error: Corrupt replay");
+            return EXIT_FAILURE;
+        }
+    }
+
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    printf("replay: %u ticks in %.3fs, %.0f ticks/s, %u/%u checksums matched\n",
+        simulation.frame(), elapsed.count(), simulation.frame() / elapsed.count(), numChecksums - numDesyncs, numChecksums);
+
+    return numDesyncs ? EXIT_FAILURE : EXIT_SUCCESS;
+}
\ No newline at end of file
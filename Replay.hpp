@@ -0,0 +1,30 @@
+#pragma once
+
+#include "Simulation.hpp"
+
+#include <fstream>
+
+constexpr uint32_t REPLAY_CHECKSUM_INTERVAL = 60;
+
+// Replays are a header followed by a stream of records. Identical consecutive inputs are run-length encoded and
+// a checksum of the simulation state is written every REPLAY_CHECKSUM_INTERVAL frames for desync detection.
+class ReplayWriter
+{
+public:
+    explicit ReplayWriter(const char *filename);
+    ReplayWriter(const ReplayWriter&) = delete;
+    ~ReplayWriter();
+
+    ReplayWriter& operator=(const ReplayWriter&) = delete;
+
+    void record(const TickInput& input, const SimulationState& state);
+
+private:
+    void flush_run();
+
+    std::ofstream _file;
+    TickInput _runInput;
+    uint16_t _runLength;
+};
+
+int run_replay(const char *filename);
\ No newline at end of file
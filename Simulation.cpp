@@ -0,0 +1,159 @@
+#include "Simulation.hpp"
+
+#include <cstring>
+#include <stdexcept>
+
+constexpr float TICK_SECONDS = std::chrono::duration<float>(SIMULATION_TICK_DURATION).count();
+
+constexpr int32_t FIGHTER_HEALTH = 100;
+constexpr float FIGHTER_MOVE_SPEED = 5.0f;
+constexpr Hitbox FIGHTER_HITBOX = { { 0.0f, 0.0f, 0.0f }, { 1.0f, 1.0f, 1.0f } };
+
+constexpr float PROJECTILE_SPAWN_DISTANCE = 2.0f;
+constexpr float PROJECTILE_SPEED = 8.0f;
+constexpr uint16_t PROJECTILE_LIFETIME = 200;
+constexpr Hitbox PROJECTILE_HITBOX = { { 0.0f, 0.0f, 0.0f }, { 0.2f, 0.2f, 0.2f } };
+
+constexpr uint32_t NUM_CROWD_PROPS = 64;
+constexpr glm::vec3 CROWD_CENTER = { 1.25f, 0.0f, 6.0f };
+constexpr float CROWD_RADIUS = 16.0f;
+constexpr Hitbox PROP_HITBOX = { { 0.0f, 0.0f, 0.0f }, { 1.0f, 1.0f, 1.0f } };
+
+uint32_t checksum(const SimulationState& state)
+{
+    // FNV-1a
+    const auto bytes = reinterpret_cast<const uint8_t *>(&state);
+
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < sizeof(SimulationState); ++i)
+    {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+void init_state(SimulationState& state)
+{
+    // Zero padding too, so checksums only depend on simulated values
+    memset(&state, 0, sizeof(state));
+
+    state.cameraLocation = { 0, 1, 0 };
+
+    constexpr glm::vec3 up = { 0, 1, 0 };
+    constexpr glm::quat identity = { 1, 0, 0, 0 };
+    constexpr glm::vec3 stationary = { 0, 0, 0 };
+
+    auto& world = state.world;
+    spawn(world.fighters, { 0.0f, 0.0f, 5.0f }, identity, stationary, FIGHTER_HITBOX, 0);
+    spawn(world.fighters, { 2.5f, 0.0f, 7.0f }, identity, stationary, FIGHTER_HITBOX, 0);
+    state.fighterHealth.fill(FIGHTER_HEALTH);
+
+    for (uint32_t i = 0; i < NUM_CROWD_PROPS; ++i)
+    {
+        const float angle = i * glm::radians(360.0f) / NUM_CROWD_PROPS;
+        const glm::vec3 offset = { glm::sin(angle), 0.0f, glm::cos(angle) };
+        const auto facing = glm::angleAxis(angle + glm::radians(180.0f), up);
+        spawn(world.props, CROWD_CENTER + offset * CROWD_RADIUS, facing, stationary, PROP_HITBOX, 0);
+    }
+}
+
+void simulate_tick(SimulationState& state, const TickInput& input)
+{
+    auto& world = state.world;
+    auto& fighters = world.fighters;
+
+    const uint8_t timer = static_cast<uint8_t>(state.frame);
+
+    constexpr glm::vec3 rotationAxis = { 0, 1, 0 };
+    fighters.rotations[0] = glm::angleAxis(timer * glm::radians(360.0f) / UINT8_MAX, rotationAxis);
+
+    for (uint32_t player = 0; player < SIMULATION_NUM_PLAYERS; ++player)
+    {
+        const auto buttons = input.buttons[player];
+        const auto pressed = buttons & ~state.previousButtons[player];
+
+        glm::vec3 velocity = { 0, 0, 0 };
+        if (buttons & BUTTON_LEFT)
+        {
+            velocity.x -= FIGHTER_MOVE_SPEED;
+        }
+        if (buttons & BUTTON_RIGHT)
+        {
+            velocity.x += FIGHTER_MOVE_SPEED;
+        }
+        fighters.velocities[player] = velocity;
+
+        if (pressed & BUTTON_ATTACK)
+        {
+            const auto& position = fighters.positions[player];
+            const auto direction = glm::normalize(fighters.positions[1 - player] - position);
+            spawn(world.projectiles, position + direction * PROJECTILE_SPAWN_DISTANCE, fighters.rotations[player],
+                direction * PROJECTILE_SPEED, PROJECTILE_HITBOX, PROJECTILE_LIFETIME);
+        }
+    }
+    state.previousButtons = input.buttons;
+
+    integrate_motion(fighters, TICK_SECONDS);
+    integrate_motion(world.projectiles, TICK_SECONDS);
+    integrate_motion(world.props, TICK_SECONDS);
+    expire_entities(world);
+
+    for (uint32_t i = 0; i < fighters.count; ++i)
+    {
+        state.fighterHealth[i] -= resolve_projectile_hits(world, i);
+    }
+
+    ++state.frame;
+}
+
+Simulation::Simulation()
+    :_snapshots(SIMULATION_ROLLBACK_FRAMES)
+{
+    init_state(_state);
+    memset(_inputs.data(), 0, sizeof(_inputs));
+}
+
+void Simulation::advance(const TickInput& input)
+{
+    save_snapshot();
+    _inputs[_state.frame % SIMULATION_ROLLBACK_FRAMES] = input;
+
+    simulate_tick(_state, input);
+}
+
+void Simulation::amend_input(uint32_t frame, const TickInput& input)
+{
+    const auto currentFrame = _state.frame;
+    if (frame >= currentFrame || currentFrame - frame > SIMULATION_ROLLBACK_FRAMES)
+    {
+        throw std::out_of_range("Frame outside rollback window");
+    }
+
+    load_snapshot(frame);
+    _inputs[frame % SIMULATION_ROLLBACK_FRAMES] = input;
+
+    while (_state.frame < currentFrame)
+    {
+        advance(_inputs[_state.frame % SIMULATION_ROLLBACK_FRAMES]);
+    }
+}
+
+uint32_t Simulation::frame() const noexcept
+{
+    return _state.frame;
+}
+
+const SimulationState& Simulation::state() const noexcept
+{
+    return _state;
+}
+
+void Simulation::save_snapshot()
+{
+    memcpy(&_snapshots[_state.frame % SIMULATION_ROLLBACK_FRAMES], &_state, sizeof(SimulationState));
+}
+
+void Simulation::load_snapshot(uint32_t frame)
+{
+    memcpy(&_state, &_snapshots[frame % SIMULATION_ROLLBACK_FRAMES], sizeof(SimulationState));
+}
\ No newline at end of file
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "Entities.hpp"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+constexpr uint32_t SIMULATION_NUM_PLAYERS = 2;
+constexpr uint32_t SIMULATION_ROLLBACK_FRAMES = 16;
+constexpr auto SIMULATION_TICK_DURATION = std::chrono::milliseconds(10);
+
+static_assert(MAX_FIGHTERS == SIMULATION_NUM_PLAYERS);
+
+enum Button : uint16_t
+{
+    BUTTON_LEFT = 1 << 0,
+    BUTTON_RIGHT = 1 << 1,
+    BUTTON_UP = 1 << 2,
+    BUTTON_DOWN = 1 << 3,
+    BUTTON_ATTACK = 1 << 4
+};
+
+struct TickInput
+{
+    std::array<uint16_t, SIMULATION_NUM_PLAYERS> buttons;
+};
+
+// Everything the simulation reads or writes lives in here, so a frame can be saved and restored with memcpy.
+struct SimulationState
+{
+    uint32_t frame;
+    std::array<uint16_t, SIMULATION_NUM_PLAYERS> previousButtons;
+    std::array<int32_t, MAX_FIGHTERS> fighterHealth;
+    glm::vec3 cameraLocation;
+    World world;
+};
+
+static_assert(std::is_trivially_copyable_v<SimulationState>);
+static_assert(std::is_trivially_copyable_v<TickInput>);
+
+uint32_t checksum(const SimulationState& state);
+void init_state(SimulationState& state);
+void simulate_tick(SimulationState& state, const TickInput& input);
+
+class Simulation
+{
+public:
+    Simulation();
+
+    void advance(const TickInput& input);
+    void amend_input(uint32_t frame, const TickInput& input);
+
+    uint32_t frame() const noexcept;
+    const SimulationState& state() const noexcept;
+
+private:
+    void save_snapshot();
+    void load_snapshot(uint32_t frame);
+
+    SimulationState _state;
+
+    // Ring of the states at the start of each of the last SIMULATION_ROLLBACK_FRAMES frames, and the inputs applied to them
+    std::vector<SimulationState> _snapshots;
+    std::array<TickInput, SIMULATION_ROLLBACK_FRAMES> _inputs;
+};
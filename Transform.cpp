@@ -0,0 +1,237 @@
+#include "Transform.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+constexpr uint32_t TRANSFORM_INPUTS = 7;
+constexpr uint32_t TRANSFORM_OUTPUTS = sizeof(InstanceTransform) / sizeof(float);
+
+// Shared by every kernel. V is either float or a SIMD register with one instance per lane; the vector types rely
+// on the GCC/Clang vector extensions for arithmetic. Inputs are px, py, pz, qx, qy, qz, qw and the view matrix
+// is passed as its upper 3x4 part, view[c * 3 + r]. Outputs are the floats of InstanceTransform in order.
+template<typename V>
+static inline __attribute__((always_inline)) void compute_transforms(const V *view, const V *in, V *out)
+{
+    const V zero = {};
+    const V one = zero + 1.0f;
+
+    const V px = in[0], py = in[1], pz = in[2];
+    const V qx = in[3], qy = in[4], qz = in[5], qw = in[6];
+
+    const V x2 = qx + qx, y2 = qy + qy, z2 = qz + qz;
+    const V xx = qx * x2, yy = qy * y2, zz = qz * z2;
+    const V xy = qx * y2, xz = qx * z2, yz = qy * z2;
+    const V wx = qw * x2, wy = qw * y2, wz = qw * z2;
+
+    const V rotation[3][3] = {
+        { one - (yy + zz), xy + wz, xz - wy },
+        { xy - wz, one - (xx + zz), yz + wx },
+        { xz + wy, yz - wx, one - (xx + yy) }
+    };
+
+    V a[3][3];
+    for (uint32_t c = 0; c < 3; ++c)
+    {
+        for (uint32_t r = 0; r < 3; ++r)
+        {
+            a[c][r] = view[r] * rotation[c][0] + view[3 + r] * rotation[c][1] + view[6 + r] * rotation[c][2];
+        }
+    }
+
+    for (uint32_t c = 0; c < 3; ++c)
+    {
+        out[4 * c + 0] = a[c][0];
+        out[4 * c + 1] = a[c][1];
+        out[4 * c + 2] = a[c][2];
+        out[4 * c + 3] = zero;
+    }
+    for (uint32_t r = 0; r < 3; ++r)
+    {
+        out[12 + r] = view[r] * px + view[3 + r] * py + view[6 + r] * pz + view[9 + r];
+    }
+    out[15] = one;
+
+    // inverse(A)^T = [a1 x a2, a2 x a0, a0 x a1] / det(A)
+    V n[3][3];
+    for (uint32_t c = 0; c < 3; ++c)
+    {
+        const auto& u = a[(c + 1) % 3];
+        const auto& v = a[(c + 2) % 3];
+        n[c][0] = u[1] * v[2] - u[2] * v[1];
+        n[c][1] = u[2] * v[0] - u[0] * v[2];
+        n[c][2] = u[0] * v[1] - u[1] * v[0];
+    }
+    const V invDet = one / (a[0][0] * n[0][0] + a[0][1] * n[0][1] + a[0][2] * n[0][2]);
+
+    for (uint32_t c = 0; c < 3; ++c)
+    {
+        out[16 + 4 * c + 0] = n[c][0] * invDet;
+        out[16 + 4 * c + 1] = n[c][1] * invDet;
+        out[16 + 4 * c + 2] = n[c][2] * invDet;
+        out[16 + 4 * c + 3] = zero;
+    }
+}
+
+static void extract_view(const glm::mat4& viewMatrix, float *view)
+{
+    for (uint32_t c = 0; c < 4; ++c)
+    {
+        for (uint32_t r = 0; r < 3; ++r)
+        {
+            view[c * 3 + r] = viewMatrix[c][r];
+        }
+    }
+}
+
+void transform_instances_scalar(const glm::mat4& viewMatrix, const glm::vec3 *positions, const glm::quat *rotations, uint32_t count, InstanceTransform *out)
+{
+    float view[12];
+    extract_view(viewMatrix, view);
+
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        const float in[TRANSFORM_INPUTS] = {
+            positions[i].x, positions[i].y, positions[i].z,
+            rotations[i].x, rotations[i].y, rotations[i].z, rotations[i].w
+        };
+        compute_transforms(view, in, reinterpret_cast<float *>(&out[i]));
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static inline __attribute__((always_inline)) void store_transposed(const __m128 *soa, float *dst0, float *dst1, float *dst2, float *dst3)
+{
+    for (uint32_t i = 0; i < TRANSFORM_OUTPUTS; i += 4)
+    {
+        __m128 r0 = soa[i], r1 = soa[i + 1], r2 = soa[i + 2], r3 = soa[i + 3];
+        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+        _mm_storeu_ps(dst0 + i, r0);
+        _mm_storeu_ps(dst1 + i, r1);
+        _mm_storeu_ps(dst2 + i, r2);
+        _mm_storeu_ps(dst3 + i, r3);
+    }
+}
+
+void transform_instances_sse(const glm::mat4& viewMatrix, const glm::vec3 *positions, const glm::quat *rotations, uint32_t count, InstanceTransform *out)
+{
+    float viewScalars[12];
+    extract_view(viewMatrix, viewScalars);
+
+    __m128 view[12];
+    for (uint32_t j = 0; j < 12; ++j)
+    {
+        view[j] = _mm_set1_ps(viewScalars[j]);
+    }
+
+    uint32_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        const auto p = positions + i;
+
+        __m128 in[TRANSFORM_INPUTS];
+        in[0] = _mm_setr_ps(p[0].x, p[1].x, p[2].x, p[3].x);
+        in[1] = _mm_setr_ps(p[0].y, p[1].y, p[2].y, p[3].y);
+        in[2] = _mm_setr_ps(p[0].z, p[1].z, p[2].z, p[3].z);
+        in[3] = _mm_loadu_ps(&rotations[i + 0].x);
+        in[4] = _mm_loadu_ps(&rotations[i + 1].x);
+        in[5] = _mm_loadu_ps(&rotations[i + 2].x);
+        in[6] = _mm_loadu_ps(&rotations[i + 3].x);
+        _MM_TRANSPOSE4_PS(in[3], in[4], in[5], in[6]);
+
+        __m128 soa[TRANSFORM_OUTPUTS];
+        compute_transforms(view, in, soa);
+
+        store_transposed(soa,
+            reinterpret_cast<float *>(&out[i + 0]), reinterpret_cast<float *>(&out[i + 1]),
+            reinterpret_cast<float *>(&out[i + 2]), reinterpret_cast<float *>(&out[i + 3]));
+    }
+
+    transform_instances_scalar(viewMatrix, positions + i, rotations + i, count - i, out + i);
+}
+
+__attribute__((target("avx2,fma")))
+void transform_instances_avx2(const glm::mat4& viewMatrix, const glm::vec3 *positions, const glm::quat *rotations, uint32_t count, InstanceTransform *out)
+{
+    float viewScalars[12];
+    extract_view(viewMatrix, viewScalars);
+
+    __m256 view[12];
+    for (uint32_t j = 0; j < 12; ++j)
+    {
+        view[j] = _mm256_set1_ps(viewScalars[j]);
+    }
+
+    uint32_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        const auto p = positions + i;
+        const auto q = reinterpret_cast<const float *>(rotations + i);
+
+        __m256 in[TRANSFORM_INPUTS];
+        in[0] = _mm256_setr_ps(p[0].x, p[1].x, p[2].x, p[3].x, p[4].x, p[5].x, p[6].x, p[7].x);
+        in[1] = _mm256_setr_ps(p[0].y, p[1].y, p[2].y, p[3].y, p[4].y, p[5].y, p[6].y, p[7].y);
+        in[2] = _mm256_setr_ps(p[0].z, p[1].z, p[2].z, p[3].z, p[4].z, p[5].z, p[6].z, p[7].z);
+
+        // Row k holds rotations k and k + 4, so an in-lane 4x4 transpose yields x, y, z and w for all eight
+        __m256 r[4];
+        for (uint32_t k = 0; k < 4; ++k)
+        {
+            r[k] = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(q + 4 * k)), _mm_loadu_ps(q + 4 * (k + 4)), 1);
+        }
+        const __m256 t0 = _mm256_unpacklo_ps(r[0], r[1]);
+        const __m256 t1 = _mm256_unpackhi_ps(r[0], r[1]);
+        const __m256 t2 = _mm256_unpacklo_ps(r[2], r[3]);
+        const __m256 t3 = _mm256_unpackhi_ps(r[2], r[3]);
+        in[3] = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+        in[4] = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+        in[5] = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+        in[6] = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+
+        __m256 soa[TRANSFORM_OUTPUTS];
+        compute_transforms(view, in, soa);
+
+        __m128 lo[TRANSFORM_OUTPUTS], hi[TRANSFORM_OUTPUTS];
+        for (uint32_t j = 0; j < TRANSFORM_OUTPUTS; ++j)
+        {
+            lo[j] = _mm256_castps256_ps128(soa[j]);
+            hi[j] = _mm256_extractf128_ps(soa[j], 1);
+        }
+
+        const auto dst = reinterpret_cast<float *>(out + i);
+        store_transposed(lo, dst, dst + TRANSFORM_OUTPUTS, dst + 2 * TRANSFORM_OUTPUTS, dst + 3 * TRANSFORM_OUTPUTS);
+        store_transposed(hi, dst + 4 * TRANSFORM_OUTPUTS, dst + 5 * TRANSFORM_OUTPUTS, dst + 6 * TRANSFORM_OUTPUTS, dst + 7 * TRANSFORM_OUTPUTS);
+    }
+
+    transform_instances_sse(viewMatrix, positions + i, rotations + i, count - i, out + i);
+}
+#endif
+
+TransformKernel select_transform_kernel()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    {
+        return transform_instances_avx2;
+    }
+    return transform_instances_sse;
+#else
+    return transform_instances_scalar;
+#endif
+}
+
+const char *transform_kernel_name(TransformKernel kernel)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (transform_instances_avx2 == kernel)
+    {
+        return "avx2";
+    }
+    if (transform_instances_sse == kernel)
+    {
+        return "sse";
+    }
+#endif
+    return "scalar";
+}
\ No newline at end of file
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <cstdint>
+
+// Per-instance vertex data. The normal matrix is stored as three vec4 columns to keep every attribute 16 byte sized.
+struct InstanceTransform
+{
+    glm::mat4 modelViewMatrix;
+    glm::vec4 normalMatrix[3];
+};
+
+static_assert(sizeof(InstanceTransform) == 28 * sizeof(float));
+
+using TransformKernel = void (*)(const glm::mat4& viewMatrix, const glm::vec3 *positions, const glm::quat *rotations, uint32_t count, InstanceTransform *out);
+
+// Converts unit rotations and translations into model-view and normal matrices. The normal matrix is the
+// inverse-transpose of the upper 3x3 only, which is exact for rigid model-view transforms.
+void transform_instances_scalar(const glm::mat4& viewMatrix, const glm::vec3 *positions, const glm::quat *rotations, uint32_t count, InstanceTransform *out);
+#if defined(__x86_64__) || defined(__i386__)
+void transform_instances_sse(const glm::mat4& viewMatrix, const glm::vec3 *positions, const glm::quat *rotations, uint32_t count, InstanceTransform *out);
+void transform_instances_avx2(const glm::mat4& viewMatrix, const glm::vec3 *positions, const glm::quat *rotations, uint32_t count, InstanceTransform *out);
+#endif
+
+// Best kernel for the running CPU
+TransformKernel select_transform_kernel();
+const char *transform_kernel_name(TransformKernel kernel);
\ No newline at end of file
@@ -22,6 +22,8 @@ Window::Window(std::string_view window_name)
         xcb_screen_next(&screen);
     }
 
+    constexpr uint32_t eventMask = XCB_EVENT_MASK_KEY_PRESS | XCB_EVENT_MASK_KEY_RELEASE;
+
     _window = xcb_generate_id(_connection.get());
     xcb_create_window(
         _connection.get(),
@@ -31,7 +33,7 @@ Window::Window(std::string_view window_name)
         0, 0, 1600, 900, 0,
         XCB_WINDOW_CLASS_INPUT_OUTPUT,
         screen.data->root_visual,
-        0, nullptr
+        XCB_CW_EVENT_MASK, &eventMask
     );
 
     xcb_change_property(_connection.get(),
@@ -77,6 +79,14 @@ std::unique_ptr<Event> Window::poll_event()
         }
         break;
     }
+    case XCB_KEY_PRESS: {
+        const auto keyPress = reinterpret_cast<const xcb_key_press_event_t*>(event.get());
+        return std::unique_ptr<Event>(new KeyEvent(keyPress->detail, true));
+    }
+    case XCB_KEY_RELEASE: {
+        const auto keyRelease = reinterpret_cast<const xcb_key_release_event_t*>(event.get());
+        return std::unique_ptr<Event>(new KeyEvent(keyRelease->detail, false));
+    }
     default:
         break;
     }
@@ -7,7 +7,8 @@
 
 enum class EventType
 {
-    Quit
+    Quit,
+    Key
 };
 
 class Event
@@ -23,6 +24,22 @@ class QuitEvent : public Event
     EventType type() const noexcept final { return EventType::Quit; }
 };
 
+class KeyEvent : public Event
+{
+public:
+    KeyEvent(xcb_keycode_t keycode, bool pressed) noexcept
+        :_keycode(keycode), _pressed(pressed) { }
+
+    EventType type() const noexcept final { return EventType::Key; }
+
+    xcb_keycode_t keycode() const noexcept { return _keycode; }
+    bool pressed() const noexcept { return _pressed; }
+
+private:
+    xcb_keycode_t _keycode;
+    bool _pressed;
+};
+
 class Window
 {
 public:
@@ -1,12 +1,28 @@
+#include "Benchmark.hpp"
 #include "Renderer.hpp"
+#include "Replay.hpp"
+#include "Simulation.hpp"
 #include "Window.hpp"
 
 #include <chrono>
 #include <mutex>
 #include <queue>
 #include <thread>
+#include <vector>
 
-constexpr auto FRAME_DURATION = std::chrono::milliseconds(10);
+constexpr auto FRAME_DURATION = SIMULATION_TICK_DURATION;
+
+// The GPU gets a whole tick per frame, rendering the scene at a lower resolution if it needs to
+constexpr float FRAME_TIME_BUDGET = std::chrono::duration<float, std::milli>(FRAME_DURATION).count();
+
+// The key light sweeps across the stage once every this many ticks
+constexpr uint32_t STAGE_LIGHT_PERIOD = 600;
+constexpr PointLight PROJECTILE_LIGHT = { { 0.0f, 0.0f, 0.0f }, { 1.0f, 0.6f, 0.2f }, 0.5f };
+
+constexpr xcb_keycode_t DEPTH_PREPASS_KEY = 33; // P
+constexpr xcb_keycode_t MSAA_KEY = 58; // M
+constexpr xcb_keycode_t DYNAMIC_RESOLUTION_KEY = 27; // R
+constexpr xcb_keycode_t STATS_KEY = 28; // T
 
 static std::mutex g_eventMutex;
 static std::queue<std::unique_ptr<const Event>> g_eventQueue;
@@ -32,7 +48,68 @@ static void push_event(std::unique_ptr<const Event> event)
     g_eventQueue.emplace(std::move(event));
 }
 
-static bool process_events(Scene& scene)
+static uint16_t key_to_button(xcb_keycode_t keycode)
+{
+    // X11 keycodes on evdev-based servers
+    switch (keycode)
+    {
+    case 113: // Left
+        return BUTTON_LEFT;
+    case 114: // Right
+        return BUTTON_RIGHT;
+    case 111: // Up
+        return BUTTON_UP;
+    case 116: // Down
+        return BUTTON_DOWN;
+    case 52: // Z
+        return BUTTON_ATTACK;
+    default:
+        return 0;
+    }
+}
+
+static void toggle_depth_prepass(Renderer& renderer)
+{
+    const auto& timings = renderer.timings();
+    printf("Depth prepass %s, was %.3fms prepass + %.3fms shading\n", renderer.depth_prepass() ? "off" : "on",
+        timings.depthPrepass, timings.shading);
+
+    renderer.set_depth_prepass(!renderer.depth_prepass());
+}
+
+// Doubles the sample count until the device runs out, then turns MSAA off
+static void cycle_msaa(Renderer& renderer)
+{
+    const auto samples = renderer.msaa_samples();
+    if (renderer.set_msaa_samples(samples * 2) == samples)
+    {
+        renderer.set_msaa_samples(1);
+    }
+
+    printf("MSAA %ux\n", renderer.msaa_samples());
+}
+
+static void toggle_dynamic_resolution(Renderer& renderer, bool& enabled)
+{
+    printf("Dynamic resolution %s, was rendering at %.0f%% in %.3fms\n", enabled ? "off" : "on",
+        renderer.render_scale() * 100.0f, renderer.timings().frame);
+
+    enabled = !enabled;
+    renderer.set_frame_time_budget(enabled ? FRAME_TIME_BUDGET : 0.0f);
+}
+
+static void print_stats(const Renderer& renderer)
+{
+    const auto& timings = renderer.timings();
+    printf("GPU %.3fms at %.0f%%: prepass %.3fms, shading %.3fms, depth pyramid %.3fms, bloom %.3fms + %.3fms, tonemap %.3fms\n",
+        timings.frame, renderer.render_scale() * 100.0f, timings.depthPrepass, timings.shading, timings.depthPyramid,
+        timings.bloomDownsample, timings.bloomUpsample, timings.tonemap);
+
+    const auto& stats = renderer.stats();
+    printf("Instances: %u tested, %u drawn by CPU culling\n", stats.instancesTested, stats.instancesDrawn);
+}
+
+static bool process_events(TickInput& input, Renderer& renderer, bool& dynamicResolution)
 {
     std::unique_ptr<const Event> event;
     while (event = pop_event())
@@ -41,6 +118,36 @@ static bool process_events(Scene& scene)
         {
         case EventType::Quit:
             return false;
+        case EventType::Key: {
+            const auto& keyEvent = static_cast<const KeyEvent&>(*event);
+            if (DEPTH_PREPASS_KEY == keyEvent.keycode() && keyEvent.pressed())
+            {
+                toggle_depth_prepass(renderer);
+            }
+            if (MSAA_KEY == keyEvent.keycode() && keyEvent.pressed())
+            {
+                cycle_msaa(renderer);
+            }
+            if (DYNAMIC_RESOLUTION_KEY == keyEvent.keycode() && keyEvent.pressed())
+            {
+                toggle_dynamic_resolution(renderer, dynamicResolution);
+            }
+            if (STATS_KEY == keyEvent.keycode() && keyEvent.pressed())
+            {
+                print_stats(renderer);
+            }
+
+            const auto button = key_to_button(keyEvent.keycode());
+            if (keyEvent.pressed())
+            {
+                input.buttons[0] |= button;
+            }
+            else
+            {
+                input.buttons[0] &= ~button;
+            }
+            break;
+        }
         default:
             puts("Unhandled Event");
             break;
@@ -49,41 +156,86 @@ static bool process_events(Scene& scene)
     return true;
 }
 
-static void update_scene(Scene& scene)
+// Stage lights come first so they keep their indices, then one light per projectile
+static void make_lights(const SimulationState& state, std::vector<PointLight>& lights)
 {
-    static uint8_t timer = 0; // HACK
+    const float angle = (state.frame % STAGE_LIGHT_PERIOD) * glm::radians(360.0f) / STAGE_LIGHT_PERIOD;
 
-    constexpr glm::vec3 rotationAxis = { 0, 1, 0 };
-    scene.modelRotation = glm::angleAxis(timer++ * glm::radians(360.0f) / UINT8_MAX, rotationAxis);
+    lights.clear();
+    lights.push_back({ { 2.0f + 4.0f * glm::sin(angle), 11.0f, 0.0f }, { 1.0f, 1.0f, 1.0f }, 40.0f });
+    lights.push_back({ { 2.0f, -1.0f, 0.0f }, { 1.0f, 0.7f, 0.7f }, 4.0f });
+
+    // Stays put, so the crowd's shadows from it are only drawn once
+    lights.push_back({ { 1.25f, 6.0f, 0.0f }, { 1.0f, 0.9f, 0.8f }, 30.0f, true });
+
+    const auto& projectiles = state.world.projectiles;
+    for (uint32_t i = 0; i < projectiles.count; ++i)
+    {
+        auto light = PROJECTILE_LIGHT;
+        light.position = projectiles.positions[i];
+        lights.push_back(light);
+    }
 }
 
-static void renderer_loop(Renderer& renderer, const Window& window)
+static Scene make_scene(const SimulationState& state, MeshHandle mesh, const std::vector<PointLight>& lights)
 {
+    const auto& fighters = state.world.fighters;
+
     Scene scene = {};
-    scene.cameraLocation = { 0, 1, 0 };
-    scene.modelLocation = { 0, 0, 5 };
+    scene.cameraLocation = state.cameraLocation;
+    scene.cameraTarget = (fighters.positions[0] + fighters.positions[1]) * 0.5f;
+    scene.world = &state.world;
+    scene.mesh = mesh;
+    scene.lights = lights.data();
+    scene.lightCount = lights.size();
+    return scene;
+}
+
+static void renderer_loop(Renderer& renderer, const Window& window, ReplayWriter *replayWriter)
+{
+    // Drawn as soon as it is loaded, the simulation doesn't wait for it
+    const auto mesh = renderer.request_mesh("../models/monkey_smooth.obj", AssetPriority::Immediate);
+
+    Simulation simulation;
+    TickInput input = {};
+    std::vector<PointLight> lights;
+
+    bool dynamicResolution = true;
+    renderer.set_frame_time_budget(FRAME_TIME_BUDGET);
 
     std::chrono::steady_clock clock;
     auto lastFrameTime = clock.now();
 
-    while (process_events(scene))
+    while (process_events(input, renderer, dynamicResolution))
     {
-        renderer.render(scene);
+        make_lights(simulation.state(), lights);
+        renderer.render(make_scene(simulation.state(), mesh, lights));
         auto currentTime = clock.now();
         while (currentTime > lastFrameTime + FRAME_DURATION)
         {
             lastFrameTime += FRAME_DURATION;
-            update_scene(scene);
+            simulation.advance(input);
+
+            if (replayWriter)
+            {
+                replayWriter->record(input, simulation.state());
+            }
         }
     }
 }
 
-static void renderer_entry(const Window *window)
+static void renderer_entry(const Window *window, const char *recordFilename)
 try
 {
-    Renderer renderer(RendererFlags::SupportGpuAssistedDebugging, window->connection(), window->window());
+    std::unique_ptr<ReplayWriter> replayWriter;
+    if (recordFilename)
+    {
+        replayWriter = std::make_unique<ReplayWriter>(recordFilename);
+    }
+
+    Renderer renderer(RendererFlags::SupportGpuAssistedDebugging | RendererFlags::GpuDrivenCulling | RendererFlags::OcclusionCulling | RendererFlags::ClusterCulling | RendererFlags::PackedVertices | RendererFlags::HotReload, window->connection(), window->window());
 
-    renderer_loop(renderer, *window);
+    renderer_loop(renderer, *window, replayWriter.get());
 
     renderer.save_caches();
 }
@@ -98,10 +250,24 @@ catch (...)
     std::terminate();
 }
 
-int main()
+int main(int argc, char *argv[])
 {
+    const char *recordFilename = nullptr;
+    if (3 == argc && std::string_view("--benchmark") == argv[1])
+    {
+        return run_benchmark(argv[2]);
+    }
+    else if (3 == argc && std::string_view("--replay") == argv[1])
+    {
+        return run_replay(argv[2]);
+    }
+    else if (3 == argc && std::string_view("--record") == argv[1])
+    {
+        recordFilename = argv[2];
+    }
+
     Window window("vfighter");
-    std::thread renderer_thread(renderer_entry, &window);
+    std::thread renderer_thread(renderer_entry, &window, recordFilename);
 
     bool should_quit = false;
     while(!should_quit)
@@ -0,0 +1,44 @@
+#version 460
+
+layout(constant_id=0) const bool PACKED_VERTICES = false;
+
+// Only what main.vert needs for gl_Position, fetched from the same streams
+layout(location=0) in vec3 in_Position;
+layout(location=2) in mat4 in_ModelViewMatrix;
+
+layout(set=0, binding=0) uniform TransformUniforms {
+    mat4 u_ProjectionMatrix;
+    mat4 u_ViewMatrix;
+    mat4 u_PreviousViewMatrix;
+    vec4 u_FrustumPlanes[5];
+    vec4 u_ViewFrustumPlanes[5];
+    vec4 u_PositionMin;
+    vec4 u_PositionScale;
+    vec4 u_LodErrors;
+    vec4 u_BoundingSphere;
+    uint u_InstanceCount;
+    uint u_OcclusionEnabled;
+    uint u_MeshletCount;
+    uint u_LodCount;
+    float u_LodScale;
+    uint u_MaterialCount;
+    uint u_FirstIndex;
+    int u_VertexOffset;
+    uint u_FirstMeshlet;
+    uint u_LightCount;
+    float u_LightDepthScale;
+    float u_LightDepthBias;
+    vec2 u_LightTileScale;
+    uint u_LightGridOffset;
+};
+
+// Positions are computed exactly as in main.vert, see there
+invariant gl_Position;
+
+void main()
+{
+    vec3 position = PACKED_VERTICES ? u_PositionMin.xyz + in_Position * u_PositionScale.xyz : in_Position;
+
+    vec4 worldPosition = in_ModelViewMatrix * vec4(position, 1.0);
+    gl_Position = u_ProjectionMatrix * worldPosition;
+}
\ No newline at end of file
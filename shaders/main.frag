@@ -1,7 +1,12 @@
 #version 460
 
-layout(constant_id = 0) const uint MAX_LIGHTS = 2;
-const uint MAX_MATERIALS = 1;
+layout(constant_id=0) const uint LIGHT_GRID_X = 16;
+layout(constant_id=1) const uint LIGHT_GRID_Y = 9;
+layout(constant_id=2) const uint LIGHT_GRID_Z = 24;
+layout(constant_id=3) const uint MAX_CLUSTER_LIGHTS = 31;
+const uint MAX_MATERIALS = 16;
+const uint MAX_SHADOW_LIGHTS = 4;
+const uint SHADOW_FACES = 6;
 
 struct Material {
     vec3 ambient;
@@ -10,10 +15,13 @@ struct Material {
     float shininess;
 };
 
+// In world space
 struct Light {
     vec3 position;
+    float radius;
     vec3 color;
     float power;
+    int shadowIndex; // Row of its cube faces in the shadow atlas, or -1
 };
 
 layout(location=0) in vec3 in_Position;
@@ -23,17 +31,86 @@ layout(push_constant) uniform PushConstants {
     uint u_MaterialIndex;
 };
 
+layout(set=0, binding=0) uniform TransformUniforms {
+    mat4 u_ProjectionMatrix;
+    mat4 u_ViewMatrix;
+    mat4 u_PreviousViewMatrix;
+    vec4 u_FrustumPlanes[5];
+    vec4 u_ViewFrustumPlanes[5];
+    vec4 u_PositionMin;
+    vec4 u_PositionScale;
+    vec4 u_LodErrors;
+    vec4 u_BoundingSphere;
+    uint u_InstanceCount;
+    uint u_OcclusionEnabled;
+    uint u_MeshletCount;
+    uint u_LodCount;
+    float u_LodScale;
+    uint u_MaterialCount;
+    uint u_FirstIndex;
+    int u_VertexOffset;
+    uint u_FirstMeshlet;
+    uint u_LightCount;
+    float u_LightDepthScale;
+    float u_LightDepthBias;
+    vec2 u_LightTileScale;
+    uint u_LightGridOffset;
+};
+
 layout(std140, set=0, binding=1) uniform LightingUniforms {
-    Light u_Lights[MAX_LIGHTS];
     Material u_Materials[MAX_MATERIALS];
+    mat4 u_ShadowFaces[SHADOW_FACES]; // +X, -X, +Y, -Y, +Z, -Z around a light at the origin
 };
 
+layout(std430, set=0, binding=8) readonly buffer Lights {
+    Light u_Lights[];
+};
+
+// Written by lightcull.comp, per cluster a count followed by MAX_CLUSTER_LIGHTS light indices
+layout(std430, set=0, binding=9) readonly buffer LightGrid {
+    uint u_LightGrid[];
+};
+
+// Reversed depth of the nearest caster from each shadow casting light, compared by the sampler
+layout(set=0, binding=10) uniform sampler2DShadow u_ShadowAtlas;
+
 layout(location=0) out vec4 out_Color;
 
+// Fraction of the light reaching the fragment, filtered over 3x3 taps within the cube face it falls on
+float calculate_shadow(const in Light light, vec3 lightRel)
+{
+    // The faces are aligned to the world axes, the view matrix only rotates and translates
+    vec3 offset = -(transpose(mat3(u_ViewMatrix)) * lightRel);
+    vec3 magnitude = abs(offset);
+    uint face = magnitude.x >= magnitude.y && magnitude.x >= magnitude.z ? (offset.x >= 0.0 ? 0u : 1u)
+        : magnitude.y >= magnitude.z ? (offset.y >= 0.0 ? 2u : 3u)
+        : (offset.z >= 0.0 ? 4u : 5u);
+
+    vec4 clipPosition = u_ShadowFaces[face] * vec4(offset, 1.0);
+    vec3 shadowPosition = clipPosition.xyz / clipPosition.w;
+
+    vec2 atlasSize = vec2(textureSize(u_ShadowAtlas, 0));
+    vec2 tileSize = atlasSize / vec2(SHADOW_FACES, MAX_SHADOW_LIGHTS);
+    vec2 tileOrigin = vec2(face, light.shadowIndex) * tileSize;
+    vec2 texel = (shadowPosition.xy * 0.5 + 0.5) * tileSize;
+
+    // Taps stay a texel inside the tile, so filtering never reads a neighbouring face
+    float lit = 0.0;
+    for (int y = -1; y <= 1; ++y)
+    {
+        for (int x = -1; x <= 1; ++x)
+        {
+            vec2 tap = clamp(texel + vec2(x, y), vec2(1.0), tileSize - 1.0);
+            lit += texture(u_ShadowAtlas, vec3((tileOrigin + tap) / atlasSize, shadowPosition.z));
+        }
+    }
+    return lit / 9.0;
+}
+
 vec3 calculate_lighting(const in Material material, const in Light light)
 {
     vec3 normal = normalize(in_Normal);
-    vec3 lightRel = light.position - in_Position;
+    vec3 lightRel = (u_ViewMatrix * vec4(light.position, 1.0)).xyz - in_Position;
     vec3 lightDir = normalize(lightRel);
     
     float distance2 = pow(length(lightRel), 2);
@@ -49,18 +126,29 @@ vec3 calculate_lighting(const in Material material, const in Light light)
         specular = pow(specAngle, material.shininess);
     }
 
+    // Fades to zero at the light's radius, so clusters past it can skip the light without a visible edge
+    float window = clamp(1.0 - pow(distance2 / (light.radius * light.radius), 2), 0.0, 1.0);
+
+    float shadow = light.shadowIndex >= 0 && lambertian > 0.0 ? calculate_shadow(light, lightRel) : 1.0;
+
     vec3 baseColor = material.diffuse * lambertian + material.specular * specular;
-    return baseColor * light.color * light.power / distance2;
+    return baseColor * light.color * light.power * window * window * shadow / distance2;
 }
 
 void main()
 {
     const Material material = u_Materials[u_MaterialIndex];
 
+    uvec2 tile = min(uvec2(gl_FragCoord.xy * u_LightTileScale), uvec2(LIGHT_GRID_X, LIGHT_GRID_Y) - 1u);
+    uint slice = uint(clamp(log(in_Position.z) * u_LightDepthScale + u_LightDepthBias, 0.0, float(LIGHT_GRID_Z - 1u)));
+    uint cluster = (slice * LIGHT_GRID_Y + tile.y) * LIGHT_GRID_X + tile.x;
+    uint base = u_LightGridOffset + cluster * (MAX_CLUSTER_LIGHTS + 1);
+
     vec3 color = material.ambient;
-    for (uint i = 0; i < u_Lights.length(); ++i)
+    uint lightCount = u_LightGrid[base];
+    for (uint i = 0; i < lightCount; ++i)
     {
-        color += calculate_lighting(material, u_Lights[i]);
+        color += calculate_lighting(material, u_Lights[u_LightGrid[base + 1 + i]]);
     }
 
     out_Color = vec4(color, 1.0);
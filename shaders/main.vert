@@ -1,22 +1,62 @@
 #version 460
 
+layout(constant_id=0) const bool PACKED_VERTICES = false;
+
+// Packed vertices carry unorm16 positions within the mesh bounds and octahedral snorm16x2 normals
 layout(location=0) in vec3 in_Position;
 layout(location=1) in vec3 in_Normal;
+layout(location=2) in mat4 in_ModelViewMatrix;
+layout(location=6) in vec4 in_NormalMatrix[3];
 
 layout(set=0, binding=0) uniform TransformUniforms {
-    mat4 u_ModelViewMatrix;
     mat4 u_ProjectionMatrix;
-    mat4 u_NormalMatrix;
+    mat4 u_ViewMatrix;
+    mat4 u_PreviousViewMatrix;
+    vec4 u_FrustumPlanes[5];
+    vec4 u_ViewFrustumPlanes[5];
+    vec4 u_PositionMin;
+    vec4 u_PositionScale;
+    vec4 u_LodErrors;
+    vec4 u_BoundingSphere;
+    uint u_InstanceCount;
+    uint u_OcclusionEnabled;
+    uint u_MeshletCount;
+    uint u_LodCount;
+    float u_LodScale;
+    uint u_MaterialCount;
+    uint u_FirstIndex;
+    int u_VertexOffset;
+    uint u_FirstMeshlet;
+    uint u_LightCount;
+    float u_LightDepthScale;
+    float u_LightDepthBias;
+    vec2 u_LightTileScale;
+    uint u_LightGridOffset;
 };
 
 layout(location=0) out vec3 out_Position;
 layout(location=1) out vec3 out_Normal;
 
+// Matches depth.vert bit for bit, so shading after a depth prepass can test for equal depth
+invariant gl_Position;
+
+vec3 octahedral_decode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.xy += mix(vec2(t), vec2(-t), greaterThanEqual(n.xy, vec2(0.0)));
+    return normalize(n);
+}
+
 void main()
 {
-    vec4 worldPosition = u_ModelViewMatrix * vec4(in_Position, 1.0);
+    vec3 position = PACKED_VERTICES ? u_PositionMin.xyz + in_Position * u_PositionScale.xyz : in_Position;
+    vec3 normal = PACKED_VERTICES ? octahedral_decode(in_Normal.xy) : in_Normal;
+
+    vec4 worldPosition = in_ModelViewMatrix * vec4(position, 1.0);
     out_Position = worldPosition.xyz / worldPosition.w;
     gl_Position = u_ProjectionMatrix * worldPosition;
 
-    out_Normal = vec3(u_NormalMatrix * vec4(in_Normal, 1.0));
+    mat3 normalMatrix = mat3(in_NormalMatrix[0].xyz, in_NormalMatrix[1].xyz, in_NormalMatrix[2].xyz);
+    out_Normal = normalMatrix * normal;
 }
\ No newline at end of file
@@ -0,0 +1,45 @@
+#version 460
+
+layout(constant_id=0) const bool PACKED_VERTICES = false;
+
+// Model matrices in place of main.vert's model view matrices, the light's view is in the shadow matrix
+layout(location=0) in vec3 in_Position;
+layout(location=2) in mat4 in_ModelMatrix;
+
+// One of the light's cube face view projections, after main.frag's push constants
+layout(push_constant) uniform ShadowPushConstants {
+    layout(offset=16) mat4 u_ShadowMatrix;
+};
+
+layout(set=0, binding=0) uniform TransformUniforms {
+    mat4 u_ProjectionMatrix;
+    mat4 u_ViewMatrix;
+    mat4 u_PreviousViewMatrix;
+    vec4 u_FrustumPlanes[5];
+    vec4 u_ViewFrustumPlanes[5];
+    vec4 u_PositionMin;
+    vec4 u_PositionScale;
+    vec4 u_LodErrors;
+    vec4 u_BoundingSphere;
+    uint u_InstanceCount;
+    uint u_OcclusionEnabled;
+    uint u_MeshletCount;
+    uint u_LodCount;
+    float u_LodScale;
+    uint u_MaterialCount;
+    uint u_FirstIndex;
+    int u_VertexOffset;
+    uint u_FirstMeshlet;
+    uint u_LightCount;
+    float u_LightDepthScale;
+    float u_LightDepthBias;
+    vec2 u_LightTileScale;
+    uint u_LightGridOffset;
+};
+
+void main()
+{
+    vec3 position = PACKED_VERTICES ? u_PositionMin.xyz + in_Position * u_PositionScale.xyz : in_Position;
+
+    gl_Position = u_ShadowMatrix * (in_ModelMatrix * vec4(position, 1.0));
+}
\ No newline at end of file
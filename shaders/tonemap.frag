@@ -0,0 +1,58 @@
+#version 460
+
+const float EXPOSURE = 1.0;
+const float BLOOM_STRENGTH = 0.05;
+
+layout(set=0, binding=0) uniform sampler2D u_Scene;
+layout(set=0, binding=1) uniform sampler2D u_Bloom;
+layout(set=0, binding=2) uniform sampler3D u_ColorGrading; // Indexed by tonemapped color
+
+layout(push_constant) uniform PushConstants {
+    vec2 u_SceneScale; // Part of u_Scene the scene was rendered into
+    vec2 u_SceneMax; // Centre of its last texel, so filtering never reaches past it
+    float u_Sharpness; // Zero at full resolution
+};
+
+layout(location=0) in vec2 in_TexCoord;
+
+layout(location=0) out vec4 out_Color;
+
+// Narkowicz's fit of the ACES filmic curve, mapping [0, inf) to [0, 1]
+vec3 tonemap(vec3 color)
+{
+    const float a = 2.51;
+    const float b = 0.03;
+    const float c = 2.43;
+    const float d = 0.59;
+    const float e = 0.14;
+    return clamp((color * (a * color + b)) / (color * (c * color + d) + e), 0.0, 1.0);
+}
+
+// Bilinear, sharpened by how much the centre stands out from its neighbours one scene texel away
+vec3 upscale(vec2 uv)
+{
+    vec3 centre = texture(u_Scene, min(uv, u_SceneMax)).rgb;
+    if (u_Sharpness <= 0.0)
+    {
+        return centre;
+    }
+
+    vec2 texel = 1.0 / vec2(textureSize(u_Scene, 0));
+    vec3 neighbours = texture(u_Scene, min(uv + vec2(texel.x, 0.0), u_SceneMax)).rgb
+        + texture(u_Scene, min(uv - vec2(texel.x, 0.0), u_SceneMax)).rgb
+        + texture(u_Scene, min(uv + vec2(0.0, texel.y), u_SceneMax)).rgb
+        + texture(u_Scene, min(uv - vec2(0.0, texel.y), u_SceneMax)).rgb;
+    return max(centre + (centre * 4.0 - neighbours) * u_Sharpness, 0.0);
+}
+
+void main()
+{
+    vec3 color = upscale(in_TexCoord * u_SceneScale) + texture(u_Bloom, in_TexCoord).rgb * BLOOM_STRENGTH;
+    vec3 mapped = tonemap(color * EXPOSURE);
+
+    // Samples texel centres, so 0 and 1 land on the LUT's first and last entries
+    float lutSize = float(textureSize(u_ColorGrading, 0).x);
+    vec3 graded = texture(u_ColorGrading, mapped * ((lutSize - 1.0) / lutSize) + 0.5 / lutSize).rgb;
+
+    out_Color = vec4(graded, 1.0);
+}
\ No newline at end of file